@@ -795,13 +795,13 @@ namespace ts {
 
   case 9:
 #line 101 "bison.y"
-                                                               {printf("Found assign expression "); compiler.assignVar(compiler.getVarIndex(yystack_[2].value.as < std::string > ()), yystack_[0].value.as < size_t > (), scanner.lineno());}
+                                                               {tsLOG_DEBUG("Found assign expression"); compiler.assignVar(compiler.getVarIndex(yystack_[2].value.as < std::string > ()), yystack_[0].value.as < size_t > (), scanner.lineno());}
 #line 800 "bison.tab.cc"
     break;
 
   case 13:
 #line 108 "bison.y"
-                                                                    {printf("Found scope");}
+                                                                    {tsLOG_DEBUG("Found scope");}
 #line 806 "bison.tab.cc"
     break;
 
@@ -867,13 +867,13 @@ namespace ts {
 
   case 33:
 #line 144 "bison.y"
-                                {printf("Found identifier\n");yylhs.value.as < size_t > () = compiler.getVarIndex(yystack_[0].value.as < std::string > ());}
+                                {tsLOG_DEBUG("Found identifier");yylhs.value.as < size_t > () = compiler.getVarIndex(yystack_[0].value.as < std::string > ());}
 #line 872 "bison.tab.cc"
     break;
 
   case 34:
 #line 145 "bison.y"
-                                               {printf("completed const int\n");yylhs.value.as < size_t > () = compiler.getConst(yystack_[0].value.as < std::string > (), tsVarType::tsInt, scanner.lineno());}
+                                               {tsLOG_DEBUG("completed const int");yylhs.value.as < size_t > () = compiler.getConst(yystack_[0].value.as < std::string > (), tsVarType::tsInt, scanner.lineno());}
 #line 878 "bison.tab.cc"
     break;
 
@@ -1377,5 +1377,5 @@ namespace ts {
 
 
 void ts::tsParser::error(const location_type &l, const std::string &err_message){
-	std::cout << "Error: " << err_message << " at line " << scanner.lineno() << std::endl;
+	tsLOG_ERROR("Error: " << err_message << " at line " << scanner.lineno());
 }
@@ -98,14 +98,14 @@ variable        : tstDEF_BOOL tstIDENTIFIER {compiler.generateVar($2, tsVarType:
 				| tstDEF_INT tstIDENTIFIER {compiler.generateVar($2, tsVarType::tsInt);}
 				| tstDEF_INT tstIDENTIFIER "=" expression {tsVar var = compiler.generateVar($2, tsVarType::tsInt); compiler.assignVar(var.varIndex, $4, scanner.lineno());}
 				| tstDEF_FLOAT tstIDENTIFIER {compiler.generateVar($2, tsVarType::tsFloat);}
-				| tstIDENTIFIER "=" expression {printf("Found assign expression "); compiler.assignVar(compiler.getVarIndex($1), $3, scanner.lineno());}
+				| tstIDENTIFIER "=" expression {tsLOG_DEBUG("Found assign expression"); compiler.assignVar(compiler.getVarIndex($1), $3, scanner.lineno());}
                 ;
 
 
 statement		: preprocessor 
 				| flow 
 				| variable ";" 
-				| enterScope "{" line "}" exitScope {printf("Found scope");}
+				| enterScope "{" line "}" exitScope {tsLOG_DEBUG("Found scope");}
 				| expression ";" 
 				| tstEND ";" 
 				| ";"
@@ -141,8 +141,8 @@ expression		: expStart "+" expression exitScope {$$ = compiler.add($1, $3, scann
 				| value { $$ = $1;}
 				;
 
-value           : tstIDENTIFIER {printf("Found identifier\n");$$ = compiler.getVarIndex($1);}
-				| tstCONST_INT {printf("completed const int\n");$$ = compiler.getConst($1, tsVarType::tsInt, scanner.lineno());}
+value           : tstIDENTIFIER {tsLOG_DEBUG("Found identifier");$$ = compiler.getVarIndex($1);}
+				| tstCONST_INT {tsLOG_DEBUG("completed const int");$$ = compiler.getConst($1, tsVarType::tsInt, scanner.lineno());}
 				;
 
 enterScope		: %empty {compiler.enterScope();}
@@ -151,5 +151,5 @@ exitScope		: %empty {compiler.exitScope();}
 %%
 
 void ts::tsParser::error(const location_type &l, const std::string &err_message){
-	std::cout << "Error: " << err_message << " at line " << scanner.lineno() << std::endl;
+	tsLOG_ERROR("Error: " << err_message << " at line " << scanner.lineno());
 }
\ No newline at end of file
@@ -3,16 +3,50 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <cstddef>
 #include <map>
+#include <unordered_map>
 #include <stack>
 #include <any>
 #include <memory>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
 #include "tsMassert.h"
+#include "tsLog.h"
+
+// Labels as values let every bytecode handler jump directly to the next one, only GCC and Clang support them.
+#ifndef TS_THREADED_DISPATCH
+	#if defined(__GNUC__) || defined(__clang__)
+		#define TS_THREADED_DISPATCH 1
+	#else
+		#define TS_THREADED_DISPATCH 0
+	#endif
+#endif
+
+// Handler labels of the threaded interpreters, in command order
+#define tsDISPATCH_LABELS \
+	&&op_END, &&op_JUMP, &&op_JUMPF, &&op_ItoF, &&op_FtoI, &&op_LOAD, &&op_MOVE, \
+	&&op_FLIPI, &&op_ADDI, &&op_MULI, &&op_DIVI, \
+	&&op_FLIPF, &&op_ADDF, &&op_MULF, &&op_DIVF, \
+	&&op_NOT, &&op_AND, &&op_OR, \
+	&&op_LessI, &&op_LessF, &&op_LessEqualI, &&op_LessEqualF, \
+	&&op_EqualI, &&op_EqualF, &&op_EqualB, \
+	&&op_SUBI, &&op_SUBF, &&op_ItoFADDF, \
+	&&op_JUMPFLessI, &&op_JUMPFLessF, &&op_JUMPFLessEqualI, &&op_JUMPFLessEqualF, &&op_JUMPFEqualI, &&op_JUMPFEqualF, \
+	&&op_ADDI_IMM, &&op_MULI_IMM, &&op_DIVI_IMM, &&op_ADDF_IMM, &&op_MULF_IMM, &&op_DIVF_IMM, \
+	&&op_LessI_IMM, &&op_LessF_IMM, &&op_LessEqualI_IMM, &&op_LessEqualF_IMM, &&op_EqualI_IMM, &&op_EqualF_IMM
+
+// Superinstructions picked from an opcode profile, written by tsWriteSuperinstructions
+#include "tsSuperinstructions.h"
 
 namespace ts
 {
 	const std::string tsVersion = "0.0.0";
+	constexpr bool tsThreadedDispatch = TS_THREADED_DISPATCH;
 
 	//bytecode commands:
 
@@ -42,6 +76,36 @@ namespace ts
 	#define tsEqualF     (tsByte)(23) // Compare ints
 	#define tsEqualB     (tsByte)(24) // XAND 
 
+	// Superinstructions, the compiler fuses common sequences of the commands above into these
+	#define tsSUBI             (tsByte)(25) // subtract an int
+	#define tsSUBF             (tsByte)(26) // subtract a float
+	#define tsItoFADDF         (tsByte)(27) // cast an int to a float and add a float to it
+	#define tsJUMPFLessI       (tsByte)(28) // if an int is not less than another, goto an index
+	#define tsJUMPFLessF       (tsByte)(29) // if a float is not less than another, goto an index
+	#define tsJUMPFLessEqualI  (tsByte)(30) // if an int is not less than or equal to another, goto an index
+	#define tsJUMPFLessEqualF  (tsByte)(31) // if a float is not less than or equal to another, goto an index
+	#define tsJUMPFEqualI      (tsByte)(32) // if two ints are not equal, goto an index
+	#define tsJUMPFEqualF      (tsByte)(33) // if two floats are not equal, goto an index
+
+	// Immediate forms, b is a constant stored in the instruction instead of an index into memory
+	#define tsADDI_IMM         (tsByte)(34) // add a constant to an int
+	#define tsMULI_IMM         (tsByte)(35) // multiply an int by a constant
+	#define tsDIVI_IMM         (tsByte)(36) // divide an int by a constant
+	#define tsADDF_IMM         (tsByte)(37) // add a constant to a float
+	#define tsMULF_IMM         (tsByte)(38) // multiply a float by a constant
+	#define tsDIVF_IMM         (tsByte)(39) // divide a float by a constant
+	#define tsLessI_IMM        (tsByte)(40) // int less than a constant
+	#define tsLessF_IMM        (tsByte)(41) // float less than a constant
+	#define tsLessEqualI_IMM   (tsByte)(42) // int less than or equal to a constant
+	#define tsLessEqualF_IMM   (tsByte)(43) // float less than or equal to a constant
+	#define tsEqualI_IMM       (tsByte)(44) // int equal to a constant
+	#define tsEqualF_IMM       (tsByte)(45) // float equal to a constant
+
+	// Generated superinstructions from tsSuperinstructions.h follow these. Each one takes the place of the command
+	// byte of the first command in its sequence and leaves the rest of the sequence as it was, so only the bytecode
+	// interpreter has to know about them, everything else treats one as the command it replaced.
+	// The checked in set is empty, tools/GenerateSuperinstructions fills it from a profile of the scripts you run.
+
 	// Define types for all types used by runtime, so they can be changed if needed, 
 	// espesially if diferent platforms have different varible sizes that could break the bytecode.
 	typedef unsigned int tsIndex;
@@ -49,6 +113,156 @@ namespace ts
 	typedef std::int32_t tsInt;
 	typedef float tsFloat;
 	typedef bool tsBool;
+
+	constexpr size_t tsCommandCount = 46;
+	constexpr size_t tsSuperinstructionCount = tsSUPERINSTRUCTION_COUNT;
+	constexpr size_t tsMaxSuperinstructionLength = 3;
+
+	inline bool tsIsSuperinstruction(tsByte code)
+	{
+		return (size_t)code >= tsCommandCount && (size_t)code < tsCommandCount + tsSuperinstructionCount;
+	}
+
+	// The commands a superinstruction runs, terminated by tsEND
+	inline const tsByte* tsSuperinstructionSequence(tsByte code)
+	{
+		// The last entry only keeps the table from being empty when there are no superinstructions
+		static const tsByte sequences[][tsMaxSuperinstructionLength + 1] = { tsSUPERINSTRUCTION_SEQUENCES { tsEND } };
+		tsMASSERT(tsIsSuperinstruction(code), "Not a superinstruction");
+		return sequences[(size_t)code - tsCommandCount];
+	}
+
+	// The command a superinstruction replaced, any other command is returned as it is
+	inline tsByte tsBaseCommand(tsByte code)
+	{
+		return tsIsSuperinstruction(code) ? tsSuperinstructionSequence(code)[0] : code;
+	}
+
+	// Name of a command the way the interpreters label it
+	inline const char* tsCommandName(tsByte code)
+	{
+		static const char* const names[tsCommandCount] = {
+			"END", "JUMP", "JUMPF", "ItoF", "FtoI", "LOAD", "MOVE",
+			"FLIPI", "ADDI", "MULI", "DIVI",
+			"FLIPF", "ADDF", "MULF", "DIVF",
+			"NOT", "AND", "OR",
+			"LessI", "LessF", "LessEqualI", "LessEqualF",
+			"EqualI", "EqualF", "EqualB",
+			"SUBI", "SUBF", "ItoFADDF",
+			"JUMPFLessI", "JUMPFLessF", "JUMPFLessEqualI", "JUMPFLessEqualF", "JUMPFEqualI", "JUMPFEqualF",
+			"ADDI_IMM", "MULI_IMM", "DIVI_IMM", "ADDF_IMM", "MULF_IMM", "DIVF_IMM",
+			"LessI_IMM", "LessF_IMM", "LessEqualI_IMM", "LessEqualF_IMM", "EqualI_IMM", "EqualF_IMM"
+		};
+		return (size_t)code < tsCommandCount ? names[(size_t)code] : "Superinstruction";
+	}
+
+	// Jumps that compare a and b and go to imm.target when the comparison is false
+	inline bool tsIsCompareJump(tsByte code)
+	{
+		return code >= tsJUMPFLessI && code <= tsJUMPFEqualF;
+	}
+
+	// Commands whose b operand is a constant of the same type as a, stored in the instruction
+	inline bool tsIsImmediate(tsByte code)
+	{
+		return code >= tsADDI_IMM && code <= tsEqualF_IMM;
+	}
+
+	// The command an immediate form does with b in memory instead, or tsEND for anything else
+	inline tsByte tsRegisterForm(tsByte code)
+	{
+		switch (code)
+		{
+			case tsADDI_IMM:       return tsADDI;
+			case tsMULI_IMM:       return tsMULI;
+			case tsDIVI_IMM:       return tsDIVI;
+			case tsADDF_IMM:       return tsADDF;
+			case tsMULF_IMM:       return tsMULF;
+			case tsDIVF_IMM:       return tsDIVF;
+			case tsLessI_IMM:      return tsLessI;
+			case tsLessF_IMM:      return tsLessF;
+			case tsLessEqualI_IMM: return tsLessEqualI;
+			case tsLessEqualF_IMM: return tsLessEqualF;
+			case tsEqualI_IMM:     return tsEqualI;
+			case tsEqualF_IMM:     return tsEqualF;
+			default:               return tsEND;
+		}
+	}
+
+	// The immediate form of a command, or tsEND if it doesn't have one
+	inline tsByte tsImmediateForm(tsByte code)
+	{
+		switch (code)
+		{
+			case tsADDI:       return tsADDI_IMM;
+			case tsMULI:       return tsMULI_IMM;
+			case tsDIVI:       return tsDIVI_IMM;
+			case tsADDF:       return tsADDF_IMM;
+			case tsMULF:       return tsMULF_IMM;
+			case tsDIVF:       return tsDIVF_IMM;
+			case tsLessI:      return tsLessI_IMM;
+			case tsLessF:      return tsLessF_IMM;
+			case tsLessEqualI: return tsLessEqualI_IMM;
+			case tsLessEqualF: return tsLessEqualF_IMM;
+			case tsEqualI:     return tsEqualI_IMM;
+			case tsEqualF:     return tsEqualF_IMM;
+			default:           return tsEND;
+		}
+	}
+
+	// Whether swapping a and b of a command gives the same result
+	inline bool tsCommutes(tsByte code)
+	{
+		switch (code)
+		{
+			case tsADDI:
+			case tsADDF:
+			case tsMULI:
+			case tsMULF:
+			case tsAND:
+			case tsOR:
+			case tsEqualI:
+			case tsEqualF:
+			case tsEqualB:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	inline bool tsIsJump(tsByte code)
+	{
+		return code == tsJUMP || code == tsJUMPF || tsIsCompareJump(code);
+	}
+
+	// The comparison a compare jump makes, or the compare jump a comparison fuses into with a following tsJUMPF.
+	// Returns tsEND for anything else.
+	inline tsByte tsJumpComparison(tsByte code)
+	{
+		switch (code)
+		{
+			case tsJUMPFLessI:      return tsLessI;
+			case tsJUMPFLessF:      return tsLessF;
+			case tsJUMPFLessEqualI: return tsLessEqualI;
+			case tsJUMPFLessEqualF: return tsLessEqualF;
+			case tsJUMPFEqualI:     return tsEqualI;
+			case tsJUMPFEqualF:     return tsEqualF;
+			default:                return tsEND;
+		}
+	}
+	inline tsByte tsComparisonJump(tsByte code)
+	{
+		switch (code)
+		{
+			case tsLessI:      return tsJUMPFLessI;
+			case tsLessF:      return tsJUMPFLessF;
+			case tsLessEqualI: return tsJUMPFLessEqualI;
+			case tsLessEqualF: return tsJUMPFLessEqualF;
+			case tsEqualI:     return tsJUMPFEqualI;
+			case tsEqualF:     return tsJUMPFEqualF;
+			default:           return tsEND;
+		}
+	}
 	
 
 	enum class tsVarType
@@ -74,6 +288,25 @@ namespace ts
 		}
 	}
 
+	// The script type a host type is stored as, only defined for types scripts can use
+	template<class T>
+	struct tsTypeOf;
+	template<>
+	struct tsTypeOf<tsInt>
+	{
+		static constexpr tsVarType value = tsVarType::tsInt;
+	};
+	template<>
+	struct tsTypeOf<tsFloat>
+	{
+		static constexpr tsVarType value = tsVarType::tsFloat;
+	};
+	template<>
+	struct tsTypeOf<tsBool>
+	{
+		static constexpr tsVarType value = tsVarType::tsBool;
+	};
+
 	class tsBytes
 	{
 	private:
@@ -106,6 +339,14 @@ namespace ts
 		{
 			return bytes.size();
 		}
+		tsByte* data()
+		{
+			return bytes.data();
+		}
+		const tsByte* data() const
+		{
+			return bytes.data();
+		}
 		void clear()
 		{
 			bytes.clear();
@@ -115,6 +356,11 @@ namespace ts
 			bytes.reserve(size);
 			bytes.resize(size, tsByte(0));
 		}
+		void write(size_t index, const void* data, size_t size)
+		{
+			tsMASSERT(size <= bytes.size() && index <= bytes.size() - size, "Index " + std::to_string(index) + " out of byte range");
+			std::memcpy(&bytes[index], data, size);
+		}
 		void copy(tsIndex a, tsIndex b, size_t size)
 		{
 			tsMASSERT(a >= 0 && a <= bytes.size() - size + 1, "Index " + std::to_string(a) + " out of byte range");
@@ -130,6 +376,36 @@ namespace ts
 		}
 	};
 
+	// Same interface as tsBytes but without any range checks, only use it with scripts that passed tsScript::verify
+	class tsUncheckedBytes
+	{
+	private:
+		tsByte* bytes;
+	public:
+		tsUncheckedBytes(tsByte* data) : bytes(data) {}
+
+		template <class T>
+		void set(size_t index, T value)
+		{
+			std::memcpy(bytes + index, &value, sizeof(T));
+		}
+		template <class T>
+		T read(size_t index) const
+		{
+			T rv;
+			std::memcpy(&rv, bytes + index, sizeof(T));
+			return rv;
+		}
+		void write(size_t index, const void* data, size_t size)
+		{
+			std::memcpy(bytes + index, data, size);
+		}
+		void copy(tsIndex a, tsIndex b, size_t size)
+		{
+			std::memcpy(bytes + a, bytes + b, size);
+		}
+	};
+
 	class tsBytecode
 	{
 		
@@ -184,8 +460,319 @@ namespace ts
 			bytes.pushBack(b);
 			bytes.pushBack(r);
 		}
+		template<class T>
+		void pushImmediate(tsByte c, tsIndex a, T value, tsIndex r)
+		{
+			static_assert(sizeof(T) == sizeof(tsIndex), "Immediates take the place of an index");
+			bytes.pushBack(c);
+			bytes.pushBack(a);
+			bytes.pushBack(value);
+			bytes.pushBack(r);
+		}
+	};
+
+
+	// Number of bytes an instruction takes up including the command byte, loadSize is only used by tsLOAD
+	inline size_t tsInstructionSize(tsByte code, tsIndex loadSize)
+	{
+		switch (tsBaseCommand(code))
+		{
+			case tsEND:
+				return 1;
+			case tsJUMP:
+				return 1 + sizeof(size_t);
+			case tsJUMPF:
+				return 1 + sizeof(tsIndex) + sizeof(size_t);
+			case tsJUMPFLessI:
+			case tsJUMPFLessF:
+			case tsJUMPFLessEqualI:
+			case tsJUMPFLessEqualF:
+			case tsJUMPFEqualI:
+			case tsJUMPFEqualF:
+				return 1 + 2 * sizeof(tsIndex) + sizeof(size_t);
+			case tsLOAD:
+				return 1 + 2 * sizeof(tsIndex) + loadSize;
+			case tsItoF:
+			case tsFtoI:
+			case tsFLIPI:
+			case tsFLIPF:
+			case tsNOT:
+				return 1 + 2 * sizeof(tsIndex);
+			default:
+				return 1 + 3 * sizeof(tsIndex);
+		}
+	}
+
+	// Number of bytes the instruction starting at cursor takes up
+	inline size_t tsInstructionSize(const tsBytes& bytes, size_t cursor)
+	{
+		tsByte code = tsBaseCommand(bytes.read<tsByte>(cursor));
+		return tsInstructionSize(code, code == tsLOAD ? bytes.read<tsIndex>(cursor + 1) : 0);
+	}
+
+	// An instruction decoded into a fixed layout so the runtime doesn't have to parse operands out of the bytecode.
+	// a and b are the inputs and r is the result for most commands, exceptions:
+	//   tsJUMP:  imm.target is the instruction to jump to
+	//   tsJUMPF: a is the condition, imm.target is the instruction to jump to
+	//   tsLOAD:  a is the size of the value stored in imm, r is where it is loaded to
+	//   tsMOVE:  a is the source, b is the size, r is the destination
+	//   compare jumps: a and b are compared, imm.target is the instruction to jump to
+	//   immediate forms: imm.bytes holds the constant that takes the place of b
+	struct alignas(8) tsInstruction
+	{
+		tsByte code;
+		tsIndex a = 0;
+		tsIndex b = 0;
+		tsIndex r = 0;
+		union
+		{
+			size_t target;
+			tsByte bytes[8];
+		} imm = {0};
+	};
+
+	// Types of the values an instruction's operands refer to, tsNone for unused operands and for tsMOVE and tsLOAD,
+	// which copy untyped bytes. b is tsNone for immediate forms, their constant has the type of a.
+	struct tsOperandTypes
+	{
+		tsVarType a = tsVarType::tsNone;
+		tsVarType b = tsVarType::tsNone;
+		tsVarType r = tsVarType::tsNone;
 	};
 
+	inline tsOperandTypes tsGetOperandTypes(tsByte code)
+	{
+		const tsVarType I = tsVarType::tsInt, F = tsVarType::tsFloat, B = tsVarType::tsBool, N = tsVarType::tsNone;
+		switch (code)
+		{
+			case tsJUMPF:      return { B, N, N };
+			case tsItoF:       return { I, N, F };
+			case tsFtoI:       return { F, N, I };
+			case tsFLIPI:      return { I, N, I };
+			case tsADDI:
+			case tsSUBI:
+			case tsMULI:
+			case tsDIVI:       return { I, I, I };
+			case tsFLIPF:      return { F, N, F };
+			case tsADDF:
+			case tsSUBF:
+			case tsMULF:
+			case tsDIVF:       return { F, F, F };
+			case tsItoFADDF:   return { I, F, F };
+			case tsNOT:        return { B, N, B };
+			case tsAND:
+			case tsOR:
+			case tsEqualB:     return { B, B, B };
+			case tsLessI:
+			case tsLessEqualI:
+			case tsEqualI:     return { I, I, B };
+			case tsLessF:
+			case tsLessEqualF:
+			case tsEqualF:     return { F, F, B };
+			case tsJUMPFLessI:
+			case tsJUMPFLessEqualI:
+			case tsJUMPFEqualI: return { I, I, N };
+			case tsJUMPFLessF:
+			case tsJUMPFLessEqualF:
+			case tsJUMPFEqualF: return { F, F, N };
+			case tsADDI_IMM:
+			case tsMULI_IMM:
+			case tsDIVI_IMM:   return { I, N, I };
+			case tsADDF_IMM:
+			case tsMULF_IMM:
+			case tsDIVF_IMM:   return { F, N, F };
+			case tsLessI_IMM:
+			case tsLessEqualI_IMM:
+			case tsEqualI_IMM: return { I, N, B };
+			case tsLessF_IMM:
+			case tsLessEqualF_IMM:
+			case tsEqualF_IMM: return { F, N, B };
+			default:           return { N, N, N };
+		}
+	}
+
+	inline size_t tsGetTypeSize(tsVarType type)
+	{
+		switch (type)
+		{
+			case tsVarType::tsInt:
+				return sizeof(tsInt);
+			case tsVarType::tsFloat:
+				return sizeof(tsFloat);
+			case tsVarType::tsBool:
+				return sizeof(tsBool);
+			default:
+				return 0;
+		}
+	}
+
+	// The constant of an immediate form
+	template<class T, class Instruction>
+	inline T tsImmediate(const Instruction& i)
+	{
+		static_assert(sizeof(T) <= sizeof(i.imm.bytes), "Immediate too large");
+		T value;
+		std::memcpy(&value, i.imm.bytes, sizeof(T));
+		return value;
+	}
+
+	// Decode bytecode into instructions, jump targets are converted from byte offsets into instruction indexes.
+	// Superinstructions decode into the commands they run.
+	inline std::vector<tsInstruction> tsDecode(const tsBytecode& bytecode)
+	{
+		const tsBytes& bytes = bytecode.bytes;
+		std::vector<tsInstruction> instructions;
+		std::vector<size_t> instructionAt(bytes.size() + 1, SIZE_MAX);
+		size_t cursor = 0;
+		while (cursor < bytes.size())
+		{
+			instructionAt[cursor] = instructions.size();
+			tsInstruction i;
+			i.code = tsBaseCommand(bytes.read<tsByte>(cursor));
+			size_t o = cursor + 1;
+			switch (i.code)
+			{
+				case tsEND:
+					break;
+				case tsJUMP:
+					i.imm.target = bytes.read<size_t>(o);
+					break;
+				case tsJUMPF:
+					i.a = bytes.read<tsIndex>(o);
+					i.imm.target = bytes.read<size_t>(o + sizeof(tsIndex));
+					break;
+				case tsJUMPFLessI:
+				case tsJUMPFLessF:
+				case tsJUMPFLessEqualI:
+				case tsJUMPFLessEqualF:
+				case tsJUMPFEqualI:
+				case tsJUMPFEqualF:
+					i.a = bytes.read<tsIndex>(o);
+					i.b = bytes.read<tsIndex>(o + sizeof(tsIndex));
+					i.imm.target = bytes.read<size_t>(o + 2 * sizeof(tsIndex));
+					break;
+				case tsLOAD:
+					i.a = bytes.read<tsIndex>(o);
+					i.r = bytes.read<tsIndex>(o + sizeof(tsIndex));
+					tsMASSERT(i.a <= sizeof(i.imm.bytes), "Loaded value too large for an instruction");
+					for (tsIndex b = 0; b < i.a; b++)
+						i.imm.bytes[b] = bytes.read<tsByte>(o + 2 * sizeof(tsIndex) + b);
+					break;
+				case tsMOVE:
+					i.b = bytes.read<tsIndex>(o);
+					i.a = bytes.read<tsIndex>(o + sizeof(tsIndex));
+					i.r = bytes.read<tsIndex>(o + 2 * sizeof(tsIndex));
+					break;
+				case tsItoF:
+				case tsFtoI:
+				case tsFLIPI:
+				case tsFLIPF:
+				case tsNOT:
+					i.a = bytes.read<tsIndex>(o);
+					i.r = bytes.read<tsIndex>(o + sizeof(tsIndex));
+					break;
+				default:
+					i.a = bytes.read<tsIndex>(o);
+					if (tsIsImmediate(i.code))
+						for (size_t b = 0; b < sizeof(tsIndex); b++)
+							i.imm.bytes[b] = bytes.read<tsByte>(o + sizeof(tsIndex) + b);
+					else
+						i.b = bytes.read<tsIndex>(o + sizeof(tsIndex));
+					i.r = bytes.read<tsIndex>(o + 2 * sizeof(tsIndex));
+					break;
+			}
+			instructions.push_back(i);
+			cursor += tsInstructionSize(bytes, cursor);
+		}
+
+		// Falling off the end of the bytecode ends the script, so make sure the instructions always stop on a tsEND
+		instructionAt[bytes.size()] = instructions.size();
+		if (instructions.empty() || instructions.back().code != tsEND)
+		{
+			tsInstruction end;
+			end.code = tsEND;
+			instructions.push_back(end);
+		}
+
+		for (tsInstruction& i : instructions)
+		{
+			if (tsIsJump(i.code))
+			{
+				tsMASSERT(i.imm.target < instructionAt.size() && instructionAt[i.imm.target] != SIZE_MAX, "Jump target is not the start of an instruction");
+				i.imm.target = instructionAt[i.imm.target];
+			}
+		}
+		return instructions;
+	}
+
+	// Encode instructions back into bytecode, the inverse of tsDecode
+	inline tsBytecode tsEncode(const std::vector<tsInstruction>& instructions)
+	{
+		// Jump targets go back from instruction indexes to byte offsets
+		std::vector<size_t> offsets(instructions.size() + 1, 0);
+		for (size_t n = 0; n < instructions.size(); n++)
+		{
+			offsets[n + 1] = offsets[n] + tsInstructionSize(instructions[n].code, instructions[n].a);
+		}
+
+		tsBytecode bytecode;
+		tsBytes& bytes = bytecode.bytes;
+		for (const tsInstruction& i : instructions)
+		{
+			bytes.pushBack(i.code);
+			switch (i.code)
+			{
+				case tsEND:
+					break;
+				case tsJUMP:
+					bytes.pushBack(offsets[i.imm.target]);
+					break;
+				case tsJUMPF:
+					bytes.pushBack(i.a);
+					bytes.pushBack(offsets[i.imm.target]);
+					break;
+				case tsJUMPFLessI:
+				case tsJUMPFLessF:
+				case tsJUMPFLessEqualI:
+				case tsJUMPFLessEqualF:
+				case tsJUMPFEqualI:
+				case tsJUMPFEqualF:
+					bytes.pushBack(i.a);
+					bytes.pushBack(i.b);
+					bytes.pushBack(offsets[i.imm.target]);
+					break;
+				case tsLOAD:
+					bytes.pushBack(i.a);
+					bytes.pushBack(i.r);
+					for (tsIndex b = 0; b < i.a; b++)
+						bytes.pushBack(i.imm.bytes[b]);
+					break;
+				case tsMOVE:
+					bytes.pushBack(i.b);
+					bytes.pushBack(i.a);
+					bytes.pushBack(i.r);
+					break;
+				case tsItoF:
+				case tsFtoI:
+				case tsFLIPI:
+				case tsFLIPF:
+				case tsNOT:
+					bytes.pushBack(i.a);
+					bytes.pushBack(i.r);
+					break;
+				default:
+					bytes.pushBack(i.a);
+					if (tsIsImmediate(i.code))
+						for (size_t b = 0; b < sizeof(tsIndex); b++)
+							bytes.pushBack(i.imm.bytes[b]);
+					else
+						bytes.pushBack(i.b);
+					bytes.pushBack(i.r);
+					break;
+			}
+		}
+		return bytecode;
+	}
 
 	class tsGlobal
 	{
@@ -202,6 +789,79 @@ namespace ts
 		tsIndex index;
 	};
 
+	// Layout of a host record holding globals. The layout of a script is its globals packed in slot order, and records
+	// generated from it carry its hash so they can be checked against the script they are used with.
+	// Hosts can also describe their own structs field by field and copy them with a tsCopyPlan.
+	class tsGlobalLayout
+	{
+	public:
+		struct Field
+		{
+			std::string identifier;
+			tsVarType type;
+			tsGlobal::GlobalType writeMode;
+			// Slot of the global in script memory, only known for layouts made from a script
+			tsIndex index;
+			// Where the global is in the record
+			size_t offset;
+		};
+		std::vector<Field> fields;
+		size_t size = 0;
+		std::uint64_t hash = 14695981039346656037ull;
+
+		tsGlobalLayout() = default;
+		// Globals that are next to each other in script memory are next to each other in the record too, so a tsCopyPlan
+		// copies a script whose globals have no gaps between them with a single memcpy
+		tsGlobalLayout(const std::vector<tsGlobal>& globals)
+		{
+			std::vector<tsGlobal> sorted = globals;
+			std::sort(sorted.begin(), sorted.end(), [](const tsGlobal& a, const tsGlobal& b) { return a.index < b.index; });
+			for (const tsGlobal& g : sorted)
+				add(g.identifier, g.type, size, g.writeMode, g.index);
+		}
+
+		// Add a field to a host record, offset is usually offsetof the member holding the global
+		void add(const std::string& identifier, tsVarType type, size_t offset, tsGlobal::GlobalType writeMode = tsGlobal::GlobalType::tsIn, tsIndex index = 0)
+		{
+			fields.push_back({ identifier, type, writeMode, index, offset });
+			size = std::max(size, offset + tsGetTypeSize(type));
+
+			auto mix = [this](const void* data, size_t bytes) {
+				const unsigned char* b = static_cast<const unsigned char*>(data);
+				for (size_t i = 0; i < bytes; i++)
+					hash = (hash ^ b[i]) * 1099511628211ull;
+			};
+			mix(identifier.data(), identifier.size() + 1);
+			mix(&type, sizeof(type));
+			mix(&writeMode, sizeof(writeMode));
+			mix(&index, sizeof(index));
+			mix(&offset, sizeof(offset));
+		}
+
+		// Source of a C++ header declaring a packed struct named name that matches this layout byte for byte
+		std::string header(const std::string& name) const
+		{
+			std::string text = "// Generated by the ThunderScript compiler, do not edit\n";
+			text += "#pragma once\n#include <cstddef>\n#include <cstdint>\n\n#pragma pack(push, 1)\n";
+			text += "struct " + name + "\n{\n";
+			char hashText[32];
+			std::snprintf(hashText, sizeof(hashText), "0x%016llxull", (unsigned long long)hash);
+			text += "\tstatic constexpr std::uint64_t tsLayoutHash = " + std::string(hashText) + ";\n\n";
+			for (const Field& f : fields)
+			{
+				const char* type = f.type == tsVarType::tsInt ? "std::int32_t" : f.type == tsVarType::tsFloat ? "float" : "bool";
+				const char* mode = f.writeMode == tsGlobal::GlobalType::tsRef ? "#ref" : "#in";
+				text += "\t" + std::string(type) + " " + f.identifier + "; // " + mode + ", slot " + std::to_string(f.index) + "\n";
+			}
+			text += "};\n#pragma pack(pop)\n\n";
+			if (size != 0)
+				text += "static_assert(sizeof(" + name + ") == " + std::to_string(size) + ", \"" + name + " does not match the script's globals\");\n";
+			for (const Field& f : fields)
+				text += "static_assert(offsetof(" + name + ", " + f.identifier + ") == " + std::to_string(f.offset) + ", \"" + name + " does not match the script's globals\");\n";
+			return text;
+		}
+	};
+
 	class tsConst
 	{
 	public:
@@ -218,389 +878,1596 @@ namespace ts
 		void (*func)(tsIndex, const std::vector<std::byte>&, std::vector<std::byte>&);
 	};
 
-	class tsScript
-	{
-	public:
-		tsIndex numBytes;
+	// Scripts compiled to native code take the base of an instance's memory and run until tsEND
+	typedef void (*tsNativeEntry)(tsByte* memory);
 
-		std::vector<tsGlobal> globals;
-		tsBytecode bytecode;
+	// std::atomic that can be copied, so scripts can still be copied into a context.
+	// Copying is not atomic, only copy scripts that are not running.
+	template<class T>
+	struct tsAtomic : std::atomic<T>
+	{
+		tsAtomic(T value = T()) : std::atomic<T>(value)
+		{
+		}
+		tsAtomic(const tsAtomic& other) : std::atomic<T>(other.load())
+		{
+		}
+		tsAtomic& operator=(const tsAtomic& other)
+		{
+			this->store(other.load());
+			return *this;
+		}
+		using std::atomic<T>::operator=;
 	};
-	
 
-	class tsContext
+	// How a script is executed, scripts are promoted up through these as they get hotter
+	enum class tsTier : std::uint8_t
 	{
-	public:
-		std::vector<tsFunction> functions;
-		std::vector<tsScript> scripts;
+		tsBytecode,
+		tsDecoded,
+		tsNative
 	};
 
-	class tsRuntime
+	class tsScript
 	{
-	private:
-		std::shared_ptr<tsContext> _context;
+	public:
+		tsIndex numBytes;
 
-		tsIndex loadedScript;
-		bool scriptLoaded;
+		std::vector<tsGlobal> globals;
+		tsBytecode bytecode;
+		// Initial memory of every instance, holds the values of constants and zeros everywhere else
+		tsBytes constants;
+		// bytecode decoded by prepare(), this is what the runtime executes
+		std::vector<tsInstruction> instructions;
+		// Position of each global in globals by identifier, built by prepare()
+		std::unordered_map<std::string, tsIndex> globalTable;
+		// Layout of a record holding every global, built by prepare()
+		tsGlobalLayout layout;
+		// Set by verify(), verified scripts are executed without range checks
+		bool verified = false;
+		// Native version of the script registered by transpiled code, runs in place of the interpreter when set.
+		// Native code is never unloaded, so runs that already started with an old entry can finish with it.
+		tsAtomic<tsNativeEntry> native = nullptr;
 
-		size_t cursor;
-		tsBytes stack;
+		// Updated by tiered runtimes, shared by every runtime running the script
+		tsAtomic<std::uint64_t> runs = 0;
+		tsAtomic<std::uint64_t> executedInstructions = 0;
+		tsAtomic<tsTier> tier = tsTier::tsBytecode;
+		// Set once a native build is started, so the script is compiled at most once
+		tsAtomic<bool> promoting = false;
 
-	public:
-		tsRuntime(std::shared_ptr<tsContext>& context)
+		// FNV-1a hash of everything that decides what the script does, used to match generated code to its script
+		std::uint64_t hash() const
 		{
-			_context = context;
+			std::uint64_t h = 14695981039346656037ull;
+			auto add = [&h](const void* data, size_t size) {
+				const unsigned char* bytes = static_cast<const unsigned char*>(data);
+				for (size_t i = 0; i < size; i++)
+					h = (h ^ bytes[i]) * 1099511628211ull;
+			};
+			add(&numBytes, sizeof(numBytes));
+			add(bytecode.bytes.data(), bytecode.bytes.size());
+			add(constants.data(), constants.size());
+			return h;
 		}
 
-		void LoadScript(tsIndex script)
+		bool prepared() const
 		{
-			loadedScript = script;
-			cursor = 0;
-			stack.clear();
-			stack.setSize(_context->scripts[loadedScript].numBytes);
-			//ExecuteByteCode(_context->scripts[loadedScript].bytecode);
-			scriptLoaded = true;
+			return !instructions.empty();
 		}
-
-
-		template<class T>
-		void SetGlobal(std::string identifier, T value)
+		void prepare()
 		{
-			if (scriptLoaded)
-			{
-				tsScript& script = _context->scripts[loadedScript];
-				for (tsIndex i = 0; i < script.globals.size(); i++)
-				{
-					if (script.globals[i].identifier == identifier)
-					{
-						SetGlobal(i, value);
-						return;
-					}
-				}
-				tsMASSERT(false, "Could not find identifier: " + identifier);
-			}
-			else
-				std::cout << "Could not set global, no loaded function.\n";
+			instructions = tsDecode(bytecode);
+			globalTable.clear();
+			for (tsIndex i = 0; i < globals.size(); i++)
+				globalTable.emplace(globals[i].identifier, i);
+			layout = tsGlobalLayout(globals);
 		}
 
-		template<class T>
-		void SetGlobal(tsIndex index, T value)
+		// Returns nullptr if the script has no global with this identifier
+		const tsGlobal* findGlobal(const std::string& identifier) const
 		{
-			tsScript& script = _context->scripts[loadedScript];
-			stack.set(script.globals[index].index, value);
-			std::cout << "Global " << index << " at index " << script.globals[index].index << " set to " << stack.read<T>(script.globals[index].index) << std::endl;
+			tsMASSERT(prepared(), "Script must be loaded before looking up globals");
+			auto global = globalTable.find(identifier);
+			return global == globalTable.end() ? nullptr : &globals[global->second];
 		}
 
-		template<class T>
-		T GetGlobal(std::string identifier)
+		// Prove that every command is known, every operand is inside of the script's memory for the size of its type,
+		// every jump lands on the start of an instruction, every superinstruction is followed by the commands it runs
+		// and the bytecode ends with tsEND.
+		bool verify(std::string& error)
 		{
-			if (scriptLoaded)
+			verified = false;
+			if (constants.size() != 0 && constants.size() != numBytes)
 			{
-				tsScript& script = _context->scripts[loadedScript];
-				for (tsIndex i = 0; i < script.globals.size(); i++)
-				{
-					if (script.globals[i].identifier == identifier)
-					{
-						return GetGlobal<T>(i);
-					}
-				}
-				tsMASSERT(false, "Could not find identifier: " + identifier);
+				error = "Constant image is " + std::to_string(constants.size()) + " bytes but the script uses " + std::to_string(numBytes);
+				return false;
 			}
-			else
-				std::cout << "Could not set global, no loaded function.\n";
-			return 0;
-		}
-
-		template<class T>
-		T GetGlobal(tsIndex index)
-		{
-			tsScript& script = _context->scripts[loadedScript];
-			return stack.read<T>(script.globals[index].index);
-		}
+			const tsBytes& bytes = bytecode.bytes;
+			std::vector<bool> instructionStart(bytes.size(), false);
+			std::vector<size_t> jumpTargets;
 
-		void Run()
-		{
-			std::cout << "Running script: " << loadedScript << " at cursor index: " << cursor << std::endl;
-			size_t start = cursor;
-			ExecuteByteCode(_context->scripts[loadedScript].bytecode);
-			// Return the cursor to the start of the function after we complete it
-			cursor = start;
-		}
+			auto inBounds = [&](tsIndex index, size_t size) {
+				return size <= numBytes && index <= numBytes - size;
+			};
 
-		void ExecuteByteCode(const tsBytecode& bytecode)
-		{
-			bool executing = true;
-			while (executing && cursor < bytecode.bytes.size())
+			size_t cursor = 0;
+			tsByte last = tsEND;
+			// Commands the last superinstruction still expects to follow it
+			const tsByte* expected = nullptr;
+			while (cursor < bytes.size())
 			{
-				//std::cout << "Executing code " << (int)bytecode.bytes.read<tsByte>(cursor) << " at index " << cursor << std::endl;
-				switch (bytecode.bytes.read<tsByte>(cursor))
+				tsByte code = bytes.read<tsByte>(cursor);
+				if ((size_t)code >= tsCommandCount + tsSuperinstructionCount)
+				{
+					error = "Unknown command " + std::to_string((unsigned int)code) + " at byte " + std::to_string(cursor);
+					return false;
+				}
+				// The interpreter runs a superinstruction's whole sequence without looking at the commands after it
+				if (expected && *expected != tsEND)
+				{
+					if (code != *expected++)
+					{
+						error = "Superinstruction is not followed by the commands it runs at byte " + std::to_string(cursor);
+						return false;
+					}
+				}
+				else if (tsIsSuperinstruction(code))
+				{
+					expected = tsSuperinstructionSequence(code);
+					code = *expected++;
+				}
+				// LOAD stores its size in the bytecode, make sure that's readable before asking for the instruction size
+				if (code == tsLOAD && cursor + 1 + sizeof(tsIndex) > bytes.size())
+				{
+					error = "Truncated instruction at byte " + std::to_string(cursor);
+					return false;
+				}
+				size_t size = tsInstructionSize(bytes, cursor);
+				if (cursor + size > bytes.size())
+				{
+					error = "Truncated instruction at byte " + std::to_string(cursor);
+					return false;
+				}
+				instructionStart[cursor] = true;
+
+				size_t o = cursor + 1;
+				bool valid = true;
+				switch (code)
 				{
 					case tsEND:
-						executing = false;
 						break;
 					case tsJUMP:
-					{
-						size_t index = bytecode.bytes.read<size_t>(++cursor);
-						cursor = index - 1;
-					}
+						jumpTargets.push_back(bytes.read<size_t>(o));
 						break;
 					case tsJUMPF:
-					{
-						tsIndex condition = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						size_t index = bytecode.bytes.read<size_t>(cursor);
-						//std::cout << sizeof(size_t);
-						cursor += 7;
-						if (!stack.read<tsBool>(condition))
-						{
-							cursor = index - 1;
-						}
+						valid = inBounds(bytes.read<tsIndex>(o), sizeof(tsBool));
+						jumpTargets.push_back(bytes.read<size_t>(o + sizeof(tsIndex)));
+						break;
+					case tsJUMPFLessI:
+					case tsJUMPFLessF:
+					case tsJUMPFLessEqualI:
+					case tsJUMPFLessEqualF:
+					case tsJUMPFEqualI:
+					case tsJUMPFEqualF:
+						valid = inBounds(bytes.read<tsIndex>(o), 4) && inBounds(bytes.read<tsIndex>(o + sizeof(tsIndex)), 4);
+						jumpTargets.push_back(bytes.read<size_t>(o + 2 * sizeof(tsIndex)));
 						break;
-					}
 					case tsLOAD:
 					{
-						size_t size = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += sizeof(tsIndex);
-						tsIndex index = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += sizeof(tsIndex);
-						bytecode.bytes.copy(stack, index, cursor, size);
-						cursor += size - 1;
-					}
+						tsIndex loadSize = bytes.read<tsIndex>(o);
+						valid = loadSize <= sizeof(tsInstruction::imm) && inBounds(bytes.read<tsIndex>(o + sizeof(tsIndex)), loadSize);
 						break;
+					}
 					case tsMOVE:
 					{
-						tsIndex size = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex index1 = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.copy(index2, index1, size);
-					}
+						tsIndex moveSize = bytes.read<tsIndex>(o);
+						valid = inBounds(bytes.read<tsIndex>(o + sizeof(tsIndex)), moveSize) && inBounds(bytes.read<tsIndex>(o + 2 * sizeof(tsIndex)), moveSize);
 						break;
-					case tsFtoI:
-					{
-						tsIndex index1 = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsInt>(index2, stack.read<tsFloat>(index1));
 					}
-						break;
 					case tsItoF:
-					{
-						tsIndex index1 = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsFloat>(index2, stack.read<tsInt>(index1));
-					}
-						break;
+					case tsFtoI:
+					case tsFLIPI:
 					case tsFLIPF:
-					{
-						tsIndex index1 = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(index2, -stack.read<tsFloat>(index1));
-					}
+						valid = inBounds(bytes.read<tsIndex>(o), 4) && inBounds(bytes.read<tsIndex>(o + sizeof(tsIndex)), 4);
 						break;
-					case tsADDF:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, stack.read<tsFloat>(a) + stack.read<tsFloat>(b));
+					case tsNOT:
+						valid = inBounds(bytes.read<tsIndex>(o), sizeof(tsBool)) && inBounds(bytes.read<tsIndex>(o + sizeof(tsIndex)), sizeof(tsBool));
 						break;
-					}
-					case tsMULF:
+					default:
 					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, stack.read<tsFloat>(a) * stack.read<tsFloat>(b));
-					}
+						// Binary operations, the immediate forms have a constant in place of b
+						tsOperandTypes types = tsGetOperandTypes(code);
+						valid = inBounds(bytes.read<tsIndex>(o), tsGetTypeSize(types.a)) &&
+							(tsIsImmediate(code) || inBounds(bytes.read<tsIndex>(o + sizeof(tsIndex)), tsGetTypeSize(types.b))) &&
+							inBounds(bytes.read<tsIndex>(o + 2 * sizeof(tsIndex)), tsGetTypeSize(types.r));
 						break;
-					case tsDIVF:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, stack.read<tsFloat>(a) / stack.read<tsFloat>(b));
 					}
-					break;
-					case tsFLIPI:
+				}
+				if (!valid)
+				{
+					error = "Operand out of range in instruction at byte " + std::to_string(cursor);
+					return false;
+				}
+				last = code;
+				cursor += size;
+			}
+
+			if (bytes.size() == 0 || last != tsEND)
+			{
+				error = "Bytecode does not end with END";
+				return false;
+			}
+			if (expected && *expected != tsEND)
+			{
+				error = "Bytecode ends inside of a superinstruction";
+				return false;
+			}
+			for (size_t target : jumpTargets)
+			{
+				if (target >= bytes.size() || !instructionStart[target])
+				{
+					error = "Jump to " + std::to_string(target) + " does not land on an instruction";
+					return false;
+				}
+			}
+			verified = true;
+			return true;
+		}
+
+		// Verify and prepare the script so runtimes can execute it. This modifies the script so it must be done
+		// before the script is shared between threads, the compiler loads every script it creates.
+		bool load(std::string& error)
+		{
+			if (!verified && !verify(error))
+				return false;
+			if (!prepared())
+				prepare();
+			return true;
+		}
+	};
+	
+
+	class tsContext
+	{
+	public:
+		std::vector<tsFunction> functions;
+		std::vector<tsScript> scripts;
+	};
+
+
+	// The mutable state of one running copy of a script. Scripts are never modified while running,
+	// so any number of instances can execute the same script at the same time.
+	class tsInstance
+	{
+	public:
+		tsIndex numBytes = 0;
+		tsBytes memory;
+
+		tsInstance() = default;
+		tsInstance(const tsScript& script)
+		{
+			reset(script);
+		}
+
+		// Size the memory for a script and fill it with the script's constants
+		void reset(const tsScript& script)
+		{
+			numBytes = script.numBytes;
+			memory = script.constants;
+			// Scripts without any constants have an empty image
+			memory.setSize(numBytes);
+		}
+	};
+
+	// How often each command, pair of commands and triple of commands ran back to back, collected by
+	// tsExecuteByteCode when it is profiled. Superinstructions are counted as the commands they run, and a sequence
+	// only carries on while execution falls through to the next instruction since that is all a superinstruction
+	// can cover. Profiles of several runs or scripts can be merged and saved to build up a whole workload.
+	class tsOpcodeProfile
+	{
+	private:
+		static constexpr size_t n = tsCommandCount;
+		tsByte previous[2] = { tsEND, tsEND };
+		size_t sequence = 0;
+		size_t fallthrough = SIZE_MAX;
+
+	public:
+		std::vector<std::uint64_t> singles;
+		std::vector<std::uint64_t> pairs;
+		std::vector<std::uint64_t> triples;
+
+		tsOpcodeProfile() : singles(n, 0), pairs(n * n, 0), triples(n * n * n, 0)
+		{
+		}
+
+		std::uint64_t& pair(tsByte a, tsByte b)
+		{
+			return pairs[(size_t)a * n + (size_t)b];
+		}
+		std::uint64_t& triple(tsByte a, tsByte b, tsByte c)
+		{
+			return triples[((size_t)a * n + (size_t)b) * n + (size_t)c];
+		}
+
+		// Nothing runs before the first instruction of a run
+		void begin()
+		{
+			sequence = 0;
+			fallthrough = SIZE_MAX;
+		}
+
+		// Count the instruction at cursor and return the command it runs
+		tsByte record(const tsBytes& bytes, size_t cursor)
+		{
+			tsByte code = tsBaseCommand(bytes.read<tsByte>(cursor));
+			if (cursor != fallthrough)
+				sequence = 0;
+			singles[(size_t)code]++;
+			if (sequence >= 1)
+				pair(previous[1], code)++;
+			if (sequence >= 2)
+				triple(previous[0], previous[1], code)++;
+			previous[0] = previous[1];
+			previous[1] = code;
+			sequence++;
+			fallthrough = cursor + tsInstructionSize(bytes, cursor);
+			return code;
+		}
+
+		void merge(const tsOpcodeProfile& other)
+		{
+			for (size_t i = 0; i < singles.size(); i++)
+				singles[i] += other.singles[i];
+			for (size_t i = 0; i < pairs.size(); i++)
+				pairs[i] += other.pairs[i];
+			for (size_t i = 0; i < triples.size(); i++)
+				triples[i] += other.triples[i];
+		}
+
+		// One line per sequence that ran: its count followed by the command names
+		void save(std::ostream& out) const
+		{
+			for (size_t a = 0; a < n; a++)
+			{
+				if (singles[a])
+					out << singles[a] << " " << tsCommandName((tsByte)a) << "\n";
+				for (size_t b = 0; b < n; b++)
+				{
+					if (pairs[a * n + b])
+						out << pairs[a * n + b] << " " << tsCommandName((tsByte)a) << " " << tsCommandName((tsByte)b) << "\n";
+					for (size_t c = 0; c < n; c++)
+						if (triples[(a * n + b) * n + c])
+							out << triples[(a * n + b) * n + c] << " " << tsCommandName((tsByte)a) << " " << tsCommandName((tsByte)b) << " " << tsCommandName((tsByte)c) << "\n";
+				}
+			}
+		}
+
+		// Add the counts of a saved profile to this one
+		bool load(std::istream& in, std::string& error)
+		{
+			std::string line;
+			size_t lineNumber = 0;
+			while (std::getline(in, line))
+			{
+				lineNumber++;
+				std::istringstream words(line);
+				std::uint64_t count;
+				if (!(words >> count))
+					continue;
+				std::vector<tsByte> codes;
+				std::string name;
+				while (words >> name)
+				{
+					size_t code = 0;
+					while (code < n && name != tsCommandName((tsByte)code))
+						code++;
+					if (code == n)
 					{
-						tsIndex index1 = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(index2, -stack.read<tsInt>(index1));
+						error = "Unknown command " + name + " on line " + std::to_string(lineNumber);
+						return false;
 					}
-					break;
-					case tsADDI:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, stack.read<tsInt>(a) + stack.read<tsInt>(b));
+					codes.push_back((tsByte)code);
+				}
+				switch (codes.size())
+				{
+					case 1:
+						singles[(size_t)codes[0]] += count;
 						break;
-					}
-					case tsMULI:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, stack.read<tsInt>(a) * stack.read<tsInt>(b));
-					}
-					break;
-					case tsDIVI:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, stack.read<tsInt>(a) / stack.read<tsInt>(b));
-					}
-					break;
-					case tsNOT:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, !stack.read<tsBool>(a));
-					}
-					break;
-					case tsAND:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, stack.read<tsBool>(a) && stack.read<tsBool>(b));
-					}
-					break;
-					case tsOR:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set(r, stack.read<tsBool>(a) || stack.read<tsBool>(b));
-					}
-					break;
-					case tsEqualI:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsBool>(r, stack.read<tsInt>(a) == stack.read<tsInt>(b));
-					}
+					case 2:
+						pair(codes[0], codes[1]) += count;
 						break;
-					case tsEqualF:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsBool>(r, stack.read<tsFloat>(a) == stack.read<tsFloat>(b));
-					}
-					break;
-					case tsEqualB:
-					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsBool>(r, stack.read<tsBool>(a) == stack.read<tsBool>(b));
-					}
-					break;
-					case tsLessI:
+					case 3:
+						triple(codes[0], codes[1], codes[2]) += count;
+						break;
+					default:
+						error = "Expected one to three commands on line " + std::to_string(lineNumber);
+						return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	// Interpret raw bytecode on a stack, starting at cursor.
+	// When threaded is true every handler jumps straight to the next handler through a table of label addresses
+	// instead of going back through the shared switch, this requires the bytecode to end with tsEND.
+	// When counted is true the number of instructions executed is returned, otherwise 0.
+	// When profiled is true every instruction is counted in profile, superinstructions then run one command at a time.
+	template<bool threaded = tsThreadedDispatch, bool counted = false, bool profiled = false>
+	size_t tsExecuteByteCode(const tsBytecode& bytecode, tsBytes& stack, size_t cursor = 0, tsOpcodeProfile* profile = nullptr)
+	{
+		size_t executed = 0;
+		tsMASSERT(!profiled || profile, "Profiled runs need a profile to record into");
+		if constexpr (profiled)
+			profile->begin();
+		#define tsFETCH() (size_t)(profiled ? profile->record(bytecode.bytes, cursor) : bytecode.bytes.read<tsByte>(cursor))
+	#if TS_THREADED_DISPATCH
+		static void* const dispatchTable[] = { tsDISPATCH_LABELS tsSUPERINSTRUCTION_LABELS };
+		#define tsDISPATCH() goto *dispatchTable[tsFETCH()]
+		#define tsNEXT() ++cursor; if constexpr (counted) ++executed; if constexpr (threaded) tsDISPATCH(); else continue
+		if constexpr (threaded)
+		{
+			tsMASSERT(bytecode.bytes.size() > 0 && cursor < bytecode.bytes.size(), "Can not run empty bytecode");
+			tsDISPATCH();
+		}
+	#else
+		#define tsNEXT() ++cursor; if constexpr (counted) ++executed; continue
+	#endif
+		#define tsCASE(name) case ts##name: op_##name:
+
+		while (cursor < bytecode.bytes.size())
+		{
+			//std::cout << "Executing code " << (int)bytecode.bytes.read<tsByte>(cursor) << " at index " << cursor << std::endl;
+			switch ((tsByte)tsFETCH())
+			{
+				tsCASE(END)
+					return counted ? executed + 1 : 0;
+				tsCASE(JUMP)
+				{
+					size_t index = bytecode.bytes.read<size_t>(++cursor);
+					cursor = index - 1;
+				}
+					tsNEXT();
+				tsCASE(JUMPF)
+				{
+					tsIndex condition = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					size_t index = bytecode.bytes.read<size_t>(cursor);
+					//std::cout << sizeof(size_t);
+					cursor += 7;
+					if (!stack.read<tsBool>(condition))
 					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsBool>(r, stack.read<tsInt>(a) < stack.read<tsInt>(b));
+						cursor = index - 1;
 					}
-					break;
-					case tsLessF:
+					tsNEXT();
+				}
+				tsCASE(LOAD)
+				{
+					size_t size = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += sizeof(tsIndex);
+					tsIndex index = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += sizeof(tsIndex);
+					bytecode.bytes.copy(stack, index, cursor, size);
+					cursor += size - 1;
+				}
+					tsNEXT();
+				tsCASE(MOVE)
+				{
+					tsIndex size = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex index1 = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.copy(index2, index1, size);
+				}
+					tsNEXT();
+				tsCASE(FtoI)
+				{
+					tsIndex index1 = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsInt>(index2, stack.read<tsFloat>(index1));
+				}
+					tsNEXT();
+				tsCASE(ItoF)
+				{
+					tsIndex index1 = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsFloat>(index2, stack.read<tsInt>(index1));
+				}
+					tsNEXT();
+				tsCASE(FLIPF)
+				{
+					tsIndex index1 = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(index2, -stack.read<tsFloat>(index1));
+				}
+					tsNEXT();
+				tsCASE(ADDF)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsFloat>(a) + stack.read<tsFloat>(b));
+					tsNEXT();
+				}
+				tsCASE(MULF)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsFloat>(a) * stack.read<tsFloat>(b));
+				}
+					tsNEXT();
+				tsCASE(DIVF)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsFloat>(a) / stack.read<tsFloat>(b));
+				}
+				tsNEXT();
+				tsCASE(FLIPI)
+				{
+					tsIndex index1 = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex index2 = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(index2, -stack.read<tsInt>(index1));
+				}
+				tsNEXT();
+				tsCASE(ADDI)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsInt>(a) + stack.read<tsInt>(b));
+					tsNEXT();
+				}
+				tsCASE(MULI)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsInt>(a) * stack.read<tsInt>(b));
+				}
+				tsNEXT();
+				tsCASE(DIVI)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsInt>(a) / stack.read<tsInt>(b));
+				}
+				tsNEXT();
+				tsCASE(NOT)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, !stack.read<tsBool>(a));
+				}
+				tsNEXT();
+				tsCASE(AND)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsBool>(a) && stack.read<tsBool>(b));
+				}
+				tsNEXT();
+				tsCASE(OR)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsBool>(a) || stack.read<tsBool>(b));
+				}
+				tsNEXT();
+				tsCASE(EqualI)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsBool>(r, stack.read<tsInt>(a) == stack.read<tsInt>(b));
+				}
+					tsNEXT();
+				tsCASE(EqualF)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsBool>(r, stack.read<tsFloat>(a) == stack.read<tsFloat>(b));
+				}
+				tsNEXT();
+				tsCASE(EqualB)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsBool>(r, stack.read<tsBool>(a) == stack.read<tsBool>(b));
+				}
+				tsNEXT();
+				tsCASE(LessI)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsBool>(r, stack.read<tsInt>(a) < stack.read<tsInt>(b));
+				}
+				tsNEXT();
+				tsCASE(LessF)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsBool>(r, stack.read<tsFloat>(a) < stack.read<tsFloat>(b));
+				}
+				tsNEXT();
+				tsCASE(LessEqualI)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsBool>(r, stack.read<int>(a) <= stack.read<int>(b));
+				}
+				tsNEXT();
+				tsCASE(LessEqualF)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set<tsBool>(r, stack.read<tsFloat>(a) <= stack.read<tsFloat>(b));
+				}
+				tsNEXT();
+				tsCASE(SUBI)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsInt>(a) - stack.read<tsInt>(b));
+				}
+				tsNEXT();
+				tsCASE(SUBF)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, stack.read<tsFloat>(a) - stack.read<tsFloat>(b));
+				}
+				tsNEXT();
+				tsCASE(ItoFADDF)
+				{
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
+					cursor += 4;
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 4;
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
+					cursor += 3;
+					stack.set(r, (tsFloat)stack.read<tsInt>(a) + stack.read<tsFloat>(b));
+				}
+				tsNEXT();
+				#define tsCOMPARE_JUMP(name, T, op) \
+				tsCASE(name) \
+				{ \
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor); \
+					cursor += 4; \
+					tsIndex b = bytecode.bytes.read<tsIndex>(cursor); \
+					cursor += 4; \
+					size_t index = bytecode.bytes.read<size_t>(cursor); \
+					cursor += 7; \
+					if (!(stack.read<T>(a) op stack.read<T>(b))) \
+						cursor = index - 1; \
+				} \
+				tsNEXT();
+				tsCOMPARE_JUMP(JUMPFLessI, tsInt, <)
+				tsCOMPARE_JUMP(JUMPFLessF, tsFloat, <)
+				tsCOMPARE_JUMP(JUMPFLessEqualI, tsInt, <=)
+				tsCOMPARE_JUMP(JUMPFLessEqualF, tsFloat, <=)
+				tsCOMPARE_JUMP(JUMPFEqualI, tsInt, ==)
+				tsCOMPARE_JUMP(JUMPFEqualF, tsFloat, ==)
+				#undef tsCOMPARE_JUMP
+				#define tsBINARY_IMM(name, T, R, op) \
+				tsCASE(name) \
+				{ \
+					tsIndex a = bytecode.bytes.read<tsIndex>(++cursor); \
+					cursor += 4; \
+					T b = bytecode.bytes.read<T>(cursor); \
+					cursor += 4; \
+					tsIndex r = bytecode.bytes.read<tsIndex>(cursor); \
+					cursor += 3; \
+					stack.set<R>(r, stack.read<T>(a) op b); \
+				} \
+				tsNEXT();
+				tsBINARY_IMM(ADDI_IMM, tsInt, tsInt, +)
+				tsBINARY_IMM(MULI_IMM, tsInt, tsInt, *)
+				tsBINARY_IMM(DIVI_IMM, tsInt, tsInt, /)
+				tsBINARY_IMM(ADDF_IMM, tsFloat, tsFloat, +)
+				tsBINARY_IMM(MULF_IMM, tsFloat, tsFloat, *)
+				tsBINARY_IMM(DIVF_IMM, tsFloat, tsFloat, /)
+				tsBINARY_IMM(LessI_IMM, tsInt, tsBool, <)
+				tsBINARY_IMM(LessF_IMM, tsFloat, tsBool, <)
+				tsBINARY_IMM(LessEqualI_IMM, tsInt, tsBool, <=)
+				tsBINARY_IMM(LessEqualF_IMM, tsFloat, tsBool, <=)
+				tsBINARY_IMM(EqualI_IMM, tsInt, tsBool, ==)
+				tsBINARY_IMM(EqualF_IMM, tsFloat, tsBool, ==)
+				#undef tsBINARY_IMM
+				tsSUPERINSTRUCTION_HANDLERS
+				default:
+				{
+				#ifdef _DEBUG
+					tsMASSERT(false, "Unknown byte code! " + std::to_string((unsigned int)bytecode.bytes.read<tsByte>(cursor)));
+				#else
+					//This apperently removes the default check from the switch, increasing speed
+					tsUNREACHABLE();
+				#endif
+				}
+			}
+		}
+		return executed;
+		#undef tsCASE
+		#undef tsNEXT
+		#undef tsDISPATCH
+		#undef tsFETCH
+	}
+
+	// Execute the instructions of a prepared script, operands are read straight out of each instruction.
+	// Scripts that passed verification can skip the range checks on every stack access.
+	// When counted is true the number of instructions executed is returned, otherwise 0.
+	template<bool threaded = tsThreadedDispatch, bool checked = true, bool counted = false>
+	size_t tsExecuteInstructions(const tsScript& script, tsBytes& stack, size_t start = 0)
+	{
+		size_t executed = 0;
+		tsMASSERT(script.prepared(), "Script must be prepared before executing instructions");
+		tsMASSERT(checked || script.verified, "Only verified scripts can be executed unchecked");
+		const tsInstruction* const code = script.instructions.data();
+		const tsInstruction* ip = code + start;
+		tsUncheckedBytes memory(stack.data());
+	#if TS_THREADED_DISPATCH
+		static void* const dispatchTable[] = { tsDISPATCH_LABELS };
+		#define tsDISPATCH() if constexpr (counted) ++executed; if constexpr (threaded) goto *dispatchTable[(size_t)ip->code]; else continue
+	#else
+		#define tsDISPATCH() if constexpr (counted) ++executed; continue
+	#endif
+		#define tsNEXT() ++ip; tsDISPATCH()
+		#define tsCASE(name) case ts##name: op_##name:
+		#define tsREAD(T, i) (checked ? stack.read<T>(i) : memory.read<T>(i))
+		#define tsSET(T, i, v) (checked ? stack.set<T>(i, v) : memory.set<T>(i, v))
+		#define tsUNARY(name, T, R, op) tsCASE(name) tsSET(R, ip->r, op tsREAD(T, ip->a)); tsNEXT();
+		#define tsBINARY(name, T, R, op) tsCASE(name) tsSET(R, ip->r, tsREAD(T, ip->a) op tsREAD(T, ip->b)); tsNEXT();
+		#define tsCOMPARE_JUMP(name, T, op) tsCASE(name) if (!(tsREAD(T, ip->a) op tsREAD(T, ip->b))) { ip = code + ip->imm.target; tsDISPATCH(); } tsNEXT();
+		#define tsBINARY_IMM(name, T, R, op) tsCASE(name) tsSET(R, ip->r, tsREAD(T, ip->a) op tsImmediate<T>(*ip)); tsNEXT();
+
+	#if TS_THREADED_DISPATCH
+		if constexpr (threaded)
+			goto *dispatchTable[(size_t)ip->code];
+	#endif
+		while (true)
+		{
+			switch (ip->code)
+			{
+				tsCASE(END)
+					return counted ? executed + 1 : 0;
+				tsCASE(JUMP)
+					ip = code + ip->imm.target;
+					tsDISPATCH();
+				tsCASE(JUMPF)
+					if (!tsREAD(tsBool, ip->a))
 					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsBool>(r, stack.read<tsFloat>(a) < stack.read<tsFloat>(b));
+						ip = code + ip->imm.target;
+						tsDISPATCH();
 					}
-					break;
-					case tsLessEqualI:
+					tsNEXT();
+				tsCASE(LOAD)
+					checked ? stack.write(ip->r, ip->imm.bytes, ip->a) : memory.write(ip->r, ip->imm.bytes, ip->a);
+					tsNEXT();
+				tsCASE(MOVE)
+					checked ? stack.copy(ip->r, ip->a, ip->b) : memory.copy(ip->r, ip->a, ip->b);
+					tsNEXT();
+				tsCASE(FtoI)
+					tsSET(tsInt, ip->r, (tsInt)tsREAD(tsFloat, ip->a));
+					tsNEXT();
+				tsCASE(ItoF)
+					tsSET(tsFloat, ip->r, (tsFloat)tsREAD(tsInt, ip->a));
+					tsNEXT();
+				tsUNARY(FLIPF, tsFloat, tsFloat, -)
+				tsBINARY(ADDF, tsFloat, tsFloat, +)
+				tsBINARY(MULF, tsFloat, tsFloat, *)
+				tsBINARY(DIVF, tsFloat, tsFloat, /)
+				tsUNARY(FLIPI, tsInt, tsInt, -)
+				tsBINARY(ADDI, tsInt, tsInt, +)
+				tsBINARY(MULI, tsInt, tsInt, *)
+				tsBINARY(DIVI, tsInt, tsInt, /)
+				tsUNARY(NOT, tsBool, tsBool, !)
+				tsBINARY(AND, tsBool, tsBool, &&)
+				tsBINARY(OR, tsBool, tsBool, ||)
+				tsBINARY(EqualI, tsInt, tsBool, ==)
+				tsBINARY(EqualF, tsFloat, tsBool, ==)
+				tsBINARY(EqualB, tsBool, tsBool, ==)
+				tsBINARY(LessI, tsInt, tsBool, <)
+				tsBINARY(LessF, tsFloat, tsBool, <)
+				tsBINARY(LessEqualI, tsInt, tsBool, <=)
+				tsBINARY(LessEqualF, tsFloat, tsBool, <=)
+				tsBINARY(SUBI, tsInt, tsInt, -)
+				tsBINARY(SUBF, tsFloat, tsFloat, -)
+				tsCASE(ItoFADDF)
+					tsSET(tsFloat, ip->r, (tsFloat)tsREAD(tsInt, ip->a) + tsREAD(tsFloat, ip->b));
+					tsNEXT();
+				tsCOMPARE_JUMP(JUMPFLessI, tsInt, <)
+				tsCOMPARE_JUMP(JUMPFLessF, tsFloat, <)
+				tsCOMPARE_JUMP(JUMPFLessEqualI, tsInt, <=)
+				tsCOMPARE_JUMP(JUMPFLessEqualF, tsFloat, <=)
+				tsCOMPARE_JUMP(JUMPFEqualI, tsInt, ==)
+				tsCOMPARE_JUMP(JUMPFEqualF, tsFloat, ==)
+				tsBINARY_IMM(ADDI_IMM, tsInt, tsInt, +)
+				tsBINARY_IMM(MULI_IMM, tsInt, tsInt, *)
+				tsBINARY_IMM(DIVI_IMM, tsInt, tsInt, /)
+				tsBINARY_IMM(ADDF_IMM, tsFloat, tsFloat, +)
+				tsBINARY_IMM(MULF_IMM, tsFloat, tsFloat, *)
+				tsBINARY_IMM(DIVF_IMM, tsFloat, tsFloat, /)
+				tsBINARY_IMM(LessI_IMM, tsInt, tsBool, <)
+				tsBINARY_IMM(LessF_IMM, tsFloat, tsBool, <)
+				tsBINARY_IMM(LessEqualI_IMM, tsInt, tsBool, <=)
+				tsBINARY_IMM(LessEqualF_IMM, tsFloat, tsBool, <=)
+				tsBINARY_IMM(EqualI_IMM, tsInt, tsBool, ==)
+				tsBINARY_IMM(EqualF_IMM, tsFloat, tsBool, ==)
+				default:
+				{
+				#ifdef _DEBUG
+					tsMASSERT(false, "Unknown byte code! " + std::to_string((unsigned int)ip->code));
+				#else
+					tsUNREACHABLE();
+				#endif
+				}
+			}
+		}
+		#undef tsBINARY_IMM
+		#undef tsCOMPARE_JUMP
+		#undef tsBINARY
+		#undef tsUNARY
+		#undef tsSET
+		#undef tsREAD
+		#undef tsCASE
+		#undef tsNEXT
+		#undef tsDISPATCH
+	}
+
+	// Run a script on an instance. This only reads the script so it is safe to call from many threads at once,
+	// as long as each thread uses its own instance and the script was loaded before being shared.
+	template<bool threaded = tsThreadedDispatch>
+	void tsExecute(const tsScript& script, tsInstance& instance)
+	{
+		tsMASSERT(script.prepared(), "Script must be loaded before it is executed");
+		tsMASSERT(instance.numBytes == script.numBytes, "Instance was not created for this script");
+		if (tsNativeEntry native = script.native.load(std::memory_order_acquire))
+			native(instance.memory.data());
+		else if (script.verified)
+			tsExecuteInstructions<threaded, false>(script, instance.memory);
+		else
+			tsExecuteInstructions<threaded, true>(script, instance.memory);
+	}
+
+	inline void tsExecute(const tsContext& context, tsIndex script, tsInstance& instance)
+	{
+		tsExecute(context.scripts[script], instance);
+	}
+
+	// Copies between a host record and script memory worked out once for a layout. Globals that sit next to each other
+	// both in the record and in memory are coalesced into a single memcpy.
+	class tsCopyPlan
+	{
+	public:
+		struct Copy
+		{
+			size_t offset;
+			tsIndex index;
+			size_t size;
+		};
+		// Coalesced copies, used for single instances
+		std::vector<Copy> copies;
+		// One copy per global, used for batches where every slot is its own array
+		std::vector<Copy> fields;
+		std::uint64_t layoutHash = 0;
+
+		bool build(const tsScript& script, const tsGlobalLayout& layout, std::string& error)
+		{
+			copies.clear();
+			fields.clear();
+			for (const tsGlobalLayout::Field& f : layout.fields)
+			{
+				const tsGlobal* g = script.findGlobal(f.identifier);
+				if (!g)
+				{
+					error = "Script has no global named " + f.identifier;
+					return false;
+				}
+				if (g->type != f.type)
+				{
+					error = "Global " + f.identifier + " is a " + std::string(getVarTypeName(g->type)) + " not a " + std::string(getVarTypeName(f.type));
+					return false;
+				}
+				fields.push_back({ f.offset, g->index, tsGetTypeSize(f.type) });
+			}
+			std::vector<Copy> sorted = fields;
+			std::sort(sorted.begin(), sorted.end(), [](const Copy& a, const Copy& b) { return a.index < b.index; });
+			for (const Copy& c : sorted)
+			{
+				if (!copies.empty())
+				{
+					Copy& last = copies.back();
+					if (last.index + last.size == c.index && last.offset + last.size == c.offset)
 					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsBool>(r, stack.read<int>(a) <= stack.read<int>(b));
+						last.size += c.size;
+						continue;
 					}
-					break;
-					case tsLessEqualF:
+				}
+				copies.push_back(c);
+			}
+			layoutHash = layout.hash;
+			return true;
+		}
+
+		void scatter(const void* record, tsByte* memory) const
+		{
+			const tsByte* source = static_cast<const tsByte*>(record);
+			for (const Copy& c : copies)
+				std::memcpy(memory + c.index, source + c.offset, c.size);
+		}
+
+		void gather(const tsByte* memory, void* record) const
+		{
+			tsByte* target = static_cast<tsByte*>(record);
+			for (const Copy& c : copies)
+				std::memcpy(target + c.offset, memory + c.index, c.size);
+		}
+	};
+
+	// An instruction whose operands are each an offset from one of several base pointers, so some of them can
+	// point into host memory. Segment 0 is always the instance's own memory.
+	struct alignas(8) tsBoundInstruction
+	{
+		tsByte code;
+		std::uint8_t segmentA = 0;
+		std::uint8_t segmentB = 0;
+		std::uint8_t segmentR = 0;
+		// Size operand of tsLOAD and tsMOVE
+		tsIndex size = 0;
+		tsIndex a = 0;
+		tsIndex b = 0;
+		tsIndex r = 0;
+		union
+		{
+			size_t target;
+			tsByte bytes[8];
+		} imm = {0};
+	};
+
+	// Globals of one instance that are read and written in host memory instead of being copied in and out.
+	// A global can be bound to its own pointer or to an offset in a host record that is shared by many globals.
+	// Operands are resolved to a segment and an offset whenever a global is bound. Moving a global to another
+	// pointer or the record to another entity only changes a base pointer, so that can be done before every run.
+	class tsBinding
+	{
+	private:
+		struct Bound
+		{
+			tsIndex index;
+			tsIndex size;
+			std::uint8_t segment;
+			size_t offset;
+		};
+		std::vector<Bound> globals;
+
+	public:
+		static constexpr std::uint8_t memorySegment = 0;
+		static constexpr std::uint8_t recordSegment = 1;
+
+		std::vector<tsBoundInstruction> instructions;
+		// Base pointer of every segment, the memory segment is filled in when the script runs
+		std::vector<tsByte*> bases = { nullptr, nullptr };
+
+		bool empty() const
+		{
+			return globals.empty();
+		}
+		void clear()
+		{
+			globals.clear();
+			instructions.clear();
+			bases = { nullptr, nullptr };
+		}
+
+		// Bind the global in the slot at index to a pointer, only resolves the script again the first time
+		bool bindPointer(const tsScript& script, tsIndex index, tsIndex size, void* pointer, std::string& error)
+		{
+			for (Bound& g : globals)
+			{
+				if (g.index == index && g.segment > recordSegment)
+				{
+					bases[g.segment] = static_cast<tsByte*>(pointer);
+					return true;
+				}
+			}
+			if (bases.size() > 255)
+			{
+				error = "Too many globals bound to their own pointers";
+				return false;
+			}
+			// The segment's base is only added once the global is bound, so a failed bind leaves nothing behind
+			std::uint8_t segment = (std::uint8_t)bases.size();
+			if (!bind(script, { index, size, segment, 0 }, error))
+				return false;
+			bases.push_back(static_cast<tsByte*>(pointer));
+			return true;
+		}
+
+		bool bindToRecord(const tsScript& script, tsIndex index, tsIndex size, size_t offset, std::string& error)
+		{
+			return bind(script, { index, size, recordSegment, offset }, error);
+		}
+
+		void setRecord(void* record)
+		{
+			bases[recordSegment] = static_cast<tsByte*>(record);
+		}
+
+	private:
+		// Resolve the script with the new binding in place of any old one for the same global. Nothing changes unless
+		// that works, so a global that can't be bound keeps the binding it had.
+		bool bind(const tsScript& script, Bound global, std::string& error)
+		{
+			tsMASSERT(script.verified && script.prepared(), "Only loaded and verified scripts can be bound");
+			std::vector<Bound> updated;
+			for (const Bound& g : globals)
+				if (g.index != global.index)
+					updated.push_back(g);
+			updated.push_back(global);
+			std::vector<tsBoundInstruction> resolved;
+			if (!resolve(script, updated, resolved, error))
+				return false;
+			globals = std::move(updated);
+			instructions = std::move(resolved);
+			return true;
+		}
+
+		static bool resolve(const tsScript& script, const std::vector<Bound>& globals, std::vector<tsBoundInstruction>& instructions, std::string& error)
+		{
+			// Which bound global, if any, each byte of memory belongs to
+			std::vector<const Bound*> owner(script.numBytes, nullptr);
+			for (const Bound& g : globals)
+				for (tsIndex b = g.index; b < g.index + g.size && b < script.numBytes; b++)
+					owner[b] = &g;
+
+			bool valid = true;
+			auto operand = [&](size_t n, tsIndex index, size_t size, std::uint8_t& segment, tsIndex& offset) {
+				if (size == 0)
+					return;
+				// Every byte of the operand has to be in the same place, either the instance or one bound global
+				const Bound* g = owner[index];
+				for (size_t b = index; b < index + size; b++)
+				{
+					if (owner[b] != g)
 					{
-						tsIndex a = bytecode.bytes.read<tsIndex>(++cursor);
-						cursor += 4;
-						tsIndex b = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 4;
-						tsIndex r = bytecode.bytes.read<tsIndex>(cursor);
-						cursor += 3;
-						stack.set<tsBool>(r, stack.read<tsFloat>(a) <= stack.read<tsFloat>(b));
+						error = "Instruction " + std::to_string(n) + " uses part of a bound global";
+						valid = false;
+						return;
 					}
-					break;
-					default:
+				}
+				segment = g ? g->segment : memorySegment;
+				offset = g ? (tsIndex)(g->offset + (index - g->index)) : index;
+			};
+
+			instructions.resize(script.instructions.size());
+			for (size_t n = 0; n < script.instructions.size(); n++)
+			{
+				const tsInstruction& i = script.instructions[n];
+				tsBoundInstruction& bound = instructions[n];
+				bound = tsBoundInstruction();
+				bound.code = i.code;
+				bound.imm.target = i.imm.target;
+				tsOperandTypes types = tsGetOperandTypes(i.code);
+				if (i.code == tsLOAD)
+				{
+					bound.size = i.a;
+					operand(n, i.r, i.a, bound.segmentR, bound.r);
+				}
+				else if (i.code == tsMOVE)
+				{
+					bound.size = i.b;
+					operand(n, i.a, i.b, bound.segmentA, bound.a);
+					operand(n, i.r, i.b, bound.segmentR, bound.r);
+				}
+				else
+				{
+					operand(n, i.a, tsGetTypeSize(types.a), bound.segmentA, bound.a);
+					operand(n, i.b, tsGetTypeSize(types.b), bound.segmentB, bound.b);
+					operand(n, i.r, tsGetTypeSize(types.r), bound.segmentR, bound.r);
+				}
+				if (!valid)
+					return false;
+			}
+			return true;
+		}
+	};
+
+	// Execute a script through its bound instructions, every operand is read from the base of its segment.
+	// Bound instructions are only made for verified scripts, so nothing is range checked.
+	template<bool threaded = tsThreadedDispatch>
+	void tsExecuteBound(const tsBoundInstruction* code, tsByte* const* bases)
+	{
+		const tsBoundInstruction* ip = code;
+	#if TS_THREADED_DISPATCH
+		static void* const dispatchTable[] = { tsDISPATCH_LABELS };
+		#define tsDISPATCH() if constexpr (threaded) goto *dispatchTable[(size_t)ip->code]; else continue
+	#else
+		#define tsDISPATCH() continue
+	#endif
+		#define tsNEXT() ++ip; tsDISPATCH()
+		#define tsCASE(name) case ts##name: op_##name:
+		#define tsREAD(T, segment, operand) tsUncheckedBytes(bases[ip->segment]).read<T>(ip->operand)
+		#define tsSET(T, v) tsUncheckedBytes(bases[ip->segmentR]).set<T>(ip->r, v)
+		#define tsUNARY(name, T, R, op) tsCASE(name) tsSET(R, op tsREAD(T, segmentA, a)); tsNEXT();
+		#define tsBINARY(name, T, R, op) tsCASE(name) tsSET(R, tsREAD(T, segmentA, a) op tsREAD(T, segmentB, b)); tsNEXT();
+		#define tsCOMPARE_JUMP(name, T, op) tsCASE(name) if (!(tsREAD(T, segmentA, a) op tsREAD(T, segmentB, b))) { ip = code + ip->imm.target; tsDISPATCH(); } tsNEXT();
+		#define tsBINARY_IMM(name, T, R, op) tsCASE(name) tsSET(R, tsREAD(T, segmentA, a) op tsImmediate<T>(*ip)); tsNEXT();
+
+	#if TS_THREADED_DISPATCH
+		if constexpr (threaded)
+			goto *dispatchTable[(size_t)ip->code];
+	#endif
+		while (true)
+		{
+			switch (ip->code)
+			{
+				tsCASE(END)
+					return;
+				tsCASE(JUMP)
+					ip = code + ip->imm.target;
+					tsDISPATCH();
+				tsCASE(JUMPF)
+					if (!tsREAD(tsBool, segmentA, a))
 					{
-					#ifdef _DEBUG
-						tsMASSERT(false, "Unknown byte code! " + std::to_string((unsigned int)bytecode.bytes.read<tsByte>(cursor)));
-					#else
-						//This apperently removes the default check from the switch, increasing speed
-						__assume(false);
-					#endif
+						ip = code + ip->imm.target;
+						tsDISPATCH();
 					}
+					tsNEXT();
+				tsCASE(LOAD)
+					std::memcpy(bases[ip->segmentR] + ip->r, ip->imm.bytes, ip->size);
+					tsNEXT();
+				tsCASE(MOVE)
+					std::memcpy(bases[ip->segmentR] + ip->r, bases[ip->segmentA] + ip->a, ip->size);
+					tsNEXT();
+				tsCASE(FtoI)
+					tsSET(tsInt, (tsInt)tsREAD(tsFloat, segmentA, a));
+					tsNEXT();
+				tsCASE(ItoF)
+					tsSET(tsFloat, (tsFloat)tsREAD(tsInt, segmentA, a));
+					tsNEXT();
+				tsUNARY(FLIPF, tsFloat, tsFloat, -)
+				tsBINARY(ADDF, tsFloat, tsFloat, +)
+				tsBINARY(MULF, tsFloat, tsFloat, *)
+				tsBINARY(DIVF, tsFloat, tsFloat, /)
+				tsUNARY(FLIPI, tsInt, tsInt, -)
+				tsBINARY(ADDI, tsInt, tsInt, +)
+				tsBINARY(MULI, tsInt, tsInt, *)
+				tsBINARY(DIVI, tsInt, tsInt, /)
+				tsUNARY(NOT, tsBool, tsBool, !)
+				tsBINARY(AND, tsBool, tsBool, &&)
+				tsBINARY(OR, tsBool, tsBool, ||)
+				tsBINARY(EqualI, tsInt, tsBool, ==)
+				tsBINARY(EqualF, tsFloat, tsBool, ==)
+				tsBINARY(EqualB, tsBool, tsBool, ==)
+				tsBINARY(LessI, tsInt, tsBool, <)
+				tsBINARY(LessF, tsFloat, tsBool, <)
+				tsBINARY(LessEqualI, tsInt, tsBool, <=)
+				tsBINARY(LessEqualF, tsFloat, tsBool, <=)
+				tsBINARY(SUBI, tsInt, tsInt, -)
+				tsBINARY(SUBF, tsFloat, tsFloat, -)
+				tsCASE(ItoFADDF)
+					tsSET(tsFloat, (tsFloat)tsREAD(tsInt, segmentA, a) + tsREAD(tsFloat, segmentB, b));
+					tsNEXT();
+				tsCOMPARE_JUMP(JUMPFLessI, tsInt, <)
+				tsCOMPARE_JUMP(JUMPFLessF, tsFloat, <)
+				tsCOMPARE_JUMP(JUMPFLessEqualI, tsInt, <=)
+				tsCOMPARE_JUMP(JUMPFLessEqualF, tsFloat, <=)
+				tsCOMPARE_JUMP(JUMPFEqualI, tsInt, ==)
+				tsCOMPARE_JUMP(JUMPFEqualF, tsFloat, ==)
+				tsBINARY_IMM(ADDI_IMM, tsInt, tsInt, +)
+				tsBINARY_IMM(MULI_IMM, tsInt, tsInt, *)
+				tsBINARY_IMM(DIVI_IMM, tsInt, tsInt, /)
+				tsBINARY_IMM(ADDF_IMM, tsFloat, tsFloat, +)
+				tsBINARY_IMM(MULF_IMM, tsFloat, tsFloat, *)
+				tsBINARY_IMM(DIVF_IMM, tsFloat, tsFloat, /)
+				tsBINARY_IMM(LessI_IMM, tsInt, tsBool, <)
+				tsBINARY_IMM(LessF_IMM, tsFloat, tsBool, <)
+				tsBINARY_IMM(LessEqualI_IMM, tsInt, tsBool, <=)
+				tsBINARY_IMM(LessEqualF_IMM, tsFloat, tsBool, <=)
+				tsBINARY_IMM(EqualI_IMM, tsInt, tsBool, ==)
+				tsBINARY_IMM(EqualF_IMM, tsFloat, tsBool, ==)
+				default:
+				{
+				#ifdef _DEBUG
+					tsMASSERT(false, "Unknown byte code! " + std::to_string((unsigned int)ip->code));
+				#else
+					tsUNREACHABLE();
+				#endif
+				}
+			}
+		}
+		#undef tsBINARY_IMM
+		#undef tsCOMPARE_JUMP
+		#undef tsBINARY
+		#undef tsUNARY
+		#undef tsSET
+		#undef tsREAD
+		#undef tsCASE
+		#undef tsNEXT
+		#undef tsDISPATCH
+	}
+
+	// Where a global lives in an instance, resolved once by tsRuntime::ResolveGlobal so setting and getting it
+	// needs no name lookup. The type is checked against T when the handle is resolved. A handle belongs to the
+	// script it was resolved against, runtimes refuse handles that failed to resolve or were resolved for another script.
+	template<class T>
+	struct tsGlobalHandle
+	{
+		typedef T type;
+		tsIndex index = 0;
+		tsIndex script = 0;
+		bool resolved = false;
+
+		// False if ResolveGlobal could not find a global of this name and type, check before using the handle
+		bool valid() const
+		{
+			return resolved;
+		}
+	};
+
+	class tsRuntime
+	{
+	protected:
+		std::shared_ptr<tsContext> _context;
+
+		tsIndex loadedScript;
+		bool scriptLoaded = false;
+
+		tsInstance instance;
+		// Globals bound to host memory, when any are bound the script runs on the bound instructions
+		tsBinding binding;
+		// Plan for the layout last passed to SetGlobals or GetGlobals
+		tsCopyPlan copyPlan;
+		const tsGlobalLayout* copyLayout = nullptr;
+
+		const tsCopyPlan* planFor(const tsGlobalLayout& layout)
+		{
+			if (copyLayout == &layout && copyPlan.layoutHash == layout.hash)
+				return &copyPlan;
+			copyLayout = nullptr;
+			std::string error;
+			if (!copyPlan.build(_context->scripts[loadedScript], layout, error))
+			{
+				tsLOG_ERROR("Could not copy globals: " << error);
+				return nullptr;
+			}
+			copyLayout = &layout;
+			return &copyPlan;
+		}
+
+		bool bound() const
+		{
+			return !binding.empty();
+		}
+
+		// Whether a handle can be used with the loaded script
+		template<class T>
+		bool accepts(const tsGlobalHandle<T>& handle) const
+		{
+			if (handle.valid() && scriptLoaded && handle.script == loadedScript)
+				return true;
+			if (!handle.valid())
+				tsLOG_ERROR("Global handle was never resolved");
+			else
+				tsLOG_ERROR("Global handle was resolved for script " << handle.script << ", not the loaded script");
+			return false;
+		}
+
+	public:
+		tsRuntime(std::shared_ptr<tsContext>& context)
+		{
+			_context = context;
+		}
+
+		// Returns false if the script's bytecode fails verification
+		bool LoadScript(tsIndex script)
+		{
+			scriptLoaded = false;
+			tsScript& s = _context->scripts[script];
+			std::string error;
+			if (!s.load(error))
+			{
+				tsLOG_ERROR("Could not load script " << script << ": " << error);
+				return false;
+			}
+
+			loadedScript = script;
+			instance.reset(s);
+			binding.clear();
+			copyLayout = nullptr;
+			scriptLoaded = true;
+			return true;
+		}
+
+		// True if Record was generated from the layout of the loaded script
+		template<class Record>
+		bool LayoutMatches() const
+		{
+			return scriptLoaded && Record::tsLayoutHash == _context->scripts[loadedScript].layout.hash;
+		}
+
+		// Copy every global described by layout in from a host record in one call. The copy plan is built the
+		// first time a layout is used and kept until another layout or script is used.
+		bool SetGlobals(const void* record, const tsGlobalLayout& layout)
+		{
+			tsMASSERT(scriptLoaded, "No script loaded");
+			const tsCopyPlan* plan = planFor(layout);
+			if (!plan)
+				return false;
+			plan->scatter(record, instance.memory.data());
+			return true;
+		}
+
+		bool GetGlobals(void* record, const tsGlobalLayout& layout)
+		{
+			tsMASSERT(scriptLoaded, "No script loaded");
+			const tsCopyPlan* plan = planFor(layout);
+			if (!plan)
+				return false;
+			plan->gather(instance.memory.data(), record);
+			return true;
+		}
+
+		// Copy every global in from a record generated by tsCompiler::writeLayoutHeader for the loaded script
+		template<class Record>
+		void SetGlobals(const Record& record)
+		{
+			tsMASSERT(LayoutMatches<Record>(), "Record was generated for a different script");
+			SetGlobals(&record, _context->scripts[loadedScript].layout);
+		}
+
+		// Copy every global out into a record generated for the loaded script
+		template<class Record>
+		void GetGlobals(Record& record)
+		{
+			tsMASSERT(LayoutMatches<Record>(), "Record was generated for a different script");
+			GetGlobals(&record, _context->scripts[loadedScript].layout);
+		}
+
+		// Read and write a global in place at pointer instead of in the runtime's memory, until UnbindGlobals.
+		// Binding the same global again only moves it, so it is cheap to point it at a new location every run.
+		// SetGlobal and GetGlobal do not see bound globals. Returns false if the script uses the global in a way
+		// that can not be split from the rest of its memory.
+		template<class T>
+		bool BindGlobal(tsGlobalHandle<T> handle, T* pointer)
+		{
+			if (!accepts(handle))
+				return false;
+			std::string error;
+			if (!binding.bindPointer(_context->scripts[loadedScript], handle.index, sizeof(T), pointer, error))
+			{
+				tsLOG_ERROR("Could not bind global: " << error);
+				return false;
+			}
+			return true;
+		}
+
+		// Read and write a global in place at offset bytes into the record set by BindRecord
+		template<class T>
+		bool BindGlobalToRecord(tsGlobalHandle<T> handle, size_t offset)
+		{
+			if (!accepts(handle))
+				return false;
+			std::string error;
+			if (!binding.bindToRecord(_context->scripts[loadedScript], handle.index, sizeof(T), offset, error))
+			{
+				tsLOG_ERROR("Could not bind global: " << error);
+				return false;
+			}
+			return true;
+		}
+
+		// Point every global bound to the record at a new host struct, usually one per entity
+		void BindRecord(void* record)
+		{
+			binding.setRecord(record);
+		}
+
+		void UnbindGlobals()
+		{
+			binding.clear();
+		}
+
+
+		// Returns a handle that is not valid() if the loaded script has no global of this name and type
+		template<class T>
+		tsGlobalHandle<T> ResolveGlobal(const std::string& identifier) const
+		{
+			tsGlobalHandle<T> handle;
+			if (!scriptLoaded)
+			{
+				tsLOG_ERROR("Could not resolve global, no loaded function.");
+				return handle;
+			}
+			const tsGlobal* global = _context->scripts[loadedScript].findGlobal(identifier);
+			if (!global)
+			{
+				tsMASSERT(false, "Could not find identifier: " + identifier);
+				return handle;
+			}
+			if (global->type != tsTypeOf<T>::value)
+			{
+				tsMASSERT(false, "Global " + identifier + " is a " + std::string(getVarTypeName(global->type)));
+				return handle;
+			}
+			handle.index = global->index;
+			handle.script = loadedScript;
+			handle.resolved = true;
+			return handle;
+		}
+
+		// Returns false and leaves memory alone if the handle is not valid or belongs to another script
+		template<class T>
+		bool SetGlobal(tsGlobalHandle<T> handle, typename tsGlobalHandle<T>::type value)
+		{
+			if (!accepts(handle))
+				return false;
+			instance.memory.set<T>(handle.index, value);
+			return true;
+		}
+
+		// Returns T() if the handle is not valid or belongs to another script
+		template<class T>
+		T GetGlobal(tsGlobalHandle<T> handle) const
+		{
+			if (!accepts(handle))
+				return T();
+			return instance.memory.read<T>(handle.index);
+		}
+
+		template<class T>
+		void SetGlobal(const std::string& identifier, T value)
+		{
+			if (scriptLoaded)
+			{
+				const tsGlobal* global = _context->scripts[loadedScript].findGlobal(identifier);
+				if (global)
+				{
+					instance.memory.set(global->index, value);
+					return;
 				}
-				++cursor;
+				tsMASSERT(false, "Could not find identifier: " + identifier);
 			}
-			
+			else
+				tsLOG_ERROR("Could not set global, no loaded function.");
+		}
+
+		template<class T>
+		void SetGlobal(tsIndex index, T value)
+		{
+			tsScript& script = _context->scripts[loadedScript];
+			instance.memory.set(script.globals[index].index, value);
 		}
+
+		template<class T>
+		T GetGlobal(const std::string& identifier) const
+		{
+			if (scriptLoaded)
+			{
+				const tsGlobal* global = _context->scripts[loadedScript].findGlobal(identifier);
+				if (global)
+					return instance.memory.read<T>(global->index);
+				tsMASSERT(false, "Could not find identifier: " + identifier);
+			}
+			else
+				tsLOG_ERROR("Could not get global, no loaded function.");
+			return 0;
+		}
+
+		template<class T>
+		T GetGlobal(tsIndex index) const
+		{
+			const tsScript& script = _context->scripts[loadedScript];
+			return instance.memory.read<T>(script.globals[index].index);
+		}
+
+		void Run()
+		{
+			tsLOG_DEBUG("Running script: " << loadedScript);
+			Execute();
+		}
+
+		// Run the loaded script without any logging, used by Run and the benchmarks.
+		// decoded selects the prepared instructions over interpreting the raw bytecode.
+		template<bool threaded = tsThreadedDispatch, bool decoded = true>
+		void Execute()
+		{
+			tsMASSERT(scriptLoaded, "No script loaded");
+			if (bound())
+			{
+				binding.bases[tsBinding::memorySegment] = instance.memory.data();
+				tsExecuteBound<threaded>(binding.instructions.data(), binding.bases.data());
+			}
+			else if constexpr (decoded)
+				tsExecute<threaded>(_context->scripts[loadedScript], instance);
+			else
+				tsExecuteByteCode<threaded>(_context->scripts[loadedScript].bytecode, instance.memory);
+		}
+
+		// Run the loaded script on the bytecode interpreter and count what it executes in profile
+		void Profile(tsOpcodeProfile& profile)
+		{
+			tsMASSERT(scriptLoaded, "No script loaded");
+			tsMASSERT(!bound(), "Scripts with globals bound to host memory can not be profiled");
+			tsExecuteByteCode<tsThreadedDispatch, false, true>(_context->scripts[loadedScript].bytecode, instance.memory, 0, &profile);
+		}
+
 	};
-}
\ No newline at end of file
+}
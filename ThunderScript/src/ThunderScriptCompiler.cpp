@@ -11,7 +11,10 @@
 #include <unordered_map>
 
 #include "ThunderScript.h"
-#include "thunderScriptCompiler.h"
+#include "ThunderScriptCompiler.h"
+#include "tsOptimizer.h"
+#include "tsPasses.h"
+#include "tsSlotAllocator.h"
 
 #include "../bison/bison.tab.hh"
 #if ! defined(yyFlexLexerOnce)
@@ -39,7 +42,6 @@ namespace ts
 		{{tsVarType::tsFloat, tsVarType::tsInt}, tsFtoI}
 	};
 
-
 	tsVarPool::tsVarPool()
 	{
 		scopes.push(std::vector<tsVar*>());
@@ -57,12 +59,12 @@ namespace ts
 	}
 	void tsVarPool::enterScope()
 	{
-		std::cout << "entering Scope " << scopes.size() << std::endl;
+		tsLOG_DEBUG("entering Scope " << scopes.size());
 		scopes.push(std::vector<tsVar*>());
 	}
 	void tsVarPool::exitScope()
 	{
-		std::cout << "exiting Scope " << scopes.size() << std::endl;
+		tsLOG_DEBUG("exiting Scope " << scopes.size());
 		for (size_t i = 0; i < scopes.top().size(); i++)
 		{
 			scopes.top()[i]->inUse = false;
@@ -120,7 +122,7 @@ namespace ts
 		var.varIndex = index;
 		vars.push_back(var);
 		scopes.top().push_back(&vars[index]);
-		std::cout << "created var at byte index: " << var.index << std::endl;
+		tsLOG_DEBUG("created var at byte index: " << var.index);
 		return var;
 	}
 
@@ -148,17 +150,18 @@ namespace ts
 				tsMASSERT(false, "Tried to create var of unimplemented type");
 				break;
 		}
-		var.index = bytes;
-		bytes += var.size;
+		// Literals don't get a slot, lowering the IR turns them into immediates or stores them with the constants
+		var.index = 0;
+		var.literal = value;
 		var.type = type;
 		var.inUse = true;
 		var.constant = true;
 		var.identifier = constKey;
-		var.initalized = false;
+		var.initalized = true;
 		size_t index = vars.size();
 		var.varIndex = index;
 		vars.push_back(var);
-		std::cout << "created inline const var at byte index: " << var.index << std::endl;
+		tsLOG_DEBUG("created inline const " << constKey);
 		return var;
 	}
 
@@ -228,9 +231,21 @@ namespace ts
 		return compile(scriptText);
 	}
 
+	bool tsCompiler::writeLayoutHeader(tsIndex script, const std::string& structName, const std::string& path)
+	{
+		if (script >= _context->scripts.size())
+			return false;
+		std::ofstream f(path);
+		if (!f.is_open())
+			return false;
+		f << _context->scripts[script].layout.header(structName);
+		return true;
+	}
+
 	bool tsCompiler::compile(std::string& scriptText)
 	{
 		vars.reset();
+		ir.clear();
 
 		script = std::make_unique<tsScript>();
 		removeComments(scriptText);
@@ -244,8 +259,7 @@ namespace ts
 		}
 		catch (std::bad_alloc& error)
 		{
-			std::cerr << "Failed to allocate scanner: (" <<
-				error.what() << "), exiting!!" << std::endl;
+			tsLOG_ERROR("Failed to allocate scanner: (" << error.what() << "), exiting!!");
 			return false;
 		}
 
@@ -257,8 +271,7 @@ namespace ts
 		}
 		catch (std::bad_alloc& error)
 		{
-			std::cout << "Failed to allocate parser: (" <<
-				error.what() << "), exiting!!" << std::endl;
+			tsLOG_ERROR("Failed to allocate parser: (" << error.what() << "), exiting!!");
 			return false;
 		}
 
@@ -266,10 +279,39 @@ namespace ts
 		const int accept(0);
 		if (parser->parse() != accept)
 		{
-			std::cout << "Parse failed" << std::endl;
+			tsLOG_ERROR("Parse failed");
+			return false;
+		}
+		// Always terminate the script so the runtime never has to check for the end of the bytecode
+		ir.push(tsEND, tsIRValue(), tsIRValue());
+		ir.numBytes = (tsIndex)vars.sizeOf();
+		ir.globals = script->globals;
+		if (optimize)
+		{
+			passes.dump = dumpIR;
+			passes.run(ir);
+			tsAllocateSlots(ir);
+			script->globals = ir.globals;
+		}
+		if (dumpIR)
+		{
+			*dumpIR << "IR lowered to bytecode:\n";
+			tsDumpIR(*dumpIR, ir);
+		}
+		tsLower(ir, *script);
+		if (superinstructions)
+		{
+			size_t removed = tsOptimize(*script, generatedSuperinstructions);
+			// The dump is the only place the count is reported
+			if (dumpIR)
+				*dumpIR << "Fused " << removed << " instructions into superinstructions\n";
+		}
+		std::string error;
+		if (!script->load(error))
+		{
+			tsLOG_ERROR("Generated invalid bytecode: " << error);
 			return false;
 		}
-		script->numBytes = vars.sizeOf();
 		_context->scripts.push_back(*script);
 		return true;
 	}
@@ -285,7 +327,7 @@ namespace ts
 			std::string key({ scriptText[i],scriptText[i + 1] });
 			if (key == "//")
 			{
-				std::cout << "found // comment" << std::endl;
+				tsLOG_DEBUG("found // comment");
 				size_t length = scriptText.find("\n", i);
 				while (i < length)
 				{
@@ -304,7 +346,7 @@ namespace ts
 			}
 			else if (key == "/*")
 			{
-				std::cout << "Found /**/ comment" << std::endl;
+				tsLOG_DEBUG("Found /**/ comment");
 				size_t length = scriptText.find("*/", i) + 2;
 				while (i < length)
 				{
@@ -332,8 +374,9 @@ namespace ts
 	{
 		tsGlobal g;
 		g.type = type;
+		g.writeMode = writeMode;
 		g.identifier = identifier;
-		std::cout << "Creating global: " << g.identifier << std::endl;
+		tsLOG_DEBUG("Creating global: " << g.identifier);
 		tsVar var = vars.requestVar(g.identifier, g.type, line, tsGlobal::GlobalType::tsIn == writeMode, true);
 		g.index = var.index;
 		script->globals.push_back(g);
@@ -341,7 +384,7 @@ namespace ts
 
 	tsVar tsCompiler::generateVar(const std::string& identifier, const tsVarType& type)
 	{
-		std::cout << "Making: " << getVarTypeName(type) << std::endl;
+		tsLOG_DEBUG("Making: " << getVarTypeName(type));
 		return vars.requestVar(identifier, type, false);
 	}
 
@@ -372,7 +415,7 @@ namespace ts
 			throw tsCompileError("can not set constant variable: " + a.identifier, line);
 		castVar(b, a.type, line);
 		vars.initialize(a);
-		script->bytecode.MOVE(b.index, a.index, a.size);
+		ir.push(tsMOVE, irValue(b), irValue(a));
 	}
 
 	void tsCompiler::castVar(tsVar& var, tsVarType targetType, size_t line)
@@ -384,12 +427,11 @@ namespace ts
 		if (var.type == tsVarType::tsNone)
 			throw tsCompileError("Can not cast varible of none type to " + (std::string)getVarTypeName(var.type), line);
 
-		std::cout << "casing" << std::endl;
-		tsVar newVar = vars.requestTempVar(var.type, line);
+		tsLOG_DEBUG("casing");
+		tsVar newVar = vars.requestTempVar(targetType, line);
 		try
 		{
-
-			script->bytecode.pushCmd(tsVarCastCodes.at({ var.type, targetType }), var.index, newVar.index);
+			ir.push(tsVarCastCodes.at({ var.type, targetType }), irValue(var), irValue(newVar));
 		}
 		catch (const std::out_of_range& e)
 		{
@@ -400,31 +442,26 @@ namespace ts
 
 	size_t tsCompiler::getConst(const std::string value, tsVarType type, size_t line)
 	{
-		std::cout << "Found const: " << value << std::endl;
-		tsVar tsConst = vars.requestInlineConst(value, type, line);
-		if (!tsConst.initalized)
+		tsLOG_DEBUG("Found const: " << value);
+		return vars.requestInlineConst(value, type, line).varIndex;
+	}
+
+	tsIRValue tsCompiler::irValue(const tsVar& var)
+	{
+		if (!var.known())
+			return tsIRSlot(var.type, var.index);
+		switch (var.type)
 		{
-			switch (type)
-			{
-				case ts::tsVarType::tsInt:
-					script->bytecode.LOAD<tsInt>(tsConst.index, std::stoi(value));
-					break;
-				case ts::tsVarType::tsFloat:
-					script->bytecode.LOAD<tsFloat>(tsConst.index, std::stof(value));
-					break;
-				case ts::tsVarType::tsBool:
-					if (value[0] == 't')
-						script->bytecode.LOAD<tsBool>(tsConst.index, true);
-					else
-						script->bytecode.LOAD<tsBool>(tsConst.index, false);
-					break;
-				default:
-					assert(false);
-					break;
-			}
-			vars.initialize(tsConst);
+			case tsVarType::tsInt:
+				return tsIRConstant(var.type, (tsInt)std::stoi(var.literal));
+			case tsVarType::tsFloat:
+				return tsIRConstant(var.type, std::stof(var.literal));
+			case tsVarType::tsBool:
+				return tsIRConstant(var.type, (tsBool)(var.literal[0] == 't'));
+			default:
+				assert(false);
+				return tsIRValue();
 		}
-		return tsConst.varIndex;
 	}
 
 	void tsCompiler::enterScope()
@@ -449,7 +486,7 @@ namespace ts
 		tsVar a = vars.getVarFromIndex(ai);
 		tsVar b = vars.getVarFromIndex(bi);
 
-		std::cout << "adding " << a.identifier << " and " << b.identifier << std::endl;
+		tsLOG_DEBUG("adding " << a.identifier << " and " << b.identifier);
 
 		if (!a.initalized)
 			throw tsCompileError("Use of uninitalized variable: " + a.identifier, line);
@@ -481,14 +518,14 @@ namespace ts
 			default:
 				throw tsCompileError("Invalid type for add operation", line);
 		}
-		script->bytecode.pushCmd(code, a.index, b.index, result.index);
+		ir.push(code, irValue(a), irValue(b), irValue(result));
 		return result.varIndex;
 	}
 	size_t tsCompiler::sub(size_t ai, size_t bi, size_t line)
 	{
 		tsVar a = vars.getVarFromIndex(ai);
 		tsVar b = vars.getVarFromIndex(bi);
-		std::cout << "subtracting " << a.identifier << " and " << b.identifier << std::endl;
+		tsLOG_DEBUG("subtracting " << a.identifier << " and " << b.identifier);
 
 
 		if (!a.initalized)
@@ -513,17 +550,15 @@ namespace ts
 		switch (type)
 		{
 			case tsVarType::tsFloat:
-				code = tsADDF;
-				script->bytecode.pushCmd(tsFLIPF, b.index, result.index);
+				code = tsSUBF;
 				break;
 			case tsVarType::tsInt:
-				code = tsADDI;
-				script->bytecode.pushCmd(tsFLIPI, b.index, result.index);
+				code = tsSUBI;
 				break;
 			default:
 				throw tsCompileError("Invalid type for add operation", line);
 		}
-		script->bytecode.pushCmd(code, a.index, result.index, result.index);
+		ir.push(code, irValue(a), irValue(b), irValue(result));
 		return result.varIndex;
 	}
 
@@ -2,7 +2,9 @@
 
 #ifndef TS_COMPILER
 #define TS_COMPILER
-#include "thunderscript.h"
+#include "ThunderScript.h"
+#include "tsIR.h"
+#include "tsPasses.h"
 #include <string>
 #include <iostream>
 
@@ -26,8 +28,7 @@ namespace ts
 		}
 		void display()
 		{
-			std::cout << "Compiler failed with message:\n" << message
-				<< "\nOn line:\n" << line << std::endl;
+			tsLOG_ERROR("Compiler failed with message:\n" << message << "\nOn line:\n" << line);
 		}
 	};
 
@@ -42,6 +43,14 @@ namespace ts
 		bool initalized;
 		int size;
 		size_t varIndex;
+		// Literals have no slot, literal holds their value instead
+		std::string literal;
+
+		// Whether the value is known while compiling
+		bool known() const
+		{
+			return !literal.empty();
+		}
 	};
 
 	class tsVarPool
@@ -91,8 +100,23 @@ namespace ts
 		tsParser* parser = nullptr;
 		tsVarPool vars;
 		std::unique_ptr<tsScript> script;
+		// The script being compiled, the bison actions add to it and it is lowered to bytecode once parsing is done
+		tsIR ir;
 		
 	public:
+		// Fuse common instruction sequences into superinstructions after compiling
+		bool superinstructions = true;
+		// Also use the superinstructions generated into tsSuperinstructions.h, there are none until
+		// tools/GenerateSuperinstructions is run. Only the bytecode interpreter runs them, so only set this for scripts
+		// that are run with Execute<threaded, false>.
+		bool generatedSuperinstructions = false;
+		// Run the IR passes and reallocate slots before lowering
+		bool optimize = true;
+		// The passes run when optimize is set
+		tsPassManager passes = tsDefaultPasses();
+		// When set the IR is written here before and after each pass
+		std::ostream* dumpIR = nullptr;
+
 		tsCompiler(std::shared_ptr<tsContext>& context);
 		~tsCompiler();
 
@@ -100,6 +124,10 @@ namespace ts
 
 		bool compile(std::string& scriptText);
 
+		// Write a header declaring a packed struct that matches the globals of a compiled script,
+		// so the host can move every global in or out with tsRuntime::SetGlobals and GetGlobals
+		bool writeLayoutHeader(tsIndex script, const std::string& structName, const std::string& path);
+
 	#pragma region PreProcessing
 		void removeComments(std::string& scriptText);
 
@@ -122,6 +150,8 @@ namespace ts
 		void castVar(tsVar& var, tsVarType targetType, size_t line);
 
 		size_t getConst(const std::string value, tsVarType type, size_t line);
+		// The IR operand for a variable, literals become constants
+		tsIRValue irValue(const tsVar& var);
 
 		size_t add(size_t a, size_t b, size_t line);
 		size_t sub(size_t a, size_t b, size_t line);
@@ -247,7 +277,7 @@ namespace ts
 			}
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Writing assign code\n";
+				tsLOG_DEBUG("Writing assign code");
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
 				tsVar b = _dep2->getValue(bytecode, vars);
@@ -292,7 +322,7 @@ namespace ts
 			}
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of add operation" << std::endl;
+				tsLOG_DEBUG("Getting value of add operation");
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
 				tsVar b = _dep2->getValue(bytecode, vars);
@@ -332,7 +362,7 @@ namespace ts
 			}
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Writing negate code\n";
+				tsLOG_DEBUG("Writing negate code");
 				vars.enterScope();
 				tsVar a = _dep->getValue(bytecode, vars);
 				vars.exitScope();
@@ -365,7 +395,7 @@ namespace ts
 			}
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of subtract operation" << std::endl;
+				tsLOG_DEBUG("Getting value of subtract operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -407,7 +437,7 @@ namespace ts
 			}
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of multiply operation" << std::endl;
+				tsLOG_DEBUG("Getting value of multiply operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -448,7 +478,7 @@ namespace ts
 
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of divide operation" << std::endl;
+				tsLOG_DEBUG("Getting value of divide operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -489,7 +519,7 @@ namespace ts
 			}
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Writing negate code\n";
+				tsLOG_DEBUG("Writing negate code");
 				vars.enterScope();
 				tsVar a = _dep->getValue(bytecode, vars);
 				vars.exitScope();
@@ -514,7 +544,7 @@ namespace ts
 
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of divide operation" << std::endl;
+				tsLOG_DEBUG("Getting value of divide operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -545,7 +575,7 @@ namespace ts
 
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of divide operation" << std::endl;
+				tsLOG_DEBUG("Getting value of divide operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -578,7 +608,7 @@ namespace ts
 
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of equal operation" << std::endl;
+				tsLOG_DEBUG("Getting value of equal operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -629,7 +659,7 @@ namespace ts
 
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of divide operation" << std::endl;
+				tsLOG_DEBUG("Getting value of divide operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -676,7 +706,7 @@ namespace ts
 
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of divide operation" << std::endl;
+				tsLOG_DEBUG("Getting value of divide operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -723,7 +753,7 @@ namespace ts
 
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of divide operation" << std::endl;
+				tsLOG_DEBUG("Getting value of divide operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -770,7 +800,7 @@ namespace ts
 
 			tsVar getValue(tsBytecode& bytecode, tsVarPool& vars)
 			{
-				std::cout << "Getting value of divide operation" << std::endl;
+				tsLOG_DEBUG("Getting value of divide operation");
 				tsMASSERT((_dep1.get() != nullptr) && (_dep2.get() != nullptr), "Dependancy pointer(s) were null " + std::to_string(_dep1.get() != nullptr) + " " + std::to_string(_dep2.get() != nullptr));
 				vars.enterScope();
 				tsVar a = _dep1->getValue(bytecode, vars);
@@ -849,7 +879,7 @@ namespace ts
 		/*
 		void GenerateConstVars(std::vector<tsToken>& tokens, tsBytecode& bytecode)
 		{
-			std::cout << "Generating constants" << std::endl;
+			tsLOG_DEBUG("Generating constants");
 			for(size_t token = 0; token < tokens.size(); token++)
 			{
 				if (tokens[token].type == tsToken::Type::tsIdentifier)
@@ -859,17 +889,17 @@ namespace ts
 						if (tokens[token].token.find(".") == std::string::npos)
 						{
 							int value = std::stoi(tokens[token].token); // try to cast string to int, if it fails it is not a int
-							std::cout << "Found const int: " << value << std::endl;
+							tsLOG_DEBUG("Found const int: " << value);
 							std::string key = "const int " + std::to_string(value);
 							tsVar var;
 							if(vars.getVarFromIdentifier(key, var))
 							{
-								std::cout << "Found predifined const int" << std::endl;
+								tsLOG_DEBUG("Found predifined const int");
 							}
 							else
 							{
 								
-								std::cout << "Making new const int" << std::endl;
+								tsLOG_DEBUG("Making new const int");
 								tsIndex var = vars.requestVar(tsVarType::tsInt, key, true, true).index;
 								bytecode.LOAD(var, value);
 							}
@@ -878,17 +908,17 @@ namespace ts
 						else
 						{
 							float value = std::stof(tokens[token].token); // try to cast string to float, if it fails it is not a float
-							std::cout << "Found const float: " << value << std::endl;
+							tsLOG_DEBUG("Found const float: " << value);
 							std::string key = "const float " + std::to_string(value);
 							tsVar var;
 							if (vars.getVarFromIdentifier(key, var))
 							{
-								std::cout << "Found predifined const float" << std::endl;
+								tsLOG_DEBUG("Found predifined const float");
 							}
 							else
 							{
 
-								std::cout << "Making new const float" << std::endl;
+								tsLOG_DEBUG("Making new const float");
 								tsIndex var = vars.requestVar(tsVarType::tsFloat, key, true, true).index;
 								bytecode.LOAD(var, value);
 							}
@@ -906,17 +936,17 @@ namespace ts
 					{
 						case GetIndexOfReservedWord("true"):
 						{
-							std::cout << "Found const true: " << std::endl;
+							tsLOG_DEBUG("Found const true");
 							std::string key = "const true";
 							tsVar var;
 							if (vars.getVarFromIdentifier(key, var))
 							{
-								std::cout << "Found predifined const true" << std::endl;
+								tsLOG_DEBUG("Found predifined const true");
 							}
 							else
 							{
 
-								std::cout << "Making new const true" << std::endl;
+								tsLOG_DEBUG("Making new const true");
 								tsIndex var = vars.requestVar(tsVarType::tsBool, key, true, true).index;
 								bytecode.LOAD(var, true);
 							}
@@ -926,17 +956,17 @@ namespace ts
 							break;
 						case GetIndexOfReservedWord("false"):
 						{
-							std::cout << "Found const false: " << std::endl;
+							tsLOG_DEBUG("Found const false");
 							std::string key = "const false";
 							tsVar var;
 							if (vars.getVarFromIdentifier(key, var))
 							{
-								std::cout << "Found predifined const false" << std::endl;
+								tsLOG_DEBUG("Found predifined const false");
 							}
 							else
 							{
 
-								std::cout << "Making new const false" << std::endl;
+								tsLOG_DEBUG("Making new const false");
 								tsIndex var = vars.requestVar(tsVarType::tsBool, key, true, true).index;
 								bytecode.LOAD(var, false);
 							}
@@ -967,7 +997,7 @@ namespace ts
 							vars.enterScope();
 
 							//enter a new scope
-							std::cout << "Generating {} statement" << std::endl;
+							tsLOG_DEBUG("Generating {} statement");
 							size_t startLine = line;
 							i++;
 							while (tokens[i].token != "}")
@@ -1025,6 +1055,14 @@ namespace ts
 			
 		}
 
+		static std::string joinTokens(const std::vector<tsToken>& tokens)
+		{
+			std::string text;
+			for (const tsToken& token : tokens)
+				text += token.token;
+			return text;
+		}
+
 		tsIndex GenerateExpression(size_t& i, const std::vector<tsToken>& tokens, tsBytecode& bytecode)
 		{
 			std::unique_ptr<tsOperation> operation;
@@ -1036,12 +1074,7 @@ namespace ts
 					throw tsCompileError("Expected ; but file ended", tokens[i + end - 1].line);
 			}
 			std::vector opTokens(tokens.begin() + i, tokens.begin() + i + end);
-			std::cout << "Expression: ";
-			for (size_t j = 0; j < opTokens.size(); j++)
-			{
-				std::cout << opTokens[j].token;
-			}
-			std::cout << std::endl;
+			tsLOG_DEBUG("Expression: " << joinTokens(opTokens));
 			GenerateOperation(opTokens, operation);
 
 			
@@ -1072,7 +1105,7 @@ namespace ts
 					}
 					else if (vars.getVarFromIdentifier(token.token, var))
 					{
-						std::cout << "found var: " << var.identifier << std::endl;
+						tsLOG_DEBUG("found var: " << var.identifier);
 						operations.push_back(std::make_unique<tsVarOperation>(var));
 					}
 					else
@@ -1085,8 +1118,6 @@ namespace ts
 					{
 						case GetIndexOfOperator("("):
 						{
-							std::cout << "Found scoped operators: ";
-
 							int pCount = 1;
 							std::vector<tsToken> subTokens;
 							i++;
@@ -1102,23 +1133,22 @@ namespace ts
 								if (pCount > 0)
 								{
 									subTokens.push_back(tokens[i]);
-									std::cout << tokens[i].token;
 									i++;
 								}
 								
 							}
-							std::cout << std::endl;
+							tsLOG_DEBUG("Found scoped operators: " << joinTokens(subTokens));
 							std::unique_ptr<tsScopeOperation> subExpression = std::make_unique<tsScopeOperation>();
 							GenerateOperation(subTokens, subExpression->operation);
 							operations.push_back(std::move(subExpression));
 						}
 							break;
 						case GetIndexOfOperator("+"):
-							std::cout << "Found +" << std::endl;
+							tsLOG_DEBUG("Found +");
 							operations.push_back(std::make_unique<tsAddOperation>());
 							break;
 						case GetIndexOfOperator("-"):
-							std::cout << "Found -" << std::endl;
+							tsLOG_DEBUG("Found -");
 
 							if(i == 0 || (tokens[i - 1].type == tsToken::Type::tsOperator && tokens[i - 1].token != ")"))
 								operations.push_back(std::make_unique<tsNegateOperation>());
@@ -1126,49 +1156,49 @@ namespace ts
 								operations.push_back(std::make_unique<tsSubtractOperation>());
 							break;
 						case GetIndexOfOperator("*"):
-							std::cout << "Found *" << std::endl;
+							tsLOG_DEBUG("Found *");
 
 							operations.push_back(std::make_unique<tsMultiplyOperation>());
 							break;
 						case GetIndexOfOperator("/"):
-							std::cout << "Found /" << std::endl;
+							tsLOG_DEBUG("Found /");
 
 							operations.push_back(std::make_unique<tsDivideOperation>());
 							break;
 						case GetIndexOfOperator("&&"):
-							std::cout << "Found &&" << std::endl;
+							tsLOG_DEBUG("Found &&");
 							operations.push_back(std::make_unique<tsAddOperation>());
 							break;
 						case GetIndexOfOperator("||"):
-							std::cout << "Found ||" << std::endl;
+							tsLOG_DEBUG("Found ||");
 							operations.push_back(std::make_unique<tsOrOperation>());
 							break;
 						case GetIndexOfOperator("!"):
-							std::cout << "Found !" << std::endl;
+							tsLOG_DEBUG("Found !");
 							operations.push_back(std::make_unique<tsNotOperation>());
 							break;
 						case GetIndexOfOperator("=="):
-							std::cout << "Found ==" << std::endl;
+							tsLOG_DEBUG("Found ==");
 							operations.push_back(std::make_unique<tsEqualOperation>());
 							break;
 						case GetIndexOfOperator("<"):
-							std::cout << "Found <" << std::endl;
+							tsLOG_DEBUG("Found <");
 							operations.push_back(std::make_unique<tsLessOperation>());
 							break;
 						case GetIndexOfOperator(">"):
-							std::cout << "Found >" << std::endl;
+							tsLOG_DEBUG("Found >");
 							operations.push_back(std::make_unique<tsMoreOperation>());
 							break;
 						case GetIndexOfOperator("<="):
-							std::cout << "Found <=" << std::endl;
+							tsLOG_DEBUG("Found <=");
 							operations.push_back(std::make_unique<tsLessEqualOperation>());
 							break;
 						case GetIndexOfOperator(">="):
-							std::cout << "Found >=" << std::endl;
+							tsLOG_DEBUG("Found >=");
 							operations.push_back(std::make_unique<tsMoreEqualOperation>());
 							break;
 						case GetIndexOfOperator("="):
-							std::cout << "Found =" << std::endl;
+							tsLOG_DEBUG("Found =");
 
 							operations.push_back(std::make_unique<tsAssignOperation>());
 							break;
@@ -1180,7 +1210,7 @@ namespace ts
 					throw tsCompileError("Unexpected reserved word in expression: " + tokens[i].token, line);
 				if (operations.size() > 0)
 				{
-					std::cout << "operations size: " << operations.size() << std::endl;
+					tsLOG_DEBUG("operations size: " << operations.size());
 					tsMASSERT(operations.size() > 0, "size less then 1")
 					operations[operations.size() - 1]->line = line;
 				}
@@ -1196,7 +1226,7 @@ namespace ts
 						switch (operations[i] -> getDepSide())
 						{
 							case tsOperation::DepSide::both:
-								std::cout << "Found double sided operator" << std::endl;
+								tsLOG_DEBUG("Found double sided operator");
 
 								if (0 > i - 1)
 									throw tsCompileError("Value for left side of operator not found", line);
@@ -1213,7 +1243,7 @@ namespace ts
 								i--;
 								break;
 							case tsOperation::DepSide::right:
-								std::cout << "Found right sided operator" << std::endl;
+								tsLOG_DEBUG("Found right sided operator");
 
 								if (operations.size() <= i + 1)
 									throw tsCompileError("Value for right side of operator not found", line);
@@ -1223,7 +1253,7 @@ namespace ts
 								operations.erase(operations.begin() + i + 1);
 								break;
 							case tsOperation::DepSide::left:
-								std::cout << "Found left sided operator" << std::endl;
+								tsLOG_DEBUG("Found left sided operator");
 
 								if (0 > i - 1)
 									throw tsCompileError("Value for left side of operator not found", line);
@@ -1268,7 +1298,6 @@ namespace ts
 			++i;
 			int pCount = 1;
 			std::vector<tsToken> subTokens;
-			std::cout << "If condition: ";
 			while (pCount > 0)
 			{
 
@@ -1282,11 +1311,10 @@ namespace ts
 				if (pCount > 0)
 				{
 					subTokens.push_back(tokens[i]);
-					std::cout << tokens[i].token;
 					i++;
 				}
 			}
-			std::cout << std::endl;
+			tsLOG_DEBUG("If condition: " << joinTokens(subTokens));
 			std::unique_ptr<tsOperation> conditionOperation;
 			GenerateOperation(subTokens, conditionOperation);
 			tsVar condition = conditionOperation->getValue(bytecode, vars);
@@ -1312,7 +1340,6 @@ namespace ts
 			++i;
 			int pCount = 1;
 			std::vector<tsToken> subTokens;
-			std::cout << "While condition: ";
 			while (pCount > 0)
 			{
 
@@ -1326,11 +1353,10 @@ namespace ts
 				if (pCount > 0)
 				{
 					subTokens.push_back(tokens[i]);
-					std::cout << tokens[i].token;
 					i++;
 				}
 			}
-			std::cout << std::endl;
+			tsLOG_DEBUG("While condition: " << joinTokens(subTokens));
 			size_t startIndex = bytecode.bytes.size();
 
 			std::unique_ptr<tsOperation> conditionOperation;
@@ -1348,8 +1374,8 @@ namespace ts
 			
 			bytecode.GOTO(startIndex);
 			bytecode.bytes.set(endIndex, bytecode.bytes.size());
-			std::cout << "While start index: " << startIndex << std::endl;
-			std::cout << "While end index: " << bytecode.bytes.read<size_t>( endIndex) << std::endl;
+			tsLOG_DEBUG("While start index: " << startIndex);
+			tsLOG_DEBUG("While end index: " << bytecode.bytes.read<size_t>( endIndex));
 			/*
 			operation
 			if operation jump to end
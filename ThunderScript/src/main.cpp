@@ -6,6 +6,8 @@
 #include "ThunderScript.h"
 #include "ThunderScriptCompiler.h"
 #include "TSBytecodeDebugger.h";
+#include "tsBenchmark.h"
+#include "tsTranspiler.h"
 
 
 
@@ -43,15 +45,49 @@ int main()
 					ts::tsRuntime runtime(tsc);
 					
 					runtime.LoadScript(0);
-					runtime.SetGlobal<ts::tsFloat>("a", 2);
-					runtime.SetGlobal<ts::tsFloat>("b", 3);
+					ts::tsGlobalHandle<ts::tsFloat> a = runtime.ResolveGlobal<ts::tsFloat>("a");
+					ts::tsGlobalHandle<ts::tsFloat> b = runtime.ResolveGlobal<ts::tsFloat>("b");
+					ts::tsGlobalHandle<ts::tsFloat> c = runtime.ResolveGlobal<ts::tsFloat>("c");
+					runtime.SetGlobal(a, 2);
+					runtime.SetGlobal(b, 3);
 					auto start = std::chrono::high_resolution_clock::now();
 					runtime.Run();
 					auto stop = std::chrono::high_resolution_clock::now();
-					std::cout << "\n\nGlobal c has a value of: " << runtime.GetGlobal<ts::tsFloat>("c") << std::endl;
+					std::cout << "\n\nGlobal c has a value of: " << runtime.GetGlobal(c) << std::endl;
 					std::cout << "Program took: " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count()
 						<< " microseconds" << std::endl;
 				}
+
+				std::cout << "Do you want to benchmark it? (y/n): ";
+				std::cin >> input;
+				if (input == 'y')
+				{
+					ts::BenchmarkDispatch(tsc, 0);
+					ts::BenchmarkBatch(tsc, 0);
+					ts::BenchmarkJit(tsc, 0);
+					if (compiler.compileFile("scripts/Arithmetic.thun"))
+					{
+						ts::BenchmarkDispatch(tsc, (ts::tsIndex)tsc->scripts.size() - 1);
+						ts::BenchmarkBatch(tsc, (ts::tsIndex)tsc->scripts.size() - 1);
+						ts::BenchmarkJit(tsc, (ts::tsIndex)tsc->scripts.size() - 1);
+					}
+				}
+
+				std::cout << "Do you want to report how much optimizing shrinks the scripts folder? (y/n): ";
+				std::cin >> input;
+				if (input == 'y')
+					ts::ReportInstructionCounts("scripts");
+
+				std::cout << "Do you want to transpile it to C++? (y/n): ";
+				std::cin >> input;
+				if (input == 'y')
+				{
+					std::string error;
+					if (ts::tsTranspileToFile(tsc->scripts[0], "HelloWorld", filePath + ".cpp", error))
+						std::cout << "Wrote " << filePath << ".cpp" << std::endl;
+					else
+						std::cout << "Could not transpile script: " << error << std::endl;
+				}
 			}
 			else
 			{
@@ -0,0 +1,111 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+#include "tsLog.h"
+
+namespace ts
+{
+	// Heap allocations made by this thread, only counted in programs that define TS_ALLOCATION_HOOKS.
+	// Counting per thread keeps background work such as native compilation from showing up in a guard.
+	inline thread_local size_t tsAllocations = 0;
+
+	// Catches allocations in code that must never touch the heap, like LoadScript after warm up or Run.
+	// Allocations are counted from construction until check is called.
+	class tsAllocationGuard
+	{
+	private:
+		const char* name;
+		size_t start;
+
+	public:
+		tsAllocationGuard(const char* guarded) : name(guarded), start(tsAllocations)
+		{
+		}
+
+		size_t allocations() const
+		{
+			return tsAllocations - start;
+		}
+
+		// Returns false and logs an error if anything was allocated
+		bool check() const
+		{
+			size_t count = allocations();
+			if (count == 0)
+				return true;
+			tsLOG_ERROR(name << " made " << count << " heap allocations");
+			return false;
+		}
+	};
+}
+
+// Define in exactly one source file of a program to replace the global operator new with one that counts.
+// Every form of new is counted, including array and aligned ones, and every form of delete frees memory the same way
+// the matching new allocated it.
+#ifdef TS_ALLOCATION_HOOKS
+namespace ts
+{
+	static void* tsCountedAllocate(std::size_t size, std::size_t alignment) noexcept
+	{
+		++tsAllocations;
+		if (size == 0)
+			size = 1;
+		if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+			return std::malloc(size);
+	#ifdef _MSC_VER
+		return _aligned_malloc(size, alignment);
+	#else
+		// aligned_alloc wants the size to be a multiple of the alignment
+		return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+	#endif
+	}
+
+	static void tsCountedFree(void* p, std::size_t alignment) noexcept
+	{
+	#ifdef _MSC_VER
+		if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+		{
+			_aligned_free(p);
+			return;
+		}
+	#else
+		// aligned_alloc memory is released with free like the rest
+		(void)alignment;
+	#endif
+		std::free(p);
+	}
+
+	static void* tsCountedNew(std::size_t size, std::size_t alignment)
+	{
+		if (void* p = tsCountedAllocate(size, alignment))
+			return p;
+		throw std::bad_alloc();
+	}
+}
+
+void* operator new(std::size_t size) { return ts::tsCountedNew(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](std::size_t size) { return ts::tsCountedNew(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return ts::tsCountedNew(size, (std::size_t)alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return ts::tsCountedNew(size, (std::size_t)alignment); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return ts::tsCountedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return ts::tsCountedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return ts::tsCountedAllocate(size, (std::size_t)alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return ts::tsCountedAllocate(size, (std::size_t)alignment); }
+
+void operator delete(void* p) noexcept { ts::tsCountedFree(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void operator delete[](void* p) noexcept { ts::tsCountedFree(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void operator delete(void* p, std::size_t) noexcept { ts::tsCountedFree(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void operator delete[](void* p, std::size_t) noexcept { ts::tsCountedFree(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { ts::tsCountedFree(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { ts::tsCountedFree(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void operator delete(void* p, std::align_val_t alignment) noexcept { ts::tsCountedFree(p, (std::size_t)alignment); }
+void operator delete[](void* p, std::align_val_t alignment) noexcept { ts::tsCountedFree(p, (std::size_t)alignment); }
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept { ts::tsCountedFree(p, (std::size_t)alignment); }
+void operator delete[](void* p, std::size_t, std::align_val_t alignment) noexcept { ts::tsCountedFree(p, (std::size_t)alignment); }
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept { ts::tsCountedFree(p, (std::size_t)alignment); }
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept { ts::tsCountedFree(p, (std::size_t)alignment); }
+#endif
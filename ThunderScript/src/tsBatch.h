@@ -0,0 +1,454 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <algorithm>
+#include "ThunderScript.h"
+#include "tsBatchKernels.h"
+
+namespace ts
+{
+	// Memory of many instances of one script stored as a struct of arrays, one lane per instance.
+	// Slot i of lane l is stored at i * stride + l * size, so every slot is a contiguous array of values and
+	// a slot that is n bytes wide in an instance owns the n * stride bytes starting at i * stride.
+	class tsBatch
+	{
+	private:
+		std::vector<tsByte> storage;
+		tsByte* base = nullptr;
+		// Index and size of every slot the script uses, needed to move lanes in and out of instances
+		std::vector<std::pair<tsIndex, tsIndex>> slots;
+
+		// Zero the memory of laneCount lanes of numBytes each, reusing the storage if it is large enough
+		void resize(tsIndex bytes, size_t laneCount)
+		{
+			numBytes = bytes;
+			lanes = laneCount;
+			stride = (laneCount + alignment - 1) / alignment * alignment;
+			storage.assign(numBytes * stride + alignment, tsByte(0));
+			base = storage.data() + (alignment - (reinterpret_cast<uintptr_t>(storage.data()) % alignment)) % alignment;
+		}
+
+	public:
+		// Lane count is rounded up to this so every slot array starts on a cache line,
+		// this also lets vector kernels run past the last lane without leaving the slot's array
+		static constexpr size_t alignment = 64;
+
+		tsIndex numBytes = 0;
+		size_t lanes = 0;
+		size_t stride = 0;
+
+		tsBatch() = default;
+		tsBatch(const tsScript& script, size_t laneCount)
+		{
+			reset(script, laneCount);
+		}
+
+		// Size the batch for a script and fill every lane with the script's constants
+		void reset(const tsScript& script, size_t laneCount)
+		{
+			tsMASSERT(script.prepared(), "Script must be loaded before creating a batch for it");
+			resize(script.numBytes, laneCount);
+
+			std::vector<tsIndex> slotSize(numBytes, 0);
+			auto addSlot = [&](tsIndex index, size_t size) {
+				if (size != 0)
+					slotSize[index] = std::max<tsIndex>(slotSize[index], (tsIndex)size);
+			};
+			for (const tsGlobal& g : script.globals)
+				addSlot(g.index, tsGetTypeSize(g.type));
+			for (const tsInstruction& i : script.instructions)
+			{
+				tsOperandTypes types = tsGetOperandTypes(i.code);
+				addSlot(i.a, tsGetTypeSize(types.a));
+				addSlot(i.b, tsGetTypeSize(types.b));
+				addSlot(i.r, tsGetTypeSize(types.r));
+				if (i.code == tsMOVE)
+				{
+					addSlot(i.a, i.b);
+					addSlot(i.r, i.b);
+				}
+				else if (i.code == tsLOAD)
+					addSlot(i.r, i.a);
+			}
+			slots.clear();
+			for (tsIndex i = 0; i < numBytes; i++)
+				if (slotSize[i] != 0)
+					slots.push_back({ i, slotSize[i] });
+
+			// Broadcast the constant image to every lane
+			if (script.constants.size() == numBytes)
+			{
+				for (auto& slot : slots)
+					for (size_t l = 0; l < lanes; l++)
+						for (tsIndex b = 0; b < slot.second; b++)
+							at(slot.first)[l * slot.second + b] = script.constants.read<tsByte>(slot.first + b);
+			}
+		}
+
+		// Start of the array holding slot index for every lane
+		tsByte* at(tsIndex index)
+		{
+			return base + (size_t)index * stride;
+		}
+		const tsByte* at(tsIndex index) const
+		{
+			return base + (size_t)index * stride;
+		}
+		template<class T>
+		T* lanesOf(tsIndex index)
+		{
+			return reinterpret_cast<T*>(at(index));
+		}
+		template<class T>
+		const T* lanesOf(tsIndex index) const
+		{
+			return reinterpret_cast<const T*>(at(index));
+		}
+
+		// Array holding a global for every lane, so the host can fill inputs and read outputs in bulk
+		template<class T>
+		T* global(const tsScript& script, const std::string& identifier)
+		{
+			const tsGlobal* g = script.findGlobal(identifier);
+			tsMASSERT(g != nullptr, "Could not find identifier: " + identifier);
+			return g ? lanesOf<T>(g->index) : nullptr;
+		}
+
+		// Copy the memory of an instance into a lane
+		void setLane(size_t lane, const tsInstance& instance)
+		{
+			tsMASSERT(instance.numBytes == numBytes && lane < lanes, "Instance does not match the batch");
+			for (auto& slot : slots)
+				for (tsIndex b = 0; b < slot.second; b++)
+					at(slot.first)[lane * slot.second + b] = instance.memory.read<tsByte>(slot.first + b);
+		}
+
+		// Copy a lane into the memory of an instance
+		void getLane(size_t lane, tsInstance& instance) const
+		{
+			tsMASSERT(instance.numBytes == numBytes && lane < lanes, "Instance does not match the batch");
+			for (auto& slot : slots)
+				for (tsIndex b = 0; b < slot.second; b++)
+					instance.memory.set<tsByte>(slot.first + b, at(slot.first)[lane * slot.second + b]);
+		}
+
+		// Copy the globals of a record per lane in, records are recordStride bytes apart
+		void setRecords(const tsCopyPlan& plan, const void* records, size_t recordStride)
+		{
+			const tsByte* source = static_cast<const tsByte*>(records);
+			for (const tsCopyPlan::Copy& c : plan.fields)
+			{
+				tsByte* slot = at(c.index);
+				for (size_t l = 0; l < lanes; l++)
+					std::memcpy(slot + l * c.size, source + l * recordStride + c.offset, c.size);
+			}
+		}
+
+		void getRecords(const tsCopyPlan& plan, void* records, size_t recordStride) const
+		{
+			tsByte* target = static_cast<tsByte*>(records);
+			for (const tsCopyPlan::Copy& c : plan.fields)
+			{
+				const tsByte* slot = at(c.index);
+				for (size_t l = 0; l < lanes; l++)
+					std::memcpy(target + l * recordStride + c.offset, slot + l * c.size, c.size);
+			}
+		}
+
+		// Resize this batch to hold only some lanes of another batch, packed together. The storage of a batch that
+		// has held as many lanes before is reused, so gathering doesn't allocate once a batch has grown.
+		void gather(const tsBatch& source, const std::vector<size_t>& sourceLanes)
+		{
+			resize(source.numBytes, sourceLanes.size());
+			slots = source.slots;
+			for (auto& slot : slots)
+				for (size_t l = 0; l < sourceLanes.size(); l++)
+					std::memcpy(at(slot.first) + l * slot.second, source.at(slot.first) + sourceLanes[l] * slot.second, slot.second);
+		}
+
+		// Write lanes gathered from another batch back to where they came from
+		void scatter(tsBatch& target, const std::vector<size_t>& targetLanes) const
+		{
+			for (auto& slot : slots)
+				for (size_t l = 0; l < targetLanes.size(); l++)
+					std::memcpy(target.at(slot.first) + targetLanes[l] * slot.second, at(slot.first) + l * slot.second, slot.second);
+		}
+	};
+
+	// Divergent forward branches up to this many instructions long are run with masked writes,
+	// anything longer or backwards splits the lanes that jump off into their own batch.
+	constexpr size_t tsBatchMaskDistance = 32;
+
+	// Lanes split off from a batch at a divergent jump, they are run once the batch they came from is done
+	struct tsBatchSplit
+	{
+		tsBatch batch;
+		// Lane of the batch passed to tsExecuteBatch that each lane of this one came from
+		std::vector<size_t> lanes;
+		size_t pc = 0;
+	};
+
+	// Scratch space used by tsExecuteBatch, kept between runs so executing a batch over and over doesn't allocate
+	// once the buffers have grown to fit it. A context can be used with any batch, but only by one thread at a time.
+	class tsBatchContext
+	{
+	public:
+		static constexpr size_t notWaiting = SIZE_MAX;
+
+		// Which lanes are active, only filled in once they diverge
+		std::vector<tsByte> mask;
+		// Instruction each lane is waiting for execution to reach, or notWaiting
+		std::vector<size_t> waitingAt;
+		// Every instruction some lane is waiting at
+		std::vector<size_t> waitingPcs;
+		// Lanes taking the jump that is being executed
+		std::vector<size_t> jumping;
+		// Splits waiting to run are the first pending ones, the rest are only kept for their storage
+		std::vector<tsBatchSplit> splits;
+		size_t pending = 0;
+		// The split that is running
+		tsBatchSplit current;
+
+		// Kernel results when only some lanes are active
+		tsByte* scratch(size_t stride)
+		{
+			return aligned(scratchStorage, stride);
+		}
+		// Immediate forms run the kernel of their register form with the constant in every lane of this
+		tsByte* immediates(size_t stride)
+		{
+			return aligned(immediateStorage, stride);
+		}
+
+		tsBatchSplit& pushSplit()
+		{
+			if (pending == splits.size())
+				splits.emplace_back();
+			return splits[pending++];
+		}
+
+	private:
+		std::vector<tsByte> scratchStorage;
+		std::vector<tsByte> immediateStorage;
+
+		// A buffer that fits a 4 byte value for stride lanes, starting on a cache line
+		static tsByte* aligned(std::vector<tsByte>& storage, size_t stride)
+		{
+			if (storage.size() < stride * sizeof(tsFloat) + tsBatch::alignment)
+				storage.resize(stride * sizeof(tsFloat) + tsBatch::alignment);
+			return storage.data() + (tsBatch::alignment - (reinterpret_cast<uintptr_t>(storage.data()) % tsBatch::alignment)) % tsBatch::alignment;
+		}
+	};
+
+	// Copy size byte values into r only for lanes where the mask is set
+	inline void tsMaskedStore(tsByte* r, const tsByte* values, const std::vector<tsByte>& mask, size_t size, size_t lanes)
+	{
+		for (size_t l = 0; l < lanes; l++)
+			if (mask[l] != tsByte(0))
+				std::memcpy(r + l * size, values + l * size, size);
+	}
+
+	// Run every lane of a batch from pc until they have all ended. lanes maps the lanes of the batch to the batch
+	// tsExecuteBatch was given, or is null if it is that batch. Lanes split off are pushed on the context's splits
+	// instead of being run.
+	inline void tsRunBatchFrom(const tsScript& script, tsBatch& batch, size_t pc, const std::vector<size_t>* lanes,
+		tsBatchContext& context, const tsBatchKernels& kernels)
+	{
+		const tsInstruction* const code = script.instructions.data();
+
+		// The mask is only built once lanes diverge, until then every lane is active
+		std::vector<tsByte>& mask = context.mask;
+		std::vector<size_t>& waitingAt = context.waitingAt;
+		std::vector<size_t>& waitingPcs = context.waitingPcs;
+		mask.clear();
+		waitingPcs.clear();
+		size_t active = batch.lanes;
+		tsByte* scratch = context.scratch(batch.stride);
+		auto broadcast = [&](const tsInstruction& i) {
+			tsByte* immediates = context.immediates(batch.stride);
+			// Padding lanes get the constant too, so vector kernels never divide by a zero that isn't in the script
+			size_t size = tsGetTypeSize(tsGetOperandTypes(i.code).a);
+			for (size_t l = 0; l < batch.stride; l++)
+				std::memcpy(immediates + l * size, i.imm.bytes, size);
+			return immediates;
+		};
+
+		auto partial = [&]() {
+			return active != batch.lanes;
+		};
+		auto buildMask = [&]() {
+			if (mask.empty())
+			{
+				mask.assign(batch.stride, tsByte(0));
+				std::fill(mask.begin(), mask.begin() + batch.lanes, tsByte(1));
+				waitingAt.assign(batch.lanes, tsBatchContext::notWaiting);
+			}
+		};
+		auto wait = [&](size_t lane, size_t target) {
+			waitingAt[lane] = target;
+			if (std::find(waitingPcs.begin(), waitingPcs.end(), target) == waitingPcs.end())
+				waitingPcs.push_back(target);
+		};
+		// Stop running the active lanes, returns false if there are no waiting lanes left to continue with
+		auto nextWaiting = [&]() {
+			std::fill(mask.begin(), mask.end(), tsByte(0));
+			active = 0;
+			if (waitingPcs.empty())
+				return false;
+			pc = *std::min_element(waitingPcs.begin(), waitingPcs.end());
+			return true;
+		};
+
+		while (true)
+		{
+			if (!waitingPcs.empty())
+			{
+				auto merge = std::find(waitingPcs.begin(), waitingPcs.end(), pc);
+				if (merge != waitingPcs.end())
+				{
+					for (size_t l = 0; l < batch.lanes; l++)
+					{
+						if (waitingAt[l] == pc)
+						{
+							waitingAt[l] = tsBatchContext::notWaiting;
+							mask[l] = tsByte(1);
+							active++;
+						}
+					}
+					waitingPcs.erase(merge);
+				}
+			}
+
+			const tsInstruction* ip = code + pc;
+			switch (ip->code)
+			{
+				case tsEND:
+					// Lanes that reach the end are finished, carry on with any that are still waiting
+					if (!partial() || !nextWaiting())
+						return;
+					continue;
+				case tsJUMP:
+					if (partial() && ip->imm.target > pc)
+					{
+						for (size_t l = 0; l < batch.lanes; l++)
+							if (mask[l] != tsByte(0))
+								wait(l, ip->imm.target);
+						if (!nextWaiting())
+							return;
+						continue;
+					}
+					pc = ip->imm.target;
+					continue;
+				case tsJUMPF:
+				case tsJUMPFLessI:
+				case tsJUMPFLessF:
+				case tsJUMPFLessEqualI:
+				case tsJUMPFLessEqualF:
+				case tsJUMPFEqualI:
+				case tsJUMPFEqualF:
+				{
+					const tsBool* condition;
+					if (ip->code == tsJUMPF)
+						condition = batch.lanesOf<tsBool>(ip->a);
+					else
+					{
+						// Compare every lane into scratch and branch on that like a tsJUMPF would
+						tsByte* compared = scratch;
+						kernels.ops[(size_t)tsJumpComparison(ip->code)](batch.at(ip->a), batch.at(ip->b), compared, batch.lanes);
+						condition = reinterpret_cast<const tsBool*>(compared);
+					}
+					std::vector<size_t>& jumping = context.jumping;
+					jumping.clear();
+					for (size_t l = 0; l < batch.lanes; l++)
+						if (!condition[l] && (!partial() || mask[l] != tsByte(0)))
+							jumping.push_back(l);
+					if (jumping.empty())
+						break;
+					if (jumping.size() == active)
+					{
+						pc = ip->imm.target;
+						continue;
+					}
+
+					buildMask();
+					if (ip->imm.target > pc && ip->imm.target - pc <= tsBatchMaskDistance)
+					{
+						for (size_t l : jumping)
+							wait(l, ip->imm.target);
+					}
+					else
+					{
+						tsBatchSplit& split = context.pushSplit();
+						split.batch.gather(batch, jumping);
+						split.pc = ip->imm.target;
+						split.lanes.clear();
+						for (size_t l : jumping)
+							split.lanes.push_back(lanes ? (*lanes)[l] : l);
+					}
+					for (size_t l : jumping)
+						mask[l] = tsByte(0);
+					active -= jumping.size();
+					break;
+				}
+				case tsLOAD:
+				{
+					tsByte* r = batch.at(ip->r);
+					for (size_t l = 0; l < batch.lanes; l++)
+						if (!partial() || mask[l] != tsByte(0))
+							std::memcpy(r + l * ip->a, ip->imm.bytes, ip->a);
+					break;
+				}
+				case tsMOVE:
+					// Slots are contiguous arrays, so moving a slot is a single copy for the whole batch
+					if (partial())
+						tsMaskedStore(batch.at(ip->r), batch.at(ip->a), mask, ip->b, batch.lanes);
+					else
+						std::memmove(batch.at(ip->r), batch.at(ip->a), (size_t)ip->b * batch.stride);
+					break;
+				default:
+				{
+					// Every other command is an element wise operation with a kernel
+					bool immediate = tsIsImmediate(ip->code);
+					tsBatchKernel kernel = kernels.ops[(size_t)(immediate ? tsRegisterForm(ip->code) : ip->code)];
+					tsMASSERT(kernel != nullptr, "Unknown byte code! " + std::to_string((unsigned int)ip->code));
+					const tsByte* b = immediate ? broadcast(*ip) : batch.at(ip->b);
+					if (partial())
+					{
+						kernel(batch.at(ip->a), b, scratch, batch.lanes);
+						tsMaskedStore(batch.at(ip->r), scratch, mask, tsGetTypeSize(tsGetOperandTypes(ip->code).r), batch.lanes);
+					}
+					else
+						kernel(batch.at(ip->a), b, batch.at(ip->r), batch.lanes);
+					break;
+				}
+			}
+			++pc;
+		}
+	}
+
+	// Run a script on every lane of a batch. Each instruction is executed for all lanes before moving on to the next,
+	// so the cost of dispatch is paid once per batch instead of once per instance.
+	// By default the operations run on the widest vector kernels the cpu supports.
+	//
+	// When lanes disagree on a tsJUMPF or compare jump the batch keeps a mask of the lanes that are active. Lanes that jump a short way
+	// forward wait at the target and are merged back into the mask when execution reaches it, while everything in
+	// between only writes to the active lanes. Lanes that jump backwards or far ahead are compacted into a new batch
+	// that is put on a worklist and run from the jump target once the batch it left is done, then copied back.
+	// A split only runs once the batch it left has been copied back, so the lanes it took end up with its values.
+	//
+	// Everything the run needs besides the batch is kept in the context, reuse it between runs to avoid allocating.
+	inline void tsExecuteBatch(const tsScript& script, tsBatch& batch, tsBatchContext& context, const tsBatchKernels& kernels = tsGetBatchKernels())
+	{
+		tsMASSERT(script.verified && script.prepared(), "Only loaded and verified scripts can be executed in a batch");
+		tsMASSERT(batch.numBytes == script.numBytes, "Batch was not created for this script");
+		context.pending = 0;
+		tsRunBatchFrom(script, batch, 0, nullptr, context, kernels);
+		while (context.pending != 0)
+		{
+			// Swapping keeps the storage of both splits around for the next ones
+			std::swap(context.current, context.splits[--context.pending]);
+			tsRunBatchFrom(script, context.current.batch, context.current.pc, &context.current.lanes, context, kernels);
+			context.current.batch.scatter(batch, context.current.lanes);
+		}
+	}
+}
@@ -0,0 +1,459 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "ThunderScript.h"
+
+// Vector kernels are only written for x86-64, where SSE2 is always available
+#if defined(__x86_64__) || defined(_M_X64)
+	#define TS_BATCH_SIMD 1
+	#include <immintrin.h>
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#include <intrin.h>
+		#define tsTARGET_AVX2
+	#else
+		#define tsTARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#else
+	#define TS_BATCH_SIMD 0
+#endif
+
+namespace ts
+{
+	// Runs one command over n lanes of a tsBatch. a, b and r point at the start of the slot arrays, b is unused by unary
+	// commands. Vector kernels round n up to a multiple of their width, tsBatch pads its lanes so that is always safe.
+	typedef void (*tsBatchKernel)(const tsByte* a, const tsByte* b, tsByte* r, size_t n);
+
+	// One kernel per command, indexed by the command byte. Control flow and copies are handled by the batch interpreter,
+	// compare jumps use the kernel of their comparison.
+	struct tsBatchKernels
+	{
+		const char* name;
+		tsBatchKernel ops[tsCommandCount] = {};
+	};
+
+#pragma region Scalar
+	#define tsSCALAR_UNARY(name, T, R, expr) \
+		inline void name(const tsByte* pa, const tsByte*, tsByte* pr, size_t n) \
+		{ \
+			const T* a = reinterpret_cast<const T*>(pa); \
+			R* r = reinterpret_cast<R*>(pr); \
+			for (size_t l = 0; l < n; l++) \
+				r[l] = (R)(expr); \
+		}
+	#define tsSCALAR_BINARY(name, T, R, expr) \
+		inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			const T* a = reinterpret_cast<const T*>(pa); \
+			const T* b = reinterpret_cast<const T*>(pb); \
+			R* r = reinterpret_cast<R*>(pr); \
+			for (size_t l = 0; l < n; l++) \
+				r[l] = (R)(expr); \
+		}
+
+	namespace scalar
+	{
+		// Kernels also run over lanes a mask has switched off, whose values the script never meant to divide or convert.
+		// Those must not trap, so a divisor of 0 counts as 1 and the overflowing cases give INT_MIN like cvttps2dq does.
+		inline tsInt divide(tsInt a, tsInt b)
+		{
+			if (b == 0)
+				return a;
+			if (b == -1)
+				return (tsInt)(0u - (uint32_t)a);
+			return a / b;
+		}
+		inline tsInt truncate(tsFloat a)
+		{
+			return a >= -2147483648.0f && a < 2147483648.0f ? (tsInt)a : INT32_MIN;
+		}
+
+		tsSCALAR_UNARY(ItoF, tsInt, tsFloat, a[l])
+		tsSCALAR_UNARY(FtoI, tsFloat, tsInt, truncate(a[l]))
+		tsSCALAR_UNARY(FLIPI, tsInt, tsInt, -a[l])
+		tsSCALAR_BINARY(ADDI, tsInt, tsInt, a[l] + b[l])
+		tsSCALAR_BINARY(MULI, tsInt, tsInt, a[l] * b[l])
+		tsSCALAR_BINARY(DIVI, tsInt, tsInt, divide(a[l], b[l]))
+		tsSCALAR_UNARY(FLIPF, tsFloat, tsFloat, -a[l])
+		tsSCALAR_BINARY(ADDF, tsFloat, tsFloat, a[l] + b[l])
+		tsSCALAR_BINARY(MULF, tsFloat, tsFloat, a[l] * b[l])
+		tsSCALAR_BINARY(DIVF, tsFloat, tsFloat, a[l] / b[l])
+		tsSCALAR_UNARY(NOT, tsBool, tsBool, !a[l])
+		tsSCALAR_BINARY(AND, tsBool, tsBool, a[l] && b[l])
+		tsSCALAR_BINARY(OR, tsBool, tsBool, a[l] || b[l])
+		tsSCALAR_BINARY(LessI, tsInt, tsBool, a[l] < b[l])
+		tsSCALAR_BINARY(LessF, tsFloat, tsBool, a[l] < b[l])
+		tsSCALAR_BINARY(LessEqualI, tsInt, tsBool, a[l] <= b[l])
+		tsSCALAR_BINARY(LessEqualF, tsFloat, tsBool, a[l] <= b[l])
+		tsSCALAR_BINARY(EqualI, tsInt, tsBool, a[l] == b[l])
+		tsSCALAR_BINARY(EqualF, tsFloat, tsBool, a[l] == b[l])
+		tsSCALAR_BINARY(EqualB, tsBool, tsBool, a[l] == b[l])
+		tsSCALAR_BINARY(SUBI, tsInt, tsInt, a[l] - b[l])
+		tsSCALAR_BINARY(SUBF, tsFloat, tsFloat, a[l] - b[l])
+		inline void ItoFADDF(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n)
+		{
+			const tsInt* a = reinterpret_cast<const tsInt*>(pa);
+			const tsFloat* b = reinterpret_cast<const tsFloat*>(pb);
+			tsFloat* r = reinterpret_cast<tsFloat*>(pr);
+			for (size_t l = 0; l < n; l++)
+				r[l] = (tsFloat)a[l] + b[l];
+		}
+	}
+
+	#undef tsSCALAR_UNARY
+	#undef tsSCALAR_BINARY
+#pragma endregion
+
+	#define tsKERNEL_TABLE(ns) \
+		k.ops[(size_t)tsItoF] = ns::ItoF; \
+		k.ops[(size_t)tsFtoI] = ns::FtoI; \
+		k.ops[(size_t)tsFLIPI] = ns::FLIPI; \
+		k.ops[(size_t)tsADDI] = ns::ADDI; \
+		k.ops[(size_t)tsMULI] = ns::MULI; \
+		k.ops[(size_t)tsDIVI] = ns::DIVI; \
+		k.ops[(size_t)tsFLIPF] = ns::FLIPF; \
+		k.ops[(size_t)tsADDF] = ns::ADDF; \
+		k.ops[(size_t)tsMULF] = ns::MULF; \
+		k.ops[(size_t)tsDIVF] = ns::DIVF; \
+		k.ops[(size_t)tsNOT] = ns::NOT; \
+		k.ops[(size_t)tsAND] = ns::AND; \
+		k.ops[(size_t)tsOR] = ns::OR; \
+		k.ops[(size_t)tsLessI] = ns::LessI; \
+		k.ops[(size_t)tsLessF] = ns::LessF; \
+		k.ops[(size_t)tsLessEqualI] = ns::LessEqualI; \
+		k.ops[(size_t)tsLessEqualF] = ns::LessEqualF; \
+		k.ops[(size_t)tsEqualI] = ns::EqualI; \
+		k.ops[(size_t)tsEqualF] = ns::EqualF; \
+		k.ops[(size_t)tsEqualB] = ns::EqualB; \
+		k.ops[(size_t)tsSUBI] = ns::SUBI; \
+		k.ops[(size_t)tsSUBF] = ns::SUBF; \
+		k.ops[(size_t)tsItoFADDF] = ns::ItoFADDF;
+
+	inline const tsBatchKernels& tsScalarKernels()
+	{
+		static const tsBatchKernels kernels = [] {
+			tsBatchKernels k;
+			k.name = "scalar";
+			tsKERNEL_TABLE(scalar)
+			return k;
+		}();
+		return kernels;
+	}
+
+#if TS_BATCH_SIMD
+#pragma region SSE2
+	// Every slot array is 64 byte aligned, so all loads and stores are aligned. 32 bit operations work on 4 lanes at a time,
+	// bool operations on 16 and comparisons do 16 lanes at a time so they can pack four masks into one store of bools.
+	#define tsSSE_FLOAT_BINARY(name, expr) \
+		inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			for (size_t l = 0; l < n; l += 4) \
+			{ \
+				__m128 a = _mm_load_ps(reinterpret_cast<const float*>(pa) + l); \
+				__m128 b = _mm_load_ps(reinterpret_cast<const float*>(pb) + l); \
+				_mm_store_ps(reinterpret_cast<float*>(pr) + l, expr); \
+			} \
+		}
+	#define tsSSE_INT_BINARY(name, expr) \
+		inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			for (size_t l = 0; l < n; l += 4) \
+			{ \
+				__m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(pa + l * 4)); \
+				__m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(pb + l * 4)); \
+				_mm_store_si128(reinterpret_cast<__m128i*>(pr + l * 4), expr); \
+			} \
+		}
+	#define tsSSE_BOOL_BINARY(name, expr) \
+		inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			for (size_t l = 0; l < n; l += 16) \
+			{ \
+				__m128i a = _mm_load_si128(reinterpret_cast<const __m128i*>(pa + l)); \
+				__m128i b = _mm_load_si128(reinterpret_cast<const __m128i*>(pb + l)); \
+				_mm_store_si128(reinterpret_cast<__m128i*>(pr + l), expr); \
+			} \
+		}
+	// mask(a, b) gives a 32 bit mask of 4 lanes from pointers to their values
+	#define tsSSE_COMPARE(name, load, mask) \
+		inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			const __m128i one = _mm_set1_epi8(1); \
+			for (size_t l = 0; l < n; l += 16) \
+			{ \
+				__m128i m[4]; \
+				for (size_t i = 0; i < 4; i++) \
+				{ \
+					auto a = load(pa + (l + i * 4) * 4); \
+					auto b = load(pb + (l + i * 4) * 4); \
+					m[i] = mask; \
+				} \
+				__m128i packed = _mm_packs_epi16(_mm_packs_epi32(m[0], m[1]), _mm_packs_epi32(m[2], m[3])); \
+				_mm_store_si128(reinterpret_cast<__m128i*>(pr + l), _mm_and_si128(packed, one)); \
+			} \
+		}
+
+	namespace sse2
+	{
+		inline __m128 loadF(const tsByte* p)
+		{
+			return _mm_load_ps(reinterpret_cast<const float*>(p));
+		}
+		inline __m128i loadI(const tsByte* p)
+		{
+			return _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+		}
+		// SSE2 has no 32 bit multiply, build it from two 32x32->64 multiplies of the even and odd lanes
+		inline __m128i mullo(__m128i a, __m128i b)
+		{
+			__m128i even = _mm_mul_epu32(a, b);
+			__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+			return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+		}
+		// There is no vector integer division, but a double holds every int exactly and truncating the quotient is exact
+		inline __m128i div(__m128i a, __m128i b)
+		{
+			__m128i lo = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(a), _mm_cvtepi32_pd(b)));
+			__m128i hi = _mm_cvttpd_epi32(_mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(a, 8)), _mm_cvtepi32_pd(_mm_srli_si128(b, 8))));
+			return _mm_unpacklo_epi64(lo, hi);
+		}
+
+		inline void ItoF(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			for (size_t l = 0; l < n; l += 4)
+				_mm_store_ps(reinterpret_cast<float*>(pr) + l, _mm_cvtepi32_ps(loadI(pa + l * 4)));
+		}
+		inline void FtoI(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			for (size_t l = 0; l < n; l += 4)
+				_mm_store_si128(reinterpret_cast<__m128i*>(pr + l * 4), _mm_cvttps_epi32(loadF(pa + l * 4)));
+		}
+		inline void FLIPI(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			for (size_t l = 0; l < n; l += 4)
+				_mm_store_si128(reinterpret_cast<__m128i*>(pr + l * 4), _mm_sub_epi32(_mm_setzero_si128(), loadI(pa + l * 4)));
+		}
+		inline void FLIPF(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			const __m128 sign = _mm_set1_ps(-0.0f);
+			for (size_t l = 0; l < n; l += 4)
+				_mm_store_ps(reinterpret_cast<float*>(pr) + l, _mm_xor_ps(loadF(pa + l * 4), sign));
+		}
+		inline void NOT(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			const __m128i one = _mm_set1_epi8(1);
+			for (size_t l = 0; l < n; l += 16)
+				_mm_store_si128(reinterpret_cast<__m128i*>(pr + l), _mm_xor_si128(loadI(pa + l), one));
+		}
+		inline void ItoFADDF(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n)
+		{
+			for (size_t l = 0; l < n; l += 4)
+				_mm_store_ps(reinterpret_cast<float*>(pr) + l, _mm_add_ps(_mm_cvtepi32_ps(loadI(pa + l * 4)), loadF(pb + l * 4)));
+		}
+		tsSSE_INT_BINARY(ADDI, _mm_add_epi32(a, b))
+		tsSSE_INT_BINARY(SUBI, _mm_sub_epi32(a, b))
+		tsSSE_INT_BINARY(MULI, mullo(a, b))
+		tsSSE_INT_BINARY(DIVI, div(a, b))
+		tsSSE_FLOAT_BINARY(ADDF, _mm_add_ps(a, b))
+		tsSSE_FLOAT_BINARY(SUBF, _mm_sub_ps(a, b))
+		tsSSE_FLOAT_BINARY(MULF, _mm_mul_ps(a, b))
+		tsSSE_FLOAT_BINARY(DIVF, _mm_div_ps(a, b))
+		tsSSE_BOOL_BINARY(AND, _mm_and_si128(a, b))
+		tsSSE_BOOL_BINARY(OR, _mm_or_si128(a, b))
+		tsSSE_BOOL_BINARY(EqualB, _mm_xor_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)))
+		tsSSE_COMPARE(LessI, loadI, _mm_cmplt_epi32(a, b))
+		tsSSE_COMPARE(LessEqualI, loadI, _mm_xor_si128(_mm_cmpgt_epi32(a, b), _mm_set1_epi32(-1)))
+		tsSSE_COMPARE(EqualI, loadI, _mm_cmpeq_epi32(a, b))
+		tsSSE_COMPARE(LessF, loadF, _mm_castps_si128(_mm_cmplt_ps(a, b)))
+		tsSSE_COMPARE(LessEqualF, loadF, _mm_castps_si128(_mm_cmple_ps(a, b)))
+		tsSSE_COMPARE(EqualF, loadF, _mm_castps_si128(_mm_cmpeq_ps(a, b)))
+	}
+
+	#undef tsSSE_FLOAT_BINARY
+	#undef tsSSE_INT_BINARY
+	#undef tsSSE_BOOL_BINARY
+	#undef tsSSE_COMPARE
+#pragma endregion
+
+#pragma region AVX2
+	// Same layout as the SSE2 kernels at twice the width. Every function needs the avx2 target since the rest of the
+	// program is compiled for the SSE2 baseline.
+	#define tsAVX_FLOAT_BINARY(name, expr) \
+		tsTARGET_AVX2 inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			for (size_t l = 0; l < n; l += 8) \
+			{ \
+				__m256 a = _mm256_load_ps(reinterpret_cast<const float*>(pa) + l); \
+				__m256 b = _mm256_load_ps(reinterpret_cast<const float*>(pb) + l); \
+				_mm256_store_ps(reinterpret_cast<float*>(pr) + l, expr); \
+			} \
+		}
+	#define tsAVX_INT_BINARY(name, expr) \
+		tsTARGET_AVX2 inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			for (size_t l = 0; l < n; l += 8) \
+			{ \
+				__m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(pa + l * 4)); \
+				__m256i b = _mm256_load_si256(reinterpret_cast<const __m256i*>(pb + l * 4)); \
+				_mm256_store_si256(reinterpret_cast<__m256i*>(pr + l * 4), expr); \
+			} \
+		}
+	#define tsAVX_BOOL_BINARY(name, expr) \
+		tsTARGET_AVX2 inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			for (size_t l = 0; l < n; l += 32) \
+			{ \
+				__m256i a = _mm256_load_si256(reinterpret_cast<const __m256i*>(pa + l)); \
+				__m256i b = _mm256_load_si256(reinterpret_cast<const __m256i*>(pb + l)); \
+				_mm256_store_si256(reinterpret_cast<__m256i*>(pr + l), expr); \
+			} \
+		}
+	// The pack instructions work inside each 128 bit half, so the packed groups of four lanes need to be put back in order
+	#define tsAVX_COMPARE(name, load, mask) \
+		tsTARGET_AVX2 inline void name(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n) \
+		{ \
+			const __m256i one = _mm256_set1_epi8(1); \
+			const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7); \
+			for (size_t l = 0; l < n; l += 32) \
+			{ \
+				__m256i m[4]; \
+				for (size_t i = 0; i < 4; i++) \
+				{ \
+					auto a = load(pa + (l + i * 8) * 4); \
+					auto b = load(pb + (l + i * 8) * 4); \
+					m[i] = mask; \
+				} \
+				__m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(m[0], m[1]), _mm256_packs_epi32(m[2], m[3])); \
+				packed = _mm256_permutevar8x32_epi32(packed, order); \
+				_mm256_store_si256(reinterpret_cast<__m256i*>(pr + l), _mm256_and_si256(packed, one)); \
+			} \
+		}
+
+	namespace avx2
+	{
+		tsTARGET_AVX2 inline __m256 loadF(const tsByte* p)
+		{
+			return _mm256_load_ps(reinterpret_cast<const float*>(p));
+		}
+		tsTARGET_AVX2 inline __m256i loadI(const tsByte* p)
+		{
+			return _mm256_load_si256(reinterpret_cast<const __m256i*>(p));
+		}
+		tsTARGET_AVX2 inline __m256i div(__m256i a, __m256i b)
+		{
+			__m128i lo = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(a)), _mm256_cvtepi32_pd(_mm256_castsi256_si128(b))));
+			__m128i hi = _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(a, 1)), _mm256_cvtepi32_pd(_mm256_extracti128_si256(b, 1))));
+			return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		}
+
+		tsTARGET_AVX2 inline void ItoF(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			for (size_t l = 0; l < n; l += 8)
+				_mm256_store_ps(reinterpret_cast<float*>(pr) + l, _mm256_cvtepi32_ps(loadI(pa + l * 4)));
+		}
+		tsTARGET_AVX2 inline void FtoI(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			for (size_t l = 0; l < n; l += 8)
+				_mm256_store_si256(reinterpret_cast<__m256i*>(pr + l * 4), _mm256_cvttps_epi32(loadF(pa + l * 4)));
+		}
+		tsTARGET_AVX2 inline void FLIPI(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			for (size_t l = 0; l < n; l += 8)
+				_mm256_store_si256(reinterpret_cast<__m256i*>(pr + l * 4), _mm256_sub_epi32(_mm256_setzero_si256(), loadI(pa + l * 4)));
+		}
+		tsTARGET_AVX2 inline void FLIPF(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			const __m256 sign = _mm256_set1_ps(-0.0f);
+			for (size_t l = 0; l < n; l += 8)
+				_mm256_store_ps(reinterpret_cast<float*>(pr) + l, _mm256_xor_ps(loadF(pa + l * 4), sign));
+		}
+		tsTARGET_AVX2 inline void NOT(const tsByte* pa, const tsByte*, tsByte* pr, size_t n)
+		{
+			const __m256i one = _mm256_set1_epi8(1);
+			for (size_t l = 0; l < n; l += 32)
+				_mm256_store_si256(reinterpret_cast<__m256i*>(pr + l), _mm256_xor_si256(loadI(pa + l), one));
+		}
+		tsTARGET_AVX2 inline void ItoFADDF(const tsByte* pa, const tsByte* pb, tsByte* pr, size_t n)
+		{
+			for (size_t l = 0; l < n; l += 8)
+				_mm256_store_ps(reinterpret_cast<float*>(pr) + l, _mm256_add_ps(_mm256_cvtepi32_ps(loadI(pa + l * 4)), loadF(pb + l * 4)));
+		}
+		tsAVX_INT_BINARY(ADDI, _mm256_add_epi32(a, b))
+		tsAVX_INT_BINARY(SUBI, _mm256_sub_epi32(a, b))
+		tsAVX_INT_BINARY(MULI, _mm256_mullo_epi32(a, b))
+		tsAVX_INT_BINARY(DIVI, div(a, b))
+		tsAVX_FLOAT_BINARY(ADDF, _mm256_add_ps(a, b))
+		tsAVX_FLOAT_BINARY(SUBF, _mm256_sub_ps(a, b))
+		tsAVX_FLOAT_BINARY(MULF, _mm256_mul_ps(a, b))
+		tsAVX_FLOAT_BINARY(DIVF, _mm256_div_ps(a, b))
+		tsAVX_BOOL_BINARY(AND, _mm256_and_si256(a, b))
+		tsAVX_BOOL_BINARY(OR, _mm256_or_si256(a, b))
+		tsAVX_BOOL_BINARY(EqualB, _mm256_xor_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1)))
+		tsAVX_COMPARE(LessI, loadI, _mm256_cmpgt_epi32(b, a))
+		tsAVX_COMPARE(LessEqualI, loadI, _mm256_xor_si256(_mm256_cmpgt_epi32(a, b), _mm256_set1_epi32(-1)))
+		tsAVX_COMPARE(EqualI, loadI, _mm256_cmpeq_epi32(a, b))
+		tsAVX_COMPARE(LessF, loadF, _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)))
+		tsAVX_COMPARE(LessEqualF, loadF, _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LE_OQ)))
+		tsAVX_COMPARE(EqualF, loadF, _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)))
+	}
+
+	#undef tsAVX_FLOAT_BINARY
+	#undef tsAVX_INT_BINARY
+	#undef tsAVX_BOOL_BINARY
+	#undef tsAVX_COMPARE
+#pragma endregion
+
+	inline const tsBatchKernels& tsSse2Kernels()
+	{
+		static const tsBatchKernels kernels = [] {
+			tsBatchKernels k;
+			k.name = "sse2";
+			tsKERNEL_TABLE(sse2)
+			return k;
+		}();
+		return kernels;
+	}
+
+	inline const tsBatchKernels& tsAvx2Kernels()
+	{
+		static const tsBatchKernels kernels = [] {
+			tsBatchKernels k;
+			k.name = "avx2";
+			tsKERNEL_TABLE(avx2)
+			return k;
+		}();
+		return kernels;
+	}
+
+	inline bool tsCpuSupportsAvx2()
+	{
+	#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		// The OS has to save the ymm registers as well as the cpu supporting the instructions
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if (!osxsave || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+	#else
+		return __builtin_cpu_supports("avx2");
+	#endif
+	}
+#endif
+
+	#undef tsKERNEL_TABLE
+
+	// The fastest kernels the cpu we're running on supports
+	inline const tsBatchKernels& tsGetBatchKernels()
+	{
+	#if TS_BATCH_SIMD
+		static const tsBatchKernels& best = tsCpuSupportsAvx2() ? tsAvx2Kernels() : tsSse2Kernels();
+		return best;
+	#else
+		return tsScalarKernels();
+	#endif
+	}
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include <chrono>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include "ThunderScript.h"
+#include "ThunderScriptCompiler.h"
+#include "tsBatch.h"
+#include "tsJit.h"
+
+namespace ts
+{
+	// Count the instructions in a script, scripts are straight line code so this is also the number executed per run
+	inline size_t CountInstructions(const tsBytecode& bytecode)
+	{
+		size_t count = 0;
+		for (size_t cursor = 0; cursor < bytecode.bytes.size(); cursor += tsInstructionSize(bytecode.bytes, cursor))
+			count++;
+		return count;
+	}
+
+	// Compile every script in a directory with and without the IR passes and print how many instructions and bytes
+	// of memory each one ends up with, and how many instructions it would have without common subexpression
+	// elimination. Superinstructions are left out so the counts only show what the passes did.
+	inline void ReportInstructionCounts(const std::string& directory)
+	{
+		std::vector<std::filesystem::path> paths;
+		std::error_code ec;
+		for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, ec))
+			if (entry.path().extension() == ".thun")
+				paths.push_back(entry.path());
+		std::sort(paths.begin(), paths.end());
+		if (ec)
+			std::cout << "Could not read " << directory << ": " << ec.message() << std::endl;
+
+		size_t totals[3] = { 0, 0, 0 };
+		for (const std::filesystem::path& path : paths)
+		{
+			// Unoptimized, optimized, then optimized without common subexpression elimination
+			size_t instructions[3];
+			tsIndex bytes[3];
+			try
+			{
+				for (int build = 0; build < 3; build++)
+				{
+					std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+					tsCompiler compiler(context);
+					compiler.optimize = build != 0;
+					compiler.superinstructions = false;
+					if (build == 2)
+						compiler.passes.remove("common subexpression elimination");
+					if (!compiler.compileFile(path.string()))
+						throw tsCompileError("Could not compile", 0);
+					instructions[build] = CountInstructions(context->scripts[0].bytecode);
+					bytes[build] = context->scripts[0].numBytes;
+				}
+			}
+			catch (const tsCompileError& error)
+			{
+				std::cout << "  " << path.filename().string() << ": " << error.message << std::endl;
+				continue;
+			}
+			for (int build = 0; build < 3; build++)
+				totals[build] += instructions[build];
+			std::cout << "  " << path.filename().string() << ": " << instructions[0] << " -> " << instructions[1] << " instructions, "
+				<< bytes[0] << " -> " << bytes[1] << " bytes" << std::endl;
+			std::cout << "    common subexpression elimination: " << instructions[2] << " -> " << instructions[1] << " instructions" << std::endl;
+		}
+		std::cout << "  total: " << totals[0] << " -> " << totals[1] << " instructions, " << totals[2] << " -> " << totals[1]
+			<< " from common subexpression elimination" << std::endl;
+	}
+
+	// Returns the average time of one run in nanoseconds
+	template<bool threaded, bool decoded>
+	double TimeRuns(tsRuntime& runtime, size_t runs)
+	{
+		// Warm up the caches and branch predictors before measuring
+		for (size_t i = 0; i < runs / 10; i++)
+			runtime.Execute<threaded, decoded>();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < runs; i++)
+			runtime.Execute<threaded, decoded>();
+		auto stop = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::nano>(stop - start).count() / runs;
+	}
+
+	inline void PrintTime(const std::string& name, double time, size_t instructions)
+	{
+		std::cout << "  " << name << time << " ns/run, " << time / instructions << " ns/instruction" << std::endl;
+	}
+
+	inline void BenchmarkDispatch(std::shared_ptr<tsContext>& context, tsIndex script, size_t runs = 1000000)
+	{
+		tsRuntime runtime(context);
+		runtime.LoadScript(script);
+		size_t instructions = CountInstructions(context->scripts[script].bytecode);
+
+		std::cout << "Benchmarking script " << script << " (" << instructions << " instructions, " << runs << " runs)" << std::endl;
+		double switchTime = TimeRuns<false, false>(runtime, runs);
+		PrintTime("bytecode, switch dispatch:       ", switchTime, instructions);
+		double decodedTime = TimeRuns<false, true>(runtime, runs);
+		PrintTime("instructions, switch dispatch:   ", decodedTime, instructions);
+	#if TS_THREADED_DISPATCH
+		double threadedTime = TimeRuns<true, false>(runtime, runs);
+		PrintTime("bytecode, threaded dispatch:     ", threadedTime, instructions);
+		double decodedThreadedTime = TimeRuns<true, true>(runtime, runs);
+		PrintTime("instructions, threaded dispatch: ", decodedThreadedTime, instructions);
+		std::cout << "  speedup: " << switchTime / decodedThreadedTime << "x" << std::endl;
+	#else
+		std::cout << "  threaded dispatch is not supported by this compiler" << std::endl;
+		std::cout << "  speedup: " << switchTime / decodedTime << "x" << std::endl;
+	#endif
+	}
+
+	// Compare the fastest interpreter against code compiled by the JIT
+	inline void BenchmarkJit(std::shared_ptr<tsContext>& context, tsIndex script, size_t runs = 1000000)
+	{
+		tsJitRuntime runtime(context);
+		runtime.LoadScript(script);
+		size_t instructions = CountInstructions(context->scripts[script].bytecode);
+
+		std::cout << "Benchmarking the JIT on script " << script << " (" << instructions << " instructions, " << runs << " runs)" << std::endl;
+		if (!runtime.compiled())
+		{
+			std::cout << "  the JIT is not supported on this platform" << std::endl;
+			return;
+		}
+		double interpreterTime = TimeRuns<tsThreadedDispatch, true>(runtime, runs);
+		PrintTime("interpreter: ", interpreterTime, instructions);
+
+		for (size_t i = 0; i < runs / 10; i++)
+			runtime.Execute();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i = 0; i < runs; i++)
+			runtime.Execute();
+		auto stop = std::chrono::high_resolution_clock::now();
+		double jitTime = std::chrono::duration<double, std::nano>(stop - start).count() / runs;
+		PrintTime("jit:         ", jitTime, instructions);
+		std::cout << "  speedup: " << interpreterTime / jitTime << "x" << std::endl;
+	}
+
+	inline double TimeBatch(const tsScript& script, tsBatch& batch, const tsBatchKernels& kernels, size_t frames)
+	{
+		tsBatchContext context;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t f = 0; f < frames; f++)
+			tsExecuteBatch(script, batch, context, kernels);
+		auto stop = std::chrono::high_resolution_clock::now();
+		return batch.lanes * frames / std::chrono::duration<double>(stop - start).count();
+	}
+
+	// Compare running a script once per instance against running it over a whole batch with each set of kernels,
+	// in instances per second
+	inline void BenchmarkBatch(std::shared_ptr<tsContext>& context, tsIndex script, size_t entities = 10000, size_t frames = 200)
+	{
+		const tsScript& s = context->scripts[script];
+		std::cout << "Benchmarking script " << script << " over " << entities << " instances" << std::endl;
+
+		std::vector<tsInstance> instances(entities, tsInstance(s));
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t f = 0; f < frames; f++)
+			for (tsInstance& instance : instances)
+				tsExecute(s, instance);
+		auto stop = std::chrono::high_resolution_clock::now();
+		double scalarRate = entities * frames / std::chrono::duration<double>(stop - start).count();
+		std::cout << "  one instance at a time: " << scalarRate << " instances/s" << std::endl;
+
+		tsBatch batch(s, entities);
+		std::vector<const tsBatchKernels*> kernels = { &tsScalarKernels() };
+	#if TS_BATCH_SIMD
+		kernels.push_back(&tsSse2Kernels());
+		if (tsCpuSupportsAvx2())
+			kernels.push_back(&tsAvx2Kernels());
+	#endif
+		for (const tsBatchKernels* k : kernels)
+		{
+			double batchRate = TimeBatch(s, batch, *k, frames);
+			std::cout << "  batch, " << k->name << " kernels: " << batchRate << " instances/s (" << batchRate / scalarRate << "x)" << std::endl;
+		}
+	}
+}
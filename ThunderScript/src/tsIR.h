@@ -0,0 +1,364 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstring>
+#include "ThunderScript.h"
+
+namespace ts
+{
+	// An operand of an IR instruction, either a slot of script memory or a constant.
+	// Constants don't have a slot, lowering decides whether they become immediates or live in the constant image.
+	struct tsIRValue
+	{
+		tsVarType type = tsVarType::tsNone;
+		bool constant = false;
+		tsIndex slot = 0;
+		tsByte bytes[sizeof(tsInt)] = {};
+
+		size_t size() const
+		{
+			return tsGetTypeSize(type);
+		}
+
+		template<class T>
+		T value() const
+		{
+			static_assert(sizeof(T) <= sizeof(bytes), "Constant too large");
+			T v;
+			std::memcpy(&v, bytes, sizeof(T));
+			return v;
+		}
+
+		bool operator==(const tsIRValue& other) const
+		{
+			if (type != other.type || constant != other.constant)
+				return false;
+			return constant ? std::memcmp(bytes, other.bytes, size()) == 0 : slot == other.slot;
+		}
+		bool operator!=(const tsIRValue& other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	inline tsIRValue tsIRSlot(tsVarType type, tsIndex slot)
+	{
+		tsIRValue v;
+		v.type = type;
+		v.slot = slot;
+		return v;
+	}
+
+	template<class T>
+	inline tsIRValue tsIRConstant(tsVarType type, T value)
+	{
+		static_assert(sizeof(T) <= sizeof(tsIRValue::bytes), "Constant too large");
+		tsIRValue v;
+		v.type = type;
+		v.constant = true;
+		std::memcpy(v.bytes, &value, sizeof(T));
+		return v;
+	}
+
+	// A three address instruction. code is always a register form command, immediate forms and superinstructions
+	// are only picked once the IR is lowered. The operands are used the same way as in tsInstruction except:
+	//   tsMOVE:  a is the source and r the destination, they have the same type. Moves of constants become tsLOAD.
+	//   jumps:   target is the index of the block to jump to
+	// There is no tsLOAD, a move of a constant is used instead.
+	struct tsIRInstruction
+	{
+		tsByte code = tsEND;
+		tsIRValue a;
+		tsIRValue b;
+		tsIRValue r;
+		size_t target = 0;
+
+		// Whether the instruction writes r, everything but jumps and tsEND does
+		bool writes() const
+		{
+			return code != tsEND && !tsIsJump(code);
+		}
+	};
+
+	// Instructions that run one after the other. Only the last instruction of a block may jump or end the script,
+	// a block that doesn't end with tsEND or tsJUMP goes on to the next one.
+	struct tsIRBlock
+	{
+		std::vector<tsIRInstruction> instructions;
+	};
+
+	// A whole script as IR, built by the compiler and turned into bytecode by tsLower
+	class tsIR
+	{
+	public:
+		std::vector<tsIRBlock> blocks = std::vector<tsIRBlock>(1);
+		// Bytes of script memory the slots use, constants get slots after these when lowering
+		tsIndex numBytes = 0;
+		// Globals are read by the host once a run ends, every other slot is only seen by the script
+		std::vector<tsGlobal> globals;
+
+		// Add an instruction to the end of the last block
+		void push(const tsIRInstruction& i)
+		{
+			blocks.back().instructions.push_back(i);
+		}
+		void push(tsByte code, const tsIRValue& a, const tsIRValue& r)
+		{
+			tsIRInstruction i;
+			i.code = code;
+			i.a = a;
+			i.r = r;
+			push(i);
+		}
+		void push(tsByte code, const tsIRValue& a, const tsIRValue& b, const tsIRValue& r)
+		{
+			tsIRInstruction i;
+			i.code = code;
+			i.a = a;
+			i.b = b;
+			i.r = r;
+			push(i);
+		}
+
+		// Start a new block and return its index
+		size_t newBlock()
+		{
+			blocks.emplace_back();
+			return blocks.size() - 1;
+		}
+
+		size_t size() const
+		{
+			size_t n = 0;
+			for (const tsIRBlock& block : blocks)
+				n += block.instructions.size();
+			return n;
+		}
+
+		void clear()
+		{
+			blocks.assign(1, tsIRBlock());
+			numBytes = 0;
+			globals.clear();
+		}
+	};
+
+	// Call read(value) for every slot an instruction reads and write(value) for the one it writes
+	template<class Read, class Write>
+	void tsForEachOperand(const tsIRInstruction& i, Read read, Write write)
+	{
+		if (i.a.type != tsVarType::tsNone && !i.a.constant)
+			read(i.a);
+		if (i.b.type != tsVarType::tsNone && !i.b.constant)
+			read(i.b);
+		if (i.writes())
+			write(i.r);
+	}
+
+	// Call f with every block execution can go to after block n. Returns whether the script can end in block n.
+	template<class F>
+	bool tsForEachSuccessor(const tsIR& ir, size_t n, F f)
+	{
+		const std::vector<tsIRInstruction>& instructions = ir.blocks[n].instructions;
+		if (!instructions.empty())
+		{
+			const tsIRInstruction& last = instructions.back();
+			if (last.code == tsEND)
+				return true;
+			if (tsIsJump(last.code))
+				f(last.target);
+			if (last.code == tsJUMP)
+				return false;
+		}
+		if (n + 1 < ir.blocks.size())
+		{
+			f(n + 1);
+			return false;
+		}
+		return true;
+	}
+
+	inline void tsDumpValue(std::ostream& out, const tsIRValue& v)
+	{
+		if (!v.constant)
+		{
+			out << "[" << v.slot << "]";
+			return;
+		}
+		switch (v.type)
+		{
+			case tsVarType::tsInt:
+				out << v.value<tsInt>();
+				break;
+			case tsVarType::tsFloat:
+				out << v.value<tsFloat>() << "f";
+				break;
+			case tsVarType::tsBool:
+				out << (v.value<tsBool>() ? "true" : "false");
+				break;
+			default:
+				out << "?";
+				break;
+		}
+	}
+
+	// Write the IR as text, one instruction per line in the form "r = CODE a, b"
+	inline void tsDumpIR(std::ostream& out, const tsIR& ir)
+	{
+		for (size_t n = 0; n < ir.blocks.size(); n++)
+		{
+			out << "block " << n << ":\n";
+			for (const tsIRInstruction& i : ir.blocks[n].instructions)
+			{
+				out << "\t";
+				if (i.writes())
+				{
+					tsDumpValue(out, i.r);
+					out << " = ";
+				}
+				out << tsCommandName(i.code);
+				bool first = true;
+				for (const tsIRValue* v : { &i.a, &i.b })
+				{
+					if (v->type == tsVarType::tsNone)
+						continue;
+					out << (first ? " " : ", ");
+					tsDumpValue(out, *v);
+					first = false;
+				}
+				if (tsIsJump(i.code))
+					out << (first ? " " : ", ") << "block " << i.target;
+				out << "\n";
+			}
+		}
+	}
+
+	// Turn IR into bytecode for a script, replacing its bytecode, size and constant image.
+	// Constants are folded into immediate forms and tsLOADs where there is one for the instruction, any that are left
+	// are given a slot after the IR's own and stored in the constant image, one slot per distinct value.
+	inline void tsLower(const tsIR& ir, tsScript& script)
+	{
+		tsIndex numBytes = ir.numBytes;
+		std::vector<std::pair<tsIRValue, tsIndex>> constantSlots;
+		auto place = [&](const tsIRValue& v) {
+			if (!v.constant)
+				return v.slot;
+			for (const std::pair<tsIRValue, tsIndex>& c : constantSlots)
+				if (c.first == v)
+					return c.second;
+			constantSlots.push_back({ v, numBytes });
+			numBytes += (tsIndex)v.size();
+			return constantSlots.back().second;
+		};
+		auto immediate = [](tsInstruction& i, tsByte code, const tsIRValue& constant) {
+			i.code = code;
+			std::memcpy(i.imm.bytes, constant.bytes, constant.size());
+		};
+
+		std::vector<size_t> blockStart(ir.blocks.size());
+		std::vector<tsInstruction> code;
+		for (size_t n = 0; n < ir.blocks.size(); n++)
+		{
+			blockStart[n] = code.size();
+			for (const tsIRInstruction& ri : ir.blocks[n].instructions)
+			{
+				tsInstruction i;
+				i.code = ri.code;
+				switch (ri.code)
+				{
+					case tsEND:
+						break;
+					case tsJUMP:
+						i.imm.target = ri.target;
+						break;
+					case tsJUMPF:
+						i.a = place(ri.a);
+						i.imm.target = ri.target;
+						break;
+					case tsMOVE:
+						i.r = ri.r.slot;
+						if (ri.a.constant)
+						{
+							i.code = tsLOAD;
+							i.a = (tsIndex)ri.a.size();
+							std::memcpy(i.imm.bytes, ri.a.bytes, ri.a.size());
+						}
+						else
+						{
+							i.a = ri.a.slot;
+							i.b = (tsIndex)ri.r.size();
+						}
+						break;
+					default:
+					{
+						i.r = ri.r.slot;
+						tsIRValue a = ri.a;
+						tsIRValue b = ri.b;
+						tsByte imm = tsImmediateForm(ri.code);
+						// Commands that commute can take a constant on either side as their immediate
+						if (a.constant && !b.constant && imm != tsEND && tsCommutes(ri.code))
+							std::swap(a, b);
+						if (b.constant && imm != tsEND)
+						{
+							i.a = place(a);
+							immediate(i, imm, b);
+						}
+						else if (b.constant && (ri.code == tsSUBI || ri.code == tsSUBF))
+						{
+							// Subtracting a constant is adding its negation, which wraps for ints just like SUBI
+							i.a = place(a);
+							if (ri.code == tsSUBI)
+								immediate(i, tsADDI_IMM, tsIRConstant(b.type, (tsInt)(0u - (std::uint32_t)b.value<tsInt>())));
+							else
+								immediate(i, tsADDF_IMM, tsIRConstant(b.type, -b.value<tsFloat>()));
+						}
+						else if (a.constant && !b.constant && (ri.code == tsSUBI || ri.code == tsSUBF))
+						{
+							// And subtracting from a constant is negating first and adding the constant after
+							tsInstruction flip;
+							flip.code = ri.code == tsSUBI ? tsFLIPI : tsFLIPF;
+							flip.a = b.slot;
+							flip.r = ri.r.slot;
+							code.push_back(flip);
+							i.a = ri.r.slot;
+							immediate(i, ri.code == tsSUBI ? tsADDI_IMM : tsADDF_IMM, a);
+						}
+						else
+						{
+							i.a = place(a);
+							if (b.type != tsVarType::tsNone)
+								i.b = place(b);
+						}
+						// Compare jumps
+						if (tsIsJump(ri.code))
+							i.imm.target = ri.target;
+						break;
+					}
+				}
+				code.push_back(i);
+			}
+		}
+		// Falling off the end of the IR ends the script
+		if (code.empty() || code.back().code != tsEND)
+		{
+			tsInstruction end;
+			end.code = tsEND;
+			code.push_back(end);
+		}
+		for (tsInstruction& i : code)
+			if (tsIsJump(i.code))
+				i.imm.target = i.imm.target < blockStart.size() ? blockStart[i.imm.target] : code.size() - 1;
+
+		script.bytecode = tsEncode(code);
+		script.numBytes = numBytes;
+		// Constants are stored in the script's constant image instead of being loaded by the bytecode,
+		// so they are copied into an instance once when it is created rather than on every run
+		script.constants = tsBytes();
+		script.constants.setSize(numBytes);
+		for (const std::pair<tsIRValue, tsIndex>& c : constantSlots)
+			script.constants.write(c.second, c.first.bytes, c.first.size());
+		script.verified = false;
+		script.instructions.clear();
+	}
+}
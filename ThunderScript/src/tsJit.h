@@ -0,0 +1,464 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "ThunderScript.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+	#define TS_JIT 1
+	#include <sys/mman.h>
+	#include <unistd.h>
+#else
+	#define TS_JIT 0
+#endif
+
+namespace ts
+{
+	// Just enough of an x86-64 assembler for the opcode templates. Every memory operand is a slot of the instance,
+	// addressed as a 32 bit displacement off rdi, which holds the memory base passed in by the caller.
+	class tsJitAssembler
+	{
+	public:
+		std::vector<std::uint8_t> code;
+
+		// Register numbers for the reg field of ModRM
+		enum Reg : std::uint8_t { eax = 0, ecx = 1, xmm0 = 0 };
+
+		void byte(std::uint8_t b)
+		{
+			code.push_back(b);
+		}
+		void bytes(std::initializer_list<std::uint8_t> b)
+		{
+			code.insert(code.end(), b);
+		}
+		template<class T>
+		void imm(T value)
+		{
+			std::uint8_t raw[sizeof(T)];
+			std::memcpy(raw, &value, sizeof(T));
+			code.insert(code.end(), raw, raw + sizeof(T));
+		}
+		// ModRM for [rdi + disp32]
+		void slot(std::uint8_t reg, tsIndex index)
+		{
+			byte(0x80 | (reg << 3) | 7);
+			imm<std::int32_t>((std::int32_t)index);
+		}
+		// Emit an opcode followed by a slot operand
+		void op(std::initializer_list<std::uint8_t> opcode, std::uint8_t reg, tsIndex index)
+		{
+			bytes(opcode);
+			slot(reg, index);
+		}
+		// Emit a 32 bit relative jump and return where its offset is so it can be patched once the target is known
+		size_t jump(std::initializer_list<std::uint8_t> opcode)
+		{
+			bytes(opcode);
+			size_t at = code.size();
+			imm<std::int32_t>(0);
+			return at;
+		}
+		void patch(size_t at, size_t target)
+		{
+			std::int32_t rel = (std::int32_t)((std::int64_t)target - (std::int64_t)(at + 4));
+			std::memcpy(&code[at], &rel, sizeof(rel));
+		}
+	};
+
+	// Executable copy of a compiled script. The pages are written while mapped read/write and only made executable
+	// afterwards, so they are never writable and executable at the same time.
+	class tsJitCode
+	{
+	private:
+		void* pages = nullptr;
+		size_t mappedSize = 0;
+
+		void release()
+		{
+		#if TS_JIT
+			if (pages)
+				munmap(pages, mappedSize);
+		#endif
+			pages = nullptr;
+			mappedSize = 0;
+			entry = nullptr;
+		}
+
+	public:
+		tsNativeEntry entry = nullptr;
+
+		tsJitCode() = default;
+		tsJitCode(const tsJitCode&) = delete;
+		tsJitCode& operator=(const tsJitCode&) = delete;
+		tsJitCode(tsJitCode&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+		tsJitCode& operator=(tsJitCode&& other) noexcept
+		{
+			if (this != &other)
+			{
+				release();
+				std::swap(pages, other.pages);
+				std::swap(mappedSize, other.mappedSize);
+				std::swap(entry, other.entry);
+			}
+			return *this;
+		}
+		~tsJitCode()
+		{
+			release();
+		}
+
+		bool compiled() const
+		{
+			return entry != nullptr;
+		}
+		size_t size() const
+		{
+			return mappedSize;
+		}
+
+		bool map(const std::vector<std::uint8_t>& code, std::string& error)
+		{
+			release();
+		#if TS_JIT
+			size_t page = (size_t)sysconf(_SC_PAGESIZE);
+			size_t size = (code.size() + page - 1) / page * page;
+			void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (memory == MAP_FAILED)
+			{
+				error = "Could not map memory for compiled code";
+				return false;
+			}
+			std::memcpy(memory, code.data(), code.size());
+			if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+			{
+				munmap(memory, size);
+				error = "Could not make compiled code executable";
+				return false;
+			}
+			pages = memory;
+			mappedSize = size;
+			entry = reinterpret_cast<tsNativeEntry>(memory);
+			return true;
+		#else
+			error = "The JIT is only supported on x86-64 Linux";
+			return false;
+		#endif
+		}
+	};
+
+	// Translate a verified script into x86-64 machine code, one template per instruction.
+	// Only verified scripts can be compiled since the generated code does no bounds checking.
+	inline bool tsJitCompile(const tsScript& script, tsJitCode& out, std::string& error)
+	{
+		if (!script.verified || !script.prepared())
+		{
+			error = "Only loaded and verified scripts can be compiled";
+			return false;
+		}
+		if (script.numBytes > (tsIndex)INT32_MAX)
+		{
+			error = "Script memory is too large to address with 32 bit displacements";
+			return false;
+		}
+
+		typedef tsJitAssembler A;
+		A a;
+		std::vector<size_t> labels(script.instructions.size());
+		// Offsets of jump displacements and the instruction they go to
+		std::vector<std::pair<size_t, size_t>> fixups;
+
+		auto compare = [&](std::uint8_t setcc) {
+			a.bytes({ 0x0F, setcc, 0xC0 });  // setcc al
+		};
+		// Float constants have no immediate encoding, they go through eax into xmm1
+		auto constant = [&](const tsInstruction& ins) {
+			a.byte(0xB8);                          // mov eax, imm32
+			a.imm(tsImmediate<std::uint32_t>(ins));
+			a.bytes({ 0x66, 0x0F, 0x6E, 0xC8 });   // movd xmm1, eax
+		};
+
+		for (size_t i = 0; i < script.instructions.size(); i++)
+		{
+			const tsInstruction& ins = script.instructions[i];
+			labels[i] = a.code.size();
+			switch (ins.code)
+			{
+				case tsEND:
+					a.byte(0xC3);                                 // ret
+					break;
+				case tsJUMP:
+					fixups.push_back({ a.jump({ 0xE9 }), ins.imm.target });  // jmp rel32
+					break;
+				case tsJUMPF:
+					a.op({ 0x80 }, 7, ins.a);                     // cmp byte [a], 0
+					a.byte(0);
+					fixups.push_back({ a.jump({ 0x0F, 0x84 }), ins.imm.target });  // je rel32
+					break;
+				case tsLOAD:
+				{
+					std::uint64_t value = 0;
+					std::memcpy(&value, ins.imm.bytes, ins.a);
+					if (ins.a == 8)
+					{
+						a.bytes({ 0x48, 0xB8 });                  // mov rax, imm64
+						a.imm(value);
+						a.op({ 0x48, 0x89 }, A::eax, ins.r);      // mov [r], rax
+					}
+					else if (ins.a == 4)
+					{
+						a.op({ 0xC7 }, 0, ins.r);                 // mov dword [r], imm32
+						a.imm((std::uint32_t)value);
+					}
+					else
+					{
+						for (tsIndex b = 0; b < ins.a; b++)
+						{
+							a.op({ 0xC6 }, 0, ins.r + b);         // mov byte [r + b], imm8
+							a.byte((std::uint8_t)ins.imm.bytes[b]);
+						}
+					}
+					break;
+				}
+				case tsMOVE:
+				{
+					tsIndex offset = 0;
+					for (; offset + 8 <= ins.b; offset += 8)
+					{
+						a.op({ 0x48, 0x8B }, A::eax, ins.a + offset);  // mov rax, [a]
+						a.op({ 0x48, 0x89 }, A::eax, ins.r + offset);  // mov [r], rax
+					}
+					for (; offset + 4 <= ins.b; offset += 4)
+					{
+						a.op({ 0x8B }, A::eax, ins.a + offset);        // mov eax, [a]
+						a.op({ 0x89 }, A::eax, ins.r + offset);        // mov [r], eax
+					}
+					for (; offset < ins.b; offset++)
+					{
+						a.op({ 0x8A }, A::eax, ins.a + offset);        // mov al, [a]
+						a.op({ 0x88 }, A::eax, ins.r + offset);        // mov [r], al
+					}
+					break;
+				}
+				case tsItoF:
+					a.op({ 0xF3, 0x0F, 0x2A }, A::xmm0, ins.a);   // cvtsi2ss xmm0, dword [a]
+					a.op({ 0xF3, 0x0F, 0x11 }, A::xmm0, ins.r);   // movss [r], xmm0
+					break;
+				case tsFtoI:
+					a.op({ 0xF3, 0x0F, 0x2C }, A::eax, ins.a);    // cvttss2si eax, [a]
+					a.op({ 0x89 }, A::eax, ins.r);                // mov [r], eax
+					break;
+				case tsFLIPI:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					a.bytes({ 0xF7, 0xD8 });                      // neg eax
+					a.op({ 0x89 }, A::eax, ins.r);                // mov [r], eax
+					break;
+				case tsFLIPF:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					a.byte(0x35);                                 // xor eax, sign bit
+					a.imm<std::uint32_t>(0x80000000u);
+					a.op({ 0x89 }, A::eax, ins.r);                // mov [r], eax
+					break;
+				case tsADDI:
+				case tsSUBI:
+				case tsMULI:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					if (ins.code == tsADDI)
+						a.op({ 0x03 }, A::eax, ins.b);            // add eax, [b]
+					else if (ins.code == tsSUBI)
+						a.op({ 0x2B }, A::eax, ins.b);            // sub eax, [b]
+					else
+						a.op({ 0x0F, 0xAF }, A::eax, ins.b);      // imul eax, [b]
+					a.op({ 0x89 }, A::eax, ins.r);                // mov [r], eax
+					break;
+				case tsDIVI:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					a.byte(0x99);                                 // cdq
+					a.op({ 0xF7 }, 7, ins.b);                     // idiv dword [b]
+					a.op({ 0x89 }, A::eax, ins.r);                // mov [r], eax
+					break;
+				case tsADDF:
+				case tsSUBF:
+				case tsMULF:
+				case tsDIVF:
+					a.op({ 0xF3, 0x0F, 0x10 }, A::xmm0, ins.a);   // movss xmm0, [a]
+					a.op({ 0xF3, 0x0F, std::uint8_t(ins.code == tsADDF ? 0x58 : ins.code == tsSUBF ? 0x5C : ins.code == tsMULF ? 0x59 : 0x5E) }, A::xmm0, ins.b);  // op xmm0, [b]
+					a.op({ 0xF3, 0x0F, 0x11 }, A::xmm0, ins.r);   // movss [r], xmm0
+					break;
+				case tsItoFADDF:
+					a.op({ 0xF3, 0x0F, 0x2A }, A::xmm0, ins.a);   // cvtsi2ss xmm0, dword [a]
+					a.op({ 0xF3, 0x0F, 0x58 }, A::xmm0, ins.b);   // addss xmm0, [b]
+					a.op({ 0xF3, 0x0F, 0x11 }, A::xmm0, ins.r);   // movss [r], xmm0
+					break;
+				case tsNOT:
+					a.op({ 0x8A }, A::eax, ins.a);                // mov al, [a]
+					a.bytes({ 0x34, 0x01 });                      // xor al, 1
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				case tsAND:
+				case tsOR:
+					a.op({ 0x8A }, A::eax, ins.a);                // mov al, [a]
+					a.op({ std::uint8_t(ins.code == tsAND ? 0x22 : 0x0A) }, A::eax, ins.b);  // and/or al, [b]
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				case tsEqualB:
+					a.op({ 0x8A }, A::eax, ins.a);                // mov al, [a]
+					a.op({ 0x3A }, A::eax, ins.b);                // cmp al, [b]
+					compare(0x94);                                // sete
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				case tsLessI:
+				case tsLessEqualI:
+				case tsEqualI:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					a.op({ 0x3B }, A::eax, ins.b);                // cmp eax, [b]
+					compare(ins.code == tsLessI ? 0x9C : ins.code == tsLessEqualI ? 0x9E : 0x94);  // setl/setle/sete
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				case tsLessF:
+				case tsLessEqualF:
+					// Compare b against a so unordered (NaN) operands come out false like they do in C++
+					a.op({ 0xF3, 0x0F, 0x10 }, A::xmm0, ins.b);   // movss xmm0, [b]
+					a.op({ 0x0F, 0x2E }, A::xmm0, ins.a);         // ucomiss xmm0, [a]
+					compare(ins.code == tsLessF ? 0x97 : 0x93);   // seta/setae
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				case tsEqualF:
+					a.op({ 0xF3, 0x0F, 0x10 }, A::xmm0, ins.a);   // movss xmm0, [a]
+					a.op({ 0x0F, 0x2E }, A::xmm0, ins.b);         // ucomiss xmm0, [b]
+					compare(0x94);                                // sete al
+					a.bytes({ 0x0F, 0x9B, 0xC1 });                // setnp cl
+					a.bytes({ 0x20, 0xC8 });                      // and al, cl
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				case tsJUMPFLessI:
+				case tsJUMPFLessEqualI:
+				case tsJUMPFEqualI:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					a.op({ 0x3B }, A::eax, ins.b);                // cmp eax, [b]
+					// jge/jg/jne rel32
+					fixups.push_back({ a.jump({ 0x0F, std::uint8_t(ins.code == tsJUMPFLessI ? 0x8D : ins.code == tsJUMPFLessEqualI ? 0x8F : 0x85) }), ins.imm.target });
+					break;
+				case tsJUMPFLessF:
+				case tsJUMPFLessEqualF:
+					// Same operand order as the comparisons, unordered operands set CF and ZF so they take the jump
+					a.op({ 0xF3, 0x0F, 0x10 }, A::xmm0, ins.b);   // movss xmm0, [b]
+					a.op({ 0x0F, 0x2E }, A::xmm0, ins.a);         // ucomiss xmm0, [a]
+					fixups.push_back({ a.jump({ 0x0F, std::uint8_t(ins.code == tsJUMPFLessF ? 0x86 : 0x82) }), ins.imm.target });  // jbe/jb rel32
+					break;
+				case tsJUMPFEqualF:
+					a.op({ 0xF3, 0x0F, 0x10 }, A::xmm0, ins.a);   // movss xmm0, [a]
+					a.op({ 0x0F, 0x2E }, A::xmm0, ins.b);         // ucomiss xmm0, [b]
+					fixups.push_back({ a.jump({ 0x0F, 0x85 }), ins.imm.target });  // jne rel32
+					fixups.push_back({ a.jump({ 0x0F, 0x8A }), ins.imm.target });  // jp rel32
+					break;
+				case tsADDI_IMM:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					a.byte(0x05);                                 // add eax, imm32
+					a.imm(tsImmediate<tsInt>(ins));
+					a.op({ 0x89 }, A::eax, ins.r);                // mov [r], eax
+					break;
+				case tsMULI_IMM:
+					a.op({ 0x69 }, A::eax, ins.a);                // imul eax, [a], imm32
+					a.imm(tsImmediate<tsInt>(ins));
+					a.op({ 0x89 }, A::eax, ins.r);                // mov [r], eax
+					break;
+				case tsDIVI_IMM:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					a.byte(0x99);                                 // cdq
+					a.byte(0xB9);                                 // mov ecx, imm32
+					a.imm(tsImmediate<tsInt>(ins));
+					a.bytes({ 0xF7, 0xF9 });                      // idiv ecx
+					a.op({ 0x89 }, A::eax, ins.r);                // mov [r], eax
+					break;
+				case tsADDF_IMM:
+				case tsMULF_IMM:
+				case tsDIVF_IMM:
+					constant(ins);                                // xmm1 = constant
+					a.op({ 0xF3, 0x0F, 0x10 }, A::xmm0, ins.a);   // movss xmm0, [a]
+					a.bytes({ 0xF3, 0x0F, std::uint8_t(ins.code == tsADDF_IMM ? 0x58 : ins.code == tsMULF_IMM ? 0x59 : 0x5E), 0xC1 });  // op xmm0, xmm1
+					a.op({ 0xF3, 0x0F, 0x11 }, A::xmm0, ins.r);   // movss [r], xmm0
+					break;
+				case tsLessI_IMM:
+				case tsLessEqualI_IMM:
+				case tsEqualI_IMM:
+					a.op({ 0x8B }, A::eax, ins.a);                // mov eax, [a]
+					a.byte(0x3D);                                 // cmp eax, imm32
+					a.imm(tsImmediate<tsInt>(ins));
+					compare(ins.code == tsLessI_IMM ? 0x9C : ins.code == tsLessEqualI_IMM ? 0x9E : 0x94);  // setl/setle/sete
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				case tsLessF_IMM:
+				case tsLessEqualF_IMM:
+					// The constant goes first like b does in the register forms so NaN comes out false
+					constant(ins);                                // xmm1 = constant
+					a.op({ 0x0F, 0x2E }, 1, ins.a);               // ucomiss xmm1, [a]
+					compare(ins.code == tsLessF_IMM ? 0x97 : 0x93);  // seta/setae
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				case tsEqualF_IMM:
+					constant(ins);                                // xmm1 = constant
+					a.op({ 0x0F, 0x2E }, 1, ins.a);               // ucomiss xmm1, [a]
+					compare(0x94);                                // sete al
+					a.bytes({ 0x0F, 0x9B, 0xC1 });                // setnp cl
+					a.bytes({ 0x20, 0xC8 });                      // and al, cl
+					a.op({ 0x88 }, A::eax, ins.r);                // mov [r], al
+					break;
+				default:
+					error = "Unknown byte code! " + std::to_string((unsigned int)ins.code);
+					return false;
+			}
+		}
+
+		for (auto& fixup : fixups)
+			a.patch(fixup.first, labels[fixup.second]);
+		return out.map(a.code, error);
+	}
+
+	// A runtime that runs scripts as native code. Scripts are compiled when they are loaded, falling back to
+	// the interpreter if the JIT is not supported on this platform.
+	class tsJitRuntime : public tsRuntime
+	{
+	private:
+		tsJitCode native;
+
+	public:
+		tsJitRuntime(std::shared_ptr<tsContext>& context) : tsRuntime(context)
+		{
+		}
+
+		bool LoadScript(tsIndex script)
+		{
+			if (!tsRuntime::LoadScript(script))
+				return false;
+			std::string error;
+			if (!tsJitCompile(_context->scripts[script], native, error))
+				tsLOG_WARNING("Running script " << script << " in the interpreter: " << error);
+			return true;
+		}
+
+		bool compiled() const
+		{
+			return native.compiled();
+		}
+
+		void Run()
+		{
+			tsLOG_DEBUG("Running script: " << loadedScript);
+			Execute();
+		}
+
+		void Execute()
+		{
+			tsMASSERT(scriptLoaded, "No script loaded");
+			// Compiled code addresses a single block of memory, so bound globals run in the interpreter
+			if (native.compiled() && !bound())
+				native.entry(instance.memory.data());
+			else
+				tsRuntime::Execute();
+		}
+	};
+}
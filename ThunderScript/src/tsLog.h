@@ -0,0 +1,41 @@
+#pragma once
+#include <iostream>
+
+// Logging is decided at compile time, messages above TS_LOG_LEVEL are removed along with the code that builds them.
+// Messages are streamed, so tsLOG_DEBUG("Found const: " << value) works like writing to std::cout.
+#define TS_LOG_NONE 0
+#define TS_LOG_ERROR 1
+#define TS_LOG_WARNING 2
+#define TS_LOG_INFO 3
+#define TS_LOG_DEBUG 4
+
+#ifndef TS_LOG_LEVEL
+#define TS_LOG_LEVEL TS_LOG_WARNING
+#endif
+
+#define tsLOG(stream, ...) do { stream << __VA_ARGS__ << std::endl; } while (false)
+#define tsLOG_NOTHING() do { } while (false)
+
+#if TS_LOG_LEVEL >= TS_LOG_ERROR
+#define tsLOG_ERROR(...) tsLOG(std::cerr, __VA_ARGS__)
+#else
+#define tsLOG_ERROR(...) tsLOG_NOTHING()
+#endif
+
+#if TS_LOG_LEVEL >= TS_LOG_WARNING
+#define tsLOG_WARNING(...) tsLOG(std::cerr, __VA_ARGS__)
+#else
+#define tsLOG_WARNING(...) tsLOG_NOTHING()
+#endif
+
+#if TS_LOG_LEVEL >= TS_LOG_INFO
+#define tsLOG_INFO(...) tsLOG(std::cout, __VA_ARGS__)
+#else
+#define tsLOG_INFO(...) tsLOG_NOTHING()
+#endif
+
+#if TS_LOG_LEVEL >= TS_LOG_DEBUG
+#define tsLOG_DEBUG(...) tsLOG(std::cout, __VA_ARGS__)
+#else
+#define tsLOG_DEBUG(...) tsLOG_NOTHING()
+#endif
@@ -2,3 +2,9 @@
 #include <cassert>
 #define tsASSERT(expression) assert(expression)
 #define tsMASSERT(expression, message) assert(expression)
+
+#if defined(_MSC_VER)
+#define tsUNREACHABLE() __assume(false)
+#else
+#define tsUNREACHABLE() __builtin_unreachable()
+#endif
@@ -0,0 +1,296 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <atomic>
+#include <cstdlib>
+#include <cerrno>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include "ThunderScript.h"
+#include "tsTranspiler.h"
+
+#if defined(__linux__)
+	#define TS_NATIVE 1
+	#include <dlfcn.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
+#else
+	#define TS_NATIVE 0
+#endif
+
+namespace ts
+{
+	// Compiles scripts to shared objects with the system C++ compiler and loads them with dlopen.
+	// Objects are cached on disk under a hash of the script, the ThunderScript and transpiler versions and the
+	// compiler command, so a script is only compiled once across restarts and never runs code built by an older version.
+	// The compiler is c++ unless TS_CXX is set, and the cache lives in TS_CACHE_DIR, $XDG_CACHE_HOME/thunderscript,
+	// ~/.cache/thunderscript or thunderscript-<uid> in the temp directory, whichever is found first. Since whatever is
+	// in the cache gets loaded into the process, it is only used if it belongs to this user and nobody else can write to it.
+	class tsNativeCompiler
+	{
+	private:
+		// Only held while looking at shared state, never while the compiler runs
+		std::mutex lock;
+		std::condition_variable built;
+		// Objects being compiled by a thread of this process
+		std::set<std::string> building;
+		// Loaded objects are never closed, scripts may still point into them
+		std::vector<void*> handles;
+		// Probed outside the lock, so threads asking at the same time may both run the compiler to find out
+		std::atomic<int> compilerFound = -1;
+		std::atomic<unsigned int> buildCount = 0;
+
+		static std::string quote(const std::string& s)
+		{
+			std::string quoted = "'";
+			for (char c : s)
+				quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+			return quoted + "'";
+		}
+
+	public:
+		std::string compiler;
+		std::filesystem::path cacheDirectory;
+		std::string flags = "-std=c++17 -O2 -shared -fPIC";
+
+		tsNativeCompiler()
+		{
+			const char* cxx = std::getenv("TS_CXX");
+			compiler = cxx && *cxx ? cxx : "c++";
+
+			if (const char* dir = std::getenv("TS_CACHE_DIR"); dir && *dir)
+				cacheDirectory = dir;
+			else if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+				cacheDirectory = std::filesystem::path(xdg) / "thunderscript";
+			else if (const char* home = std::getenv("HOME"); home && *home)
+				cacheDirectory = std::filesystem::path(home) / ".cache" / "thunderscript";
+			else
+			{
+				std::error_code ec;
+				cacheDirectory = std::filesystem::temp_directory_path(ec) / "thunderscript";
+			#if TS_NATIVE
+				cacheDirectory += "-" + std::to_string(geteuid());
+			#endif
+			}
+		}
+
+		// Shared by every runtime in the process so objects are only loaded once
+		static tsNativeCompiler& global()
+		{
+			static tsNativeCompiler instance;
+			return instance;
+		}
+
+		// Name of the compiled function and the files made for a script. Everything that changes the object built
+		// for the script is hashed into the name, so a stale object is never picked up from the cache.
+		std::string symbol(const tsScript& script) const
+		{
+			std::uint64_t h = script.hash();
+			auto add = [&h](const std::string& s) {
+				for (char c : s)
+					h = (h ^ (unsigned char)c) * 1099511628211ull;
+				h = (h ^ 0xff) * 1099511628211ull;
+			};
+			add(tsVersion);
+			add(std::to_string(tsTranspilerVersion));
+			add(compiler);
+			add(flags);
+
+			std::ostringstream name;
+			name << "ts_" << std::hex << std::setw(16) << std::setfill('0') << h;
+			return name.str();
+		}
+
+		// Create the cache directory readable only by this user if it is missing, and check that nobody else could
+		// have put objects in it
+		bool prepareCacheDirectory(std::string& error) const
+		{
+		#if TS_NATIVE
+			std::error_code ec;
+			if (cacheDirectory.has_parent_path())
+				std::filesystem::create_directories(cacheDirectory.parent_path(), ec);
+			if (mkdir(cacheDirectory.c_str(), 0700) != 0 && errno != EEXIST)
+			{
+				error = "Could not create cache directory " + cacheDirectory.string() + ": " + std::strerror(errno);
+				return false;
+			}
+			struct stat info;
+			if (stat(cacheDirectory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+			{
+				error = "Cache directory " + cacheDirectory.string() + " is not a directory";
+				return false;
+			}
+			if (info.st_uid != geteuid() || (info.st_mode & (S_IWGRP | S_IWOTH)) != 0)
+			{
+				error = "Not using cache directory " + cacheDirectory.string() + ", it is not owned by this user or others can write to it";
+				return false;
+			}
+			return true;
+		#else
+			error = "Native compilation is only supported on Linux";
+			return false;
+		#endif
+		}
+
+		bool compilerAvailable()
+		{
+		#if TS_NATIVE
+			if (compilerFound.load(std::memory_order_acquire) < 0)
+				compilerFound.store(std::system((quote(compiler) + " --version > /dev/null 2>&1").c_str()) == 0, std::memory_order_release);
+			return compilerFound.load(std::memory_order_acquire) == 1;
+		#else
+			return false;
+		#endif
+		}
+
+		// Find or build the native version of a script, returns nullptr and sets error if that is not possible.
+		// Safe to call from many threads. Different scripts are compiled at the same time, a thread asking for a script
+		// another thread is already compiling waits for it, and builds from other processes are not duplicated on disk.
+		tsNativeEntry compile(const tsScript& script, std::string& error)
+		{
+		#if TS_NATIVE
+			std::string name = symbol(script);
+			std::filesystem::path object = cacheDirectory / (name + ".so");
+			// Probing runs the compiler, which must not happen while other threads wait on the lock
+			bool available = compilerAvailable();
+
+			std::unique_lock<std::mutex> guard(lock);
+			if (!prepareCacheDirectory(error))
+				return nullptr;
+			built.wait(guard, [&]() { return building.count(name) == 0; });
+			std::error_code ec;
+			if (!std::filesystem::exists(object, ec))
+			{
+				if (!available)
+				{
+					error = "No C++ compiler found, tried " + compiler;
+					return nullptr;
+				}
+				building.insert(name);
+				guard.unlock();
+				bool compiled = build(script, name, object, error);
+				guard.lock();
+				building.erase(name);
+				built.notify_all();
+				if (!compiled)
+					return nullptr;
+			}
+
+			void* handle = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+			if (!handle)
+			{
+				error = "Could not load " + object.string() + ": " + dlerror();
+				return nullptr;
+			}
+			void* entry = dlsym(handle, name.c_str());
+			if (!entry)
+			{
+				dlclose(handle);
+				error = "Could not find " + name + " in " + object.string();
+				return nullptr;
+			}
+			handles.push_back(handle);
+			return reinterpret_cast<tsNativeEntry>(entry);
+		#else
+			error = "Native compilation is only supported on Linux";
+			return nullptr;
+		#endif
+		}
+
+	private:
+		// Transpile and compile a script into object, runs without holding the lock
+		bool build(const tsScript& script, const std::string& name, const std::filesystem::path& object, std::string& error)
+		{
+		#if TS_NATIVE
+			// Every build works on files of its own and renames the object into place at the end,
+			// so other processes never load half written objects
+			std::string stem = name + "." + std::to_string(getpid()) + "." + std::to_string(buildCount++);
+			std::filesystem::path source = cacheDirectory / (stem + ".cpp");
+			std::filesystem::path log = cacheDirectory / (name + ".log");
+			std::filesystem::path built = cacheDirectory / (stem + ".so");
+			std::error_code ec;
+			if (!tsTranspileToFile(script, name, source.string(), error))
+				return false;
+
+			std::string command = quote(compiler) + " " + flags + " -DTS_AOT_NO_REGISTRATION -o " + quote(built.string()) + " " +
+				quote(source.string()) + " > " + quote(log.string()) + " 2>&1";
+			if (std::system(command.c_str()) != 0)
+			{
+				std::filesystem::remove(built, ec);
+				error = "Compiling " + source.string() + " failed, see " + log.string();
+				return false;
+			}
+			std::filesystem::rename(built, object, ec);
+			if (ec)
+			{
+				error = "Could not move compiled script into the cache: " + ec.message();
+				return false;
+			}
+			// The source is only kept to look at, so it doesn't matter if another build's source wins
+			std::filesystem::rename(source, cacheDirectory / (name + ".cpp"), ec);
+			return true;
+		#else
+			error = "Native compilation is only supported on Linux";
+			return false;
+		#endif
+		}
+	};
+
+	// Make native code the way a script runs. The entry and tier are atomics, so instances running the script on other
+	// threads finish their current run on the tier they started on and pick up the entry on their next one.
+	inline void tsInstallNative(tsScript& script, tsNativeEntry entry)
+	{
+		script.native.store(entry, std::memory_order_release);
+		script.tier.store(tsTier::tsNative, std::memory_order_release);
+	}
+
+	// Switch a script to native code. On failure the script is left as it was and keeps running in the interpreter.
+	// Only verified scripts can be compiled. This blocks for as long as the C++ compiler runs and the script must stay
+	// where it is until it returns, so don't call it on a script in a context other threads may be adding scripts to.
+	// tsTieredRuntime compiles a copy of the script on tsPromoter's worker instead.
+	inline bool tsCompileNative(tsScript& script, std::string& error, tsNativeCompiler& compiler = tsNativeCompiler::global())
+	{
+		if (!script.verified || !script.prepared())
+		{
+			error = "Only loaded and verified scripts can be compiled";
+			return false;
+		}
+		tsNativeEntry entry = compiler.compile(script, error);
+		if (!entry)
+			return false;
+		tsInstallNative(script, entry);
+		return true;
+	}
+
+	// A runtime that can move its script to native code once it is worth the cost of compiling,
+	// Run, SetGlobal and GetGlobal work the same before and after.
+	class tsNativeRuntime : public tsRuntime
+	{
+	public:
+		tsNativeRuntime(std::shared_ptr<tsContext>& context) : tsRuntime(context)
+		{
+		}
+
+		// Returns false and keeps interpreting if the script could not be compiled
+		bool CompileNative()
+		{
+			tsMASSERT(scriptLoaded, "No script loaded");
+			std::string error;
+			if (!tsCompileNative(_context->scripts[loadedScript], error))
+			{
+				tsLOG_WARNING("Running script " << loadedScript << " in the interpreter: " << error);
+				return false;
+			}
+			return true;
+		}
+
+		bool compiled() const
+		{
+			return _context->scripts[loadedScript].native != nullptr;
+		}
+	};
+}
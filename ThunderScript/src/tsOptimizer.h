@@ -0,0 +1,295 @@
+#pragma once
+#include <vector>
+#include "ThunderScript.h"
+
+namespace ts
+{
+	// Call read(index, size) for every operand an instruction reads and write(index, size) for the one it writes
+	template<class Read, class Write>
+	void tsForEachOperand(const tsInstruction& i, Read read, Write write)
+	{
+		if (i.code == tsLOAD)
+		{
+			write(i.r, (size_t)i.a);
+			return;
+		}
+		if (i.code == tsMOVE)
+		{
+			read(i.a, (size_t)i.b);
+			write(i.r, (size_t)i.b);
+			return;
+		}
+		tsOperandTypes types = tsGetOperandTypes(i.code);
+		if (types.a != tsVarType::tsNone)
+			read(i.a, tsGetTypeSize(types.a));
+		if (types.b != tsVarType::tsNone)
+			read(i.b, tsGetTypeSize(types.b));
+		if (types.r != tsVarType::tsNone)
+			write(i.r, tsGetTypeSize(types.r));
+	}
+
+	// Call f with every instruction execution can go to after instruction n
+	template<class F>
+	void tsForEachSuccessor(const std::vector<tsInstruction>& code, size_t n, F f)
+	{
+		const tsInstruction& i = code[n];
+		if (i.code == tsEND)
+			return;
+		if (i.code == tsJUMP)
+		{
+			f(i.imm.target);
+			return;
+		}
+		if (tsIsJump(i.code))
+			f(i.imm.target);
+		if (n + 1 < code.size())
+			f(n + 1);
+	}
+
+	// Which bytes of memory hold a value that is still going to be read after each instruction.
+	// Only globals are seen by the host once a run ends, every other slot is written before it is read in each run.
+	class tsLiveness
+	{
+	public:
+		std::vector<std::vector<bool>> liveOut;
+
+		tsLiveness(const tsScript& script, const std::vector<tsInstruction>& code)
+		{
+			std::vector<bool> exit(script.numBytes, false);
+			for (const tsGlobal& g : script.globals)
+				for (size_t b = g.index; b < g.index + tsGetTypeSize(g.type) && b < script.numBytes; b++)
+					exit[b] = true;
+
+			std::vector<std::vector<bool>> liveIn(code.size(), std::vector<bool>(script.numBytes, false));
+			liveOut.assign(code.size(), std::vector<bool>(script.numBytes, false));
+			bool changed = true;
+			while (changed)
+			{
+				changed = false;
+				for (size_t n = code.size(); n-- > 0;)
+				{
+					std::vector<bool> out = code[n].code == tsEND ? exit : std::vector<bool>(script.numBytes, false);
+					tsForEachSuccessor(code, n, [&](size_t s) {
+						for (size_t b = 0; b < out.size(); b++)
+							if (liveIn[s][b])
+								out[b] = true;
+					});
+
+					std::vector<bool> in = out;
+					tsForEachOperand(code[n],
+						[](tsIndex, size_t) {},
+						[&](tsIndex index, size_t size) {
+							for (size_t b = index; b < index + size && b < in.size(); b++)
+								in[b] = false;
+						});
+					tsForEachOperand(code[n],
+						[&](tsIndex index, size_t size) {
+							for (size_t b = index; b < index + size && b < in.size(); b++)
+								in[b] = true;
+						},
+						[](tsIndex, size_t) {});
+
+					if (in != liveIn[n] || out != liveOut[n])
+					{
+						liveIn[n] = std::move(in);
+						liveOut[n] = std::move(out);
+						changed = true;
+					}
+				}
+			}
+		}
+
+		bool liveAfter(size_t n, tsIndex index, size_t size) const
+		{
+			for (size_t b = index; b < index + size && b < liveOut[n].size(); b++)
+				if (liveOut[n][b])
+					return true;
+			return false;
+		}
+	};
+
+	inline bool tsOverlaps(tsIndex a, size_t aSize, tsIndex b, size_t bSize)
+	{
+		return a < b + bSize && b < a + aSize;
+	}
+
+	// Try to replace instruction n and the one after it with a single superinstruction:
+	//   FLIP t <- b; ADD r <- x, t      becomes SUB r <- x, b
+	//   ItoF t <- i; ADDF r <- x, t     becomes ItoFADDF r <- i, x
+	//   op t <- ...; MOVE r <- t        becomes op r <- ...
+	//   compare c <- x, y; JUMPF c      becomes a compare jump on x and y
+	// Each of these only holds when nothing reads the temporary t afterwards.
+	inline bool tsFusePair(const std::vector<tsInstruction>& code, size_t n, const tsLiveness& live, tsInstruction& fused)
+	{
+		const tsInstruction& i = code[n];
+		const tsInstruction& j = code[n + 1];
+
+		// Where i writes, if it writes anywhere
+		tsIndex t = 0;
+		size_t tSize = 0;
+		tsForEachOperand(i, [](tsIndex, size_t) {}, [&](tsIndex index, size_t size) {
+			t = index;
+			tSize = size;
+		});
+		if (tSize == 0)
+			return false;
+		auto deadAfter = [&](tsIndex r, size_t rSize) {
+			return (t == r && tSize == rSize) || !live.liveAfter(n + 1, t, tSize);
+		};
+
+		// Additions where one side is the result of i and the other side does not touch it
+		auto addend = [&](tsByte add, tsIndex& other) {
+			if (j.code != add || (j.a == t) == (j.b == t))
+				return false;
+			other = j.a == t ? j.b : j.a;
+			return !tsOverlaps(other, 4, t, tSize) && deadAfter(j.r, 4);
+		};
+
+		tsIndex other;
+		if ((i.code == tsFLIPF && addend(tsADDF, other)) || (i.code == tsFLIPI && addend(tsADDI, other)))
+		{
+			fused = tsInstruction();
+			fused.code = i.code == tsFLIPF ? tsSUBF : tsSUBI;
+			fused.a = other;
+			fused.b = i.a;
+			fused.r = j.r;
+			return true;
+		}
+		if (i.code == tsItoF && addend(tsADDF, other))
+		{
+			fused = tsInstruction();
+			fused.code = tsItoFADDF;
+			fused.a = i.a;
+			fused.b = other;
+			fused.r = j.r;
+			return true;
+		}
+		if (j.code == tsMOVE && j.a == t && j.b == tSize && deadAfter(j.r, j.b))
+		{
+			// Moves copy with memcpy, so a move of a move must not end up overlapping its source
+			if (i.code == tsMOVE && tsOverlaps(i.a, i.b, j.r, j.b))
+				return false;
+			fused = i;
+			fused.r = j.r;
+			return true;
+		}
+		if (j.code == tsJUMPF && j.a == t && tsComparisonJump(i.code) != tsEND && !live.liveAfter(n + 1, t, tSize))
+		{
+			fused = tsInstruction();
+			fused.code = tsComparisonJump(i.code);
+			fused.a = i.a;
+			fused.b = i.b;
+			fused.imm.target = j.imm.target;
+			return true;
+		}
+		return false;
+	}
+
+	// Fuse common sequences of instructions into superinstructions until there are none left,
+	// returns how many instructions were removed
+	inline size_t tsFuseSuperinstructions(const tsScript& script, std::vector<tsInstruction>& code)
+	{
+		size_t removedTotal = 0;
+		bool changed = true;
+		while (changed)
+		{
+			changed = false;
+			// Fusing only ever makes fewer bytes live, so liveness from the start of a sweep stays safe to use
+			tsLiveness live(script, code);
+			std::vector<bool> isTarget(code.size(), false);
+			for (const tsInstruction& i : code)
+				if (tsIsJump(i.code))
+					isTarget[i.imm.target] = true;
+
+			std::vector<bool> removed(code.size(), false);
+			for (size_t n = 0; n + 1 < code.size(); n++)
+			{
+				// The second instruction can only be folded into the first if nothing else jumps to it
+				tsInstruction fused;
+				if (isTarget[n + 1] || !tsFusePair(code, n, live, fused))
+					continue;
+				code[n] = fused;
+				removed[n + 1] = true;
+				changed = true;
+				n++;
+			}
+			if (!changed)
+				break;
+
+			std::vector<size_t> newIndex(code.size());
+			std::vector<tsInstruction> compacted;
+			for (size_t n = 0; n < code.size(); n++)
+			{
+				newIndex[n] = compacted.size();
+				if (!removed[n])
+					compacted.push_back(code[n]);
+			}
+			for (tsInstruction& i : compacted)
+				if (tsIsJump(i.code))
+					i.imm.target = newIndex[i.imm.target];
+			removedTotal += code.size() - compacted.size();
+			code = std::move(compacted);
+		}
+		return removedTotal;
+	}
+
+	// Swap the first command of every sequence that has a generated superinstruction for that superinstruction,
+	// taking the longest one where several match. The rest of each sequence stays where it is, so jumps into the
+	// middle of one still land on a whole instruction. Returns how many superinstructions were used.
+	// Only tsExecuteByteCode has handlers for them. tsDecode turns them back into the commands they replaced, so
+	// scripts run from their decoded instructions, by Run, tsExecute, batches or native code, gain nothing from them.
+	inline size_t tsApplySuperinstructions(tsBytecode& bytecode)
+	{
+		tsBytes& bytes = bytecode.bytes;
+		std::vector<size_t> starts;
+		for (size_t cursor = 0; cursor < bytes.size(); cursor += tsInstructionSize(bytes, cursor))
+			starts.push_back(cursor);
+
+		size_t applied = 0;
+		size_t n = 0;
+		while (n < starts.size())
+		{
+			tsByte best = tsEND;
+			size_t bestLength = 1;
+			for (size_t s = 0; s < tsSuperinstructionCount; s++)
+			{
+				const tsByte* sequence = tsSuperinstructionSequence((tsByte)(tsCommandCount + s));
+				size_t length = 0;
+				while (sequence[length] != tsEND && n + length < starts.size() &&
+					tsBaseCommand(bytes.read<tsByte>(starts[n + length])) == sequence[length])
+					length++;
+				if (sequence[length] == tsEND && length > bestLength)
+				{
+					best = (tsByte)(tsCommandCount + s);
+					bestLength = length;
+				}
+			}
+			if (best != tsEND)
+			{
+				bytes.set(starts[n], best);
+				applied++;
+			}
+			n += bestLength;
+		}
+		return applied;
+	}
+
+	// Decode a script's bytecode, fuse superinstructions and encode it again, then use whichever generated
+	// superinstructions fit if generated is true. The script has to be loaded again afterwards, so this is done by the
+	// compiler before a script is verified. Returns how many instructions fusing removed.
+	inline size_t tsOptimize(tsScript& script, bool generated = false)
+	{
+		std::vector<tsInstruction> code = tsDecode(script.bytecode);
+		size_t removed = tsFuseSuperinstructions(script, code);
+		if (removed != 0)
+			script.bytecode = tsEncode(code);
+		size_t applied = generated ? tsApplySuperinstructions(script.bytecode) : 0;
+		tsLOG_DEBUG("Used " << applied << " generated superinstructions");
+		if (removed != 0 || applied != 0)
+		{
+			script.verified = false;
+			script.instructions.clear();
+		}
+		return removed;
+	}
+}
@@ -0,0 +1,611 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <ostream>
+#include <functional>
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include "tsIR.h"
+#include "tsOptimizer.h"
+
+namespace ts
+{
+	// The bytes of memory globals live in. Any global can be bound to host memory another bound global also points
+	// at, so the passes treat reading or writing one global as reading or writing every one of them.
+	class tsGlobalBytes
+	{
+	private:
+		std::vector<bool> bytes;
+
+	public:
+		tsGlobalBytes(const tsIR& ir) : bytes(ir.numBytes, false)
+		{
+			for (const tsGlobal& g : ir.globals)
+				for (size_t b = g.index; b < g.index + tsGetTypeSize(g.type) && b < bytes.size(); b++)
+					bytes[b] = true;
+		}
+
+		bool contains(tsIndex slot, size_t size) const
+		{
+			for (size_t b = slot; b < slot + size && b < bytes.size(); b++)
+				if (bytes[b])
+					return true;
+			return false;
+		}
+
+		bool contains(const tsIRValue& v) const
+		{
+			return !v.constant && v.type != tsVarType::tsNone && contains(v.slot, v.size());
+		}
+
+		// Mark the bytes of every global in live
+		void markAll(std::vector<bool>& live) const
+		{
+			for (size_t b = 0; b < bytes.size() && b < live.size(); b++)
+				if (bytes[b])
+					live[b] = true;
+		}
+	};
+
+	// Update the bytes live before an instruction from the ones live after it. Reading a global keeps every global
+	// live, since the one read may share its memory with any of them.
+	inline void tsLiveBefore(const tsIRInstruction& i, std::vector<bool>& live, const tsGlobalBytes& globals)
+	{
+		auto mark = [&](const tsIRValue& v, bool value) {
+			for (size_t b = v.slot; b < v.slot + v.size() && b < live.size(); b++)
+				live[b] = value;
+		};
+		tsForEachOperand(i, [](const tsIRValue&) {}, [&](const tsIRValue& v) { mark(v, false); });
+		tsForEachOperand(i, [&](const tsIRValue& v) {
+			mark(v, true);
+			if (globals.contains(v))
+				globals.markAll(live);
+		}, [](const tsIRValue&) {});
+	}
+
+	inline bool tsAnyLive(const std::vector<bool>& live, const tsIRValue& v)
+	{
+		for (size_t b = v.slot; b < v.slot + v.size() && b < live.size(); b++)
+			if (live[b])
+				return true;
+		return false;
+	}
+
+	// Which bytes of memory hold a value that is still going to be read at the end of each block, the IR counterpart
+	// of tsLiveness
+	class tsIRLiveness
+	{
+	public:
+		std::vector<std::vector<bool>> liveOut;
+
+		tsIRLiveness(const tsIR& ir)
+		{
+			tsGlobalBytes globals(ir);
+			std::vector<bool> exit(ir.numBytes, false);
+			globals.markAll(exit);
+
+			std::vector<std::vector<bool>> liveIn(ir.blocks.size(), std::vector<bool>(ir.numBytes, false));
+			liveOut.assign(ir.blocks.size(), std::vector<bool>(ir.numBytes, false));
+			bool changed = true;
+			while (changed)
+			{
+				changed = false;
+				for (size_t n = ir.blocks.size(); n-- > 0;)
+				{
+					std::vector<bool> out(ir.numBytes, false);
+					bool exits = tsForEachSuccessor(ir, n, [&](size_t s) {
+						for (size_t b = 0; b < out.size(); b++)
+							if (liveIn[s][b])
+								out[b] = true;
+					});
+					if (exits)
+						for (size_t b = 0; b < out.size(); b++)
+							if (exit[b])
+								out[b] = true;
+
+					std::vector<bool> in = out;
+					const std::vector<tsIRInstruction>& instructions = ir.blocks[n].instructions;
+					for (size_t i = instructions.size(); i-- > 0;)
+						tsLiveBefore(instructions[i], in, globals);
+
+					if (in != liveIn[n] || out != liveOut[n])
+					{
+						liveIn[n] = std::move(in);
+						liveOut[n] = std::move(out);
+						changed = true;
+					}
+				}
+			}
+		}
+	};
+
+	// Work out the result of an instruction whose inputs are all constants. Returns false if it can't be done while
+	// compiling, either because an input isn't known or because the result is left to the runtime: int division by
+	// zero and float to int conversions that don't fit.
+	inline bool tsEvaluate(const tsIRInstruction& i, tsIRValue& result)
+	{
+		const tsIRValue& a = i.a;
+		const tsIRValue& b = i.b;
+		if (!a.constant || (b.type != tsVarType::tsNone && !b.constant))
+			return false;
+		// Ints are worked out unsigned so they wrap around like the runtime does
+		auto ua = [&]() { return (std::uint32_t)a.value<tsInt>(); };
+		auto ub = [&]() { return (std::uint32_t)b.value<tsInt>(); };
+		auto i32 = [&](std::uint32_t v) { result = tsIRConstant(tsVarType::tsInt, (tsInt)v); };
+		auto f32 = [&](tsFloat v) { result = tsIRConstant(tsVarType::tsFloat, v); };
+		auto b8 = [&](bool v) { result = tsIRConstant(tsVarType::tsBool, (tsBool)v); };
+		tsFloat fa = a.type == tsVarType::tsFloat ? a.value<tsFloat>() : 0;
+		tsFloat fb = b.type == tsVarType::tsFloat ? b.value<tsFloat>() : 0;
+		switch (i.code)
+		{
+			case tsMOVE:
+				return false;
+			case tsItoF:       f32((tsFloat)a.value<tsInt>()); return true;
+			case tsFtoI:
+				if (!(fa >= -2147483648.0f && fa < 2147483648.0f))
+					return false;
+				i32((std::uint32_t)(tsInt)fa);
+				return true;
+			case tsFLIPI:      i32(0u - ua()); return true;
+			case tsADDI:       i32(ua() + ub()); return true;
+			case tsSUBI:       i32(ua() - ub()); return true;
+			case tsMULI:       i32(ua() * ub()); return true;
+			case tsDIVI:
+				if (b.value<tsInt>() == 0 || (a.value<tsInt>() == INT32_MIN && b.value<tsInt>() == -1))
+					return false;
+				i32((std::uint32_t)(a.value<tsInt>() / b.value<tsInt>()));
+				return true;
+			case tsFLIPF:      f32(-fa); return true;
+			case tsADDF:       f32(fa + fb); return true;
+			case tsSUBF:       f32(fa - fb); return true;
+			case tsMULF:       f32(fa * fb); return true;
+			case tsDIVF:       f32(fa / fb); return true;
+			case tsNOT:        b8(!a.value<tsBool>()); return true;
+			case tsAND:        b8(a.value<tsBool>() && b.value<tsBool>()); return true;
+			case tsOR:         b8(a.value<tsBool>() || b.value<tsBool>()); return true;
+			case tsEqualB:     b8(a.value<tsBool>() == b.value<tsBool>()); return true;
+			case tsLessI:      b8(a.value<tsInt>() < b.value<tsInt>()); return true;
+			case tsLessEqualI: b8(a.value<tsInt>() <= b.value<tsInt>()); return true;
+			case tsEqualI:     b8(a.value<tsInt>() == b.value<tsInt>()); return true;
+			case tsLessF:      b8(fa < fb); return true;
+			case tsLessEqualF: b8(fa <= fb); return true;
+			case tsEqualF:     b8(fa == fb); return true;
+			default:
+				return false;
+		}
+	}
+
+	// Algebraic identities that hold for every int: x + 0, x - 0, x * 1 and x / 1 are x and x * 0 is 0.
+	// Floats are left alone since -0 + 0 is 0 and NaN * 0 is NaN. Returns whether i was simplified.
+	inline bool tsSimplify(tsIRInstruction& i)
+	{
+		auto is = [](const tsIRValue& v, tsInt n) { return v.constant && v.value<tsInt>() == n; };
+		auto move = [&](const tsIRValue& from) {
+			i.code = tsMOVE;
+			i.a = from;
+			i.b = tsIRValue();
+		};
+		switch (i.code)
+		{
+			case tsADDI:
+				if (is(i.b, 0))
+					move(i.a);
+				else if (is(i.a, 0))
+					move(i.b);
+				else
+					return false;
+				return true;
+			case tsSUBI:
+				if (is(i.b, 0))
+					move(i.a);
+				else if (is(i.a, 0))
+				{
+					i.code = tsFLIPI;
+					i.a = i.b;
+					i.b = tsIRValue();
+				}
+				else
+					return false;
+				return true;
+			case tsMULI:
+				if (is(i.b, 1))
+					move(i.a);
+				else if (is(i.a, 1))
+					move(i.b);
+				else if (is(i.a, 0) || is(i.b, 0))
+					move(tsIRConstant(tsVarType::tsInt, (tsInt)0));
+				else
+					return false;
+				return true;
+			case tsDIVI:
+				if (!is(i.b, 1))
+					return false;
+				move(i.a);
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	// Constant folding. Tracks which slots hold a known value through each block, replaces reads of them with the
+	// value and works out instructions whose inputs are all known, leaving a move of the result. Jumps on a known
+	// condition become a tsJUMP or are dropped. Writing a global forgets the values of every global.
+	inline bool tsFoldConstants(tsIR& ir)
+	{
+		tsGlobalBytes globals(ir);
+		bool changed = false;
+		for (tsIRBlock& block : ir.blocks)
+		{
+			std::vector<tsIRValue> known;
+			std::vector<tsIndex> knownSlots;
+			auto substitute = [&](tsIRValue& v) {
+				if (v.type == tsVarType::tsNone || v.constant)
+					return;
+				for (size_t k = 0; k < known.size(); k++)
+				{
+					if (knownSlots[k] == v.slot && known[k].type == v.type)
+					{
+						v = known[k];
+						changed = true;
+						return;
+					}
+				}
+			};
+
+			std::vector<tsIRInstruction>& instructions = block.instructions;
+			for (size_t n = 0; n < instructions.size(); n++)
+			{
+				tsIRInstruction& i = instructions[n];
+				substitute(i.a);
+				substitute(i.b);
+
+				tsIRValue result;
+				if (tsEvaluate(i, result))
+				{
+					i.code = tsMOVE;
+					i.a = result;
+					i.b = tsIRValue();
+					changed = true;
+				}
+				else if (tsSimplify(i))
+					changed = true;
+				else if (i.code == tsJUMPF && i.a.constant)
+				{
+					if (i.a.value<tsBool>())
+					{
+						instructions.erase(instructions.begin() + n);
+						changed = true;
+						break;
+					}
+					i.code = tsJUMP;
+					i.a = tsIRValue();
+					changed = true;
+				}
+
+				if (!i.writes())
+					continue;
+				bool aliased = globals.contains(i.r);
+				for (size_t k = known.size(); k-- > 0;)
+				{
+					if (tsOverlaps(knownSlots[k], known[k].size(), i.r.slot, i.r.size()) || (aliased && globals.contains(knownSlots[k], known[k].size())))
+					{
+						known.erase(known.begin() + k);
+						knownSlots.erase(knownSlots.begin() + k);
+					}
+				}
+				if (i.code == tsMOVE && i.a.constant)
+				{
+					known.push_back(i.a);
+					knownSlots.push_back(i.r.slot);
+				}
+			}
+		}
+		return changed;
+	}
+
+	// Dead code elimination. Removes every instruction whose result is overwritten or never read again.
+	inline bool tsEliminateDeadCode(tsIR& ir)
+	{
+		tsIRLiveness live(ir);
+		tsGlobalBytes globals(ir);
+		bool changed = false;
+		for (size_t n = 0; n < ir.blocks.size(); n++)
+		{
+			std::vector<tsIRInstruction>& instructions = ir.blocks[n].instructions;
+			std::vector<bool> liveNow = live.liveOut[n];
+			for (size_t i = instructions.size(); i-- > 0;)
+			{
+				if (instructions[i].writes() && !tsAnyLive(liveNow, instructions[i].r))
+				{
+					instructions.erase(instructions.begin() + i);
+					changed = true;
+					continue;
+				}
+				tsLiveBefore(instructions[i], liveNow, globals);
+			}
+		}
+		return changed;
+	}
+
+	// Copy propagation. After a move d <- s, reads of d later in the block read s instead for as long as neither of
+	// them is written again, which often leaves nothing reading the move for dead code elimination to remove.
+	// Writing a global drops every copy to or from a global.
+	inline bool tsPropagateCopies(tsIR& ir)
+	{
+		tsGlobalBytes globals(ir);
+		bool changed = false;
+		for (tsIRBlock& block : ir.blocks)
+		{
+			// Destination and source of every move that still holds
+			std::vector<std::pair<tsIRValue, tsIRValue>> copies;
+			for (tsIRInstruction& i : block.instructions)
+			{
+				for (tsIRValue* v : { &i.a, &i.b })
+				{
+					if (v->type == tsVarType::tsNone || v->constant)
+						continue;
+					for (const std::pair<tsIRValue, tsIRValue>& copy : copies)
+					{
+						if (copy.first == *v)
+						{
+							*v = copy.second;
+							changed = true;
+							break;
+						}
+					}
+				}
+				if (!i.writes())
+					continue;
+				bool aliased = globals.contains(i.r);
+				for (size_t c = copies.size(); c-- > 0;)
+				{
+					const tsIRValue& d = copies[c].first;
+					const tsIRValue& s = copies[c].second;
+					if (tsOverlaps(d.slot, d.size(), i.r.slot, i.r.size()) || tsOverlaps(s.slot, s.size(), i.r.slot, i.r.size()) ||
+						(aliased && (globals.contains(d) || globals.contains(s))))
+						copies.erase(copies.begin() + c);
+				}
+				if (i.code == tsMOVE && !i.a.constant && !tsOverlaps(i.a.slot, i.a.size(), i.r.slot, i.r.size()))
+					copies.push_back({ i.r, i.a });
+			}
+		}
+		return changed;
+	}
+
+	// Dead move elimination. A move d <- t of a value nothing else reads is removed by having the instruction that
+	// produced t write straight to d, as long as nothing in between touches d. Moves of a slot to itself are dropped.
+	// The producer may read d itself, every command reads its operands before writing its result.
+	// A move into a global is never moved ahead of anything that reads or writes another global.
+	inline bool tsRetargetMoves(tsIR& ir)
+	{
+		tsIRLiveness liveness(ir);
+		tsGlobalBytes globals(ir);
+		bool changed = false;
+		auto overlaps = [](const tsIRValue& a, const tsIRValue& b) {
+			return tsOverlaps(a.slot, a.size(), b.slot, b.size());
+		};
+		for (size_t n = 0; n < ir.blocks.size(); n++)
+		{
+			std::vector<tsIRInstruction>& instructions = ir.blocks[n].instructions;
+			std::vector<std::vector<bool>> liveAfter(instructions.size());
+			std::vector<bool> live = liveness.liveOut[n];
+			for (size_t i = instructions.size(); i-- > 0;)
+			{
+				liveAfter[i] = live;
+				tsLiveBefore(instructions[i], live, globals);
+			}
+
+			std::vector<bool> removed(instructions.size(), false);
+			for (size_t m = 0; m < instructions.size(); m++)
+			{
+				const tsIRInstruction& move = instructions[m];
+				if (move.code != tsMOVE || move.a.constant)
+					continue;
+				if (move.a == move.r)
+				{
+					removed[m] = true;
+					changed = true;
+					continue;
+				}
+				const tsIRValue t = move.a;
+				const tsIRValue d = move.r;
+				if (tsAnyLive(liveAfter[m], t) || overlaps(t, d))
+					continue;
+				bool global = globals.contains(d);
+				for (size_t p = m; p-- > 0;)
+				{
+					if (removed[p])
+						continue;
+					tsIRInstruction& producer = instructions[p];
+					if (producer.writes() && producer.r == t)
+					{
+						producer.r = d;
+						removed[m] = true;
+						changed = true;
+						break;
+					}
+					bool blocked = false;
+					auto touches = [&](const tsIRValue& v) { blocked |= overlaps(v, d) || overlaps(v, t) || (global && globals.contains(v)); };
+					tsForEachOperand(producer, touches, touches);
+					if (blocked)
+						break;
+				}
+			}
+
+			size_t kept = 0;
+			for (size_t i = 0; i < instructions.size(); i++)
+				if (!removed[i])
+					instructions[kept++] = instructions[i];
+			instructions.resize(kept);
+		}
+		return changed;
+	}
+
+	// Common subexpression elimination by value numbering. Every value in a block gets a number, and an instruction
+	// that runs the same command on the same numbers as an earlier one becomes a move from the slot that holds the
+	// earlier result, as long as that slot hasn't been written since. Numbering starts over at every block, since
+	// values can come from more than one place where blocks join.
+	// Results held in #ref globals are never reused, the host can bind those to memory of its own and change them.
+	// Writing a global forgets the values of every global, see tsGlobalBytes.
+	inline bool tsEliminateCommonSubexpressions(tsIR& ir)
+	{
+		std::vector<bool> hostOwned(ir.numBytes, false);
+		for (const tsGlobal& g : ir.globals)
+			if (g.writeMode == tsGlobal::GlobalType::tsRef)
+				for (size_t b = g.index; b < g.index + tsGetTypeSize(g.type) && b < ir.numBytes; b++)
+					hostOwned[b] = true;
+		tsGlobalBytes globals(ir);
+
+		bool changed = false;
+		for (tsIRBlock& block : ir.blocks)
+		{
+			size_t next = 0;
+			// Number and type of the value each slot holds
+			std::map<tsIndex, std::pair<size_t, tsVarType>> slotValue;
+			std::map<std::pair<tsVarType, std::uint32_t>, size_t> constantValue;
+			// Command and operand numbers of every result, with its number and the slot holding it
+			std::map<std::tuple<tsByte, size_t, size_t>, std::pair<size_t, tsIRValue>> expressions;
+
+			auto number = [&](const tsIRValue& v) {
+				if (v.constant)
+				{
+					std::uint32_t bits = 0;
+					std::memcpy(&bits, v.bytes, v.size());
+					auto c = constantValue.find({ v.type, bits });
+					if (c != constantValue.end())
+						return c->second;
+					return constantValue[{ v.type, bits }] = next++;
+				}
+				auto s = slotValue.find(v.slot);
+				if (s != slotValue.end() && s->second.second == v.type)
+					return s->second.first;
+				slotValue[v.slot] = { next, v.type };
+				return next++;
+			};
+			auto write = [&](const tsIRValue& r, size_t value) {
+				bool aliased = globals.contains(r);
+				for (auto s = slotValue.begin(); s != slotValue.end();)
+				{
+					size_t size = tsGetTypeSize(s->second.second);
+					if (tsOverlaps(s->first, size, r.slot, r.size()) || (aliased && globals.contains(s->first, size)))
+						s = slotValue.erase(s);
+					else
+						s++;
+				}
+				slotValue[r.slot] = { value, r.type };
+			};
+
+			for (tsIRInstruction& i : block.instructions)
+			{
+				if (!i.writes())
+					continue;
+				if (i.code == tsMOVE)
+				{
+					write(i.r, number(i.a));
+					continue;
+				}
+				size_t a = number(i.a);
+				size_t b = i.b.type != tsVarType::tsNone ? number(i.b) : SIZE_MAX;
+				if (tsCommutes(i.code) && b < a)
+					std::swap(a, b);
+				std::tuple<tsByte, size_t, size_t> key = { i.code, a, b };
+
+				auto e = expressions.find(key);
+				if (e != expressions.end())
+				{
+					const tsIRValue& holder = e->second.second;
+					auto h = slotValue.find(holder.slot);
+					if (h != slotValue.end() && h->second.first == e->second.first && h->second.second == holder.type)
+					{
+						i.code = tsMOVE;
+						i.a = holder;
+						i.b = tsIRValue();
+						write(i.r, e->second.first);
+						changed = true;
+						continue;
+					}
+				}
+				size_t value = next++;
+				write(i.r, value);
+				if (!tsAnyLive(hostOwned, i.r))
+					expressions[key] = { value, i.r };
+			}
+		}
+		return changed;
+	}
+
+	// Runs passes over the IR in order, going round again for as long as any of them changes something
+	class tsPassManager
+	{
+	public:
+		struct Pass
+		{
+			std::string name;
+			std::function<bool(tsIR&)> run;
+		};
+		std::vector<Pass> passes;
+		// When set the IR is written here before the first pass and after every pass that ran, for tuning the passes
+		std::ostream* dump = nullptr;
+		// Passes keep opening up work for each other, but only this many times
+		size_t maxRounds = 8;
+
+		void add(const std::string& name, std::function<bool(tsIR&)> run)
+		{
+			passes.push_back({ name, std::move(run) });
+		}
+
+		// Returns false if there is no pass with that name
+		bool remove(const std::string& name)
+		{
+			auto pass = std::find_if(passes.begin(), passes.end(), [&name](const Pass& p) { return p.name == name; });
+			if (pass == passes.end())
+				return false;
+			passes.erase(pass);
+			return true;
+		}
+
+		// Returns how many instructions the passes removed
+		size_t run(tsIR& ir)
+		{
+			size_t before = ir.size();
+			if (dump)
+			{
+				*dump << "IR before optimizing:\n";
+				tsDumpIR(*dump, ir);
+			}
+			bool changed = true;
+			for (size_t round = 0; changed && round < maxRounds; round++)
+			{
+				changed = false;
+				for (Pass& pass : passes)
+				{
+					bool passChanged = pass.run(ir);
+					changed |= passChanged;
+					if (dump)
+					{
+						*dump << "IR after " << pass.name << " in round " << round << (passChanged ? ":\n" : ", unchanged\n");
+						if (passChanged)
+							tsDumpIR(*dump, ir);
+					}
+				}
+			}
+			tsLOG_DEBUG("Optimizing the IR removed " << before - ir.size() << " instructions");
+			return before - ir.size();
+		}
+	};
+
+	// The passes the compiler runs
+	inline tsPassManager tsDefaultPasses()
+	{
+		tsPassManager passes;
+		passes.add("constant folding", tsFoldConstants);
+		passes.add("common subexpression elimination", tsEliminateCommonSubexpressions);
+		// Moves are retargeted before copies are propagated, otherwise reads of a global that was just assigned
+		// would be redirected to the temporary and keep it and the move alive
+		passes.add("dead move elimination", tsRetargetMoves);
+		passes.add("copy propagation", tsPropagateCopies);
+		passes.add("dead code elimination", tsEliminateDeadCode);
+		return passes;
+	}
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "tsPasses.h"
+
+namespace ts
+{
+	// The instructions over which a slot holds a value that is still needed, positions count instructions through
+	// the blocks in order
+	struct tsLiveInterval
+	{
+		tsIndex slot = 0;
+		size_t size = 0;
+		size_t start = SIZE_MAX;
+		size_t end = 0;
+	};
+
+	// Work out the live interval of every slot the IR uses. Returns false if operands use slots that partly overlap,
+	// which the compiler never does, since their bytes couldn't be moved apart.
+	inline bool tsLiveIntervals(const tsIR& ir, std::vector<tsLiveInterval>& intervals)
+	{
+		const tsIndex none = (tsIndex)-1;
+		std::vector<tsIndex> owner(ir.numBytes, none);
+		std::vector<tsLiveInterval> bySlot(ir.numBytes);
+		bool consistent = true;
+		auto claim = [&](tsIndex slot, size_t size) {
+			if (slot + size > ir.numBytes || (bySlot[slot].size != 0 && bySlot[slot].size != size))
+			{
+				consistent = false;
+				return;
+			}
+			for (size_t b = slot; b < slot + size; b++)
+			{
+				if (owner[b] != none && owner[b] != slot)
+					consistent = false;
+				owner[b] = slot;
+			}
+			bySlot[slot].slot = slot;
+			bySlot[slot].size = size;
+		};
+		for (const tsGlobal& g : ir.globals)
+			claim(g.index, tsGetTypeSize(g.type));
+		for (const tsIRBlock& block : ir.blocks)
+			for (const tsIRInstruction& i : block.instructions)
+				tsForEachOperand(i, [&](const tsIRValue& v) { claim(v.slot, v.size()); }, [&](const tsIRValue& v) { claim(v.slot, v.size()); });
+		if (!consistent)
+			return false;
+
+		auto extend = [&](tsIndex slot, size_t position) {
+			tsLiveInterval& interval = bySlot[slot];
+			interval.start = std::min(interval.start, position);
+			interval.end = std::max(interval.end, position);
+		};
+		auto extendLive = [&](const std::vector<bool>& live, size_t position) {
+			for (size_t b = 0; b < live.size(); b++)
+				if (live[b] && owner[b] != none)
+					extend(owner[b], position);
+		};
+
+		tsIRLiveness liveness(ir);
+		tsGlobalBytes globals(ir);
+		size_t position = 0;
+		for (size_t n = 0; n < ir.blocks.size(); n++)
+		{
+			const std::vector<tsIRInstruction>& instructions = ir.blocks[n].instructions;
+			std::vector<bool> live = liveness.liveOut[n];
+			for (size_t i = instructions.size(); i-- > 0;)
+			{
+				size_t p = position + i;
+				extendLive(live, p);
+				// Results nothing reads still need somewhere to go
+				tsForEachOperand(instructions[i], [&](const tsIRValue& v) { extend(v.slot, p); }, [&](const tsIRValue& v) { extend(v.slot, p); });
+				tsLiveBefore(instructions[i], live, globals);
+				extendLive(live, p);
+			}
+			position += instructions.size();
+		}
+
+		intervals.clear();
+		for (const tsLiveInterval& interval : bySlot)
+			if (interval.size != 0 && interval.start != SIZE_MAX)
+				intervals.push_back(interval);
+		return true;
+	}
+
+	// Give the slots of the IR new places in memory so that values that are never live at the same time share them,
+	// shrinking the memory every instance needs. Globals are packed at the start in the order of their slots, after
+	// them come 4 byte slots that ints and floats share and then the 1 byte slots of bools. The slots are handed out
+	// with a linear scan over the live intervals, taking the lowest slot that is free. Returns how many bytes were saved.
+	inline size_t tsAllocateSlots(tsIR& ir)
+	{
+		std::vector<tsLiveInterval> intervals;
+		if (!tsLiveIntervals(ir, intervals))
+		{
+			tsLOG_WARNING("Operands of the IR overlap, leaving slots where they are");
+			return 0;
+		}
+
+		const tsIndex none = (tsIndex)-1;
+		std::vector<tsIndex> newSlot(ir.numBytes, none);
+		tsIndex bytes = 0;
+		std::vector<tsGlobal*> globals;
+		for (tsGlobal& g : ir.globals)
+			globals.push_back(&g);
+		std::stable_sort(globals.begin(), globals.end(), [](const tsGlobal* a, const tsGlobal* b) {
+			return a->index < b->index;
+		});
+		for (tsGlobal* g : globals)
+		{
+			if (newSlot[g->index] == none)
+			{
+				newSlot[g->index] = bytes;
+				bytes += (tsIndex)tsGetTypeSize(g->type);
+			}
+			g->index = newSlot[g->index];
+		}
+
+		// For every size of slot, the end of the interval last given each slot of that size
+		std::map<size_t, std::vector<size_t>, std::greater<size_t>> busyUntil;
+		std::vector<size_t> assigned(intervals.size());
+		std::stable_sort(intervals.begin(), intervals.end(), [](const tsLiveInterval& a, const tsLiveInterval& b) {
+			return a.start < b.start;
+		});
+		for (size_t n = 0; n < intervals.size(); n++)
+		{
+			const tsLiveInterval& interval = intervals[n];
+			if (newSlot[interval.slot] != none)
+				continue;
+			std::vector<size_t>& slots = busyUntil[interval.size];
+			size_t s = 0;
+			while (s < slots.size() && slots[s] >= interval.start)
+				s++;
+			if (s == slots.size())
+				slots.push_back(0);
+			slots[s] = interval.end;
+			assigned[n] = s;
+		}
+
+		std::map<size_t, tsIndex> base;
+		for (const std::pair<const size_t, std::vector<size_t>>& size : busyUntil)
+		{
+			base[size.first] = bytes;
+			bytes += (tsIndex)(size.first * size.second.size());
+		}
+		for (size_t n = 0; n < intervals.size(); n++)
+			if (newSlot[intervals[n].slot] == none)
+				newSlot[intervals[n].slot] = base[intervals[n].size] + (tsIndex)(assigned[n] * intervals[n].size);
+
+		auto move = [&](tsIRValue& v) {
+			if (v.type != tsVarType::tsNone && !v.constant)
+				v.slot = newSlot[v.slot];
+		};
+		for (tsIRBlock& block : ir.blocks)
+		{
+			for (tsIRInstruction& i : block.instructions)
+			{
+				move(i.a);
+				move(i.b);
+				if (i.writes())
+					move(i.r);
+			}
+		}
+
+		size_t saved = ir.numBytes - bytes;
+		tsLOG_DEBUG("Slot allocation shrank memory from " << ir.numBytes << " to " << bytes << " bytes");
+		ir.numBytes = bytes;
+		return saved;
+	}
+}
@@ -0,0 +1,187 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include "ThunderScript.h"
+
+namespace ts
+{
+	// A sequence of commands that ran back to back and how often it did
+	struct tsSuperinstructionCandidate
+	{
+		std::vector<tsByte> sequence;
+		std::uint64_t count = 0;
+
+		// Dispatches a superinstruction for this sequence would have saved over the profile
+		std::uint64_t saved() const
+		{
+			return count * (sequence.size() - 1);
+		}
+	};
+
+	// Commands that always go on to the next instruction, only these can run before the end of a superinstruction
+	inline bool tsFallsThrough(tsByte code)
+	{
+		return code != tsEND && !tsIsJump(code);
+	}
+
+	// Pick the pairs and triples of commands that would save the most dispatches over a profile, at most max of them.
+	// tsEND is left out entirely since it terminates the sequences in the generated table.
+	inline std::vector<tsSuperinstructionCandidate> tsSelectSuperinstructions(const tsOpcodeProfile& profile, size_t max)
+	{
+		const size_t n = tsCommandCount;
+		std::vector<tsSuperinstructionCandidate> candidates;
+		for (size_t a = 0; a < n; a++)
+		{
+			if (!tsFallsThrough((tsByte)a))
+				continue;
+			for (size_t b = 1; b < n; b++)
+			{
+				if (std::uint64_t count = profile.pairs[a * n + b])
+					candidates.push_back({ { (tsByte)a, (tsByte)b }, count });
+				if (!tsFallsThrough((tsByte)b))
+					continue;
+				for (size_t c = 1; c < n; c++)
+					if (std::uint64_t count = profile.triples[(a * n + b) * n + c])
+						candidates.push_back({ { (tsByte)a, (tsByte)b, (tsByte)c }, count });
+			}
+		}
+		std::stable_sort(candidates.begin(), candidates.end(), [](const tsSuperinstructionCandidate& a, const tsSuperinstructionCandidate& b) {
+			return a.saved() > b.saved();
+		});
+		// Every superinstruction needs a command byte of its own
+		max = std::min(max, (size_t)256 - tsCommandCount);
+		if (candidates.size() > max)
+			candidates.resize(max);
+		return candidates;
+	}
+
+	// C++ that runs the command at cursor inside of tsExecuteByteCode and moves cursor on to the next instruction
+	inline std::string tsSuperinstructionStep(tsByte code)
+	{
+		auto operand = [](size_t n) {
+			return "bytecode.bytes.read<tsIndex>(cursor + " + std::to_string(1 + n * sizeof(tsIndex)) + ")";
+		};
+		if (code == tsLOAD)
+			return "{ tsIndex size = " + operand(0) + "; bytecode.bytes.copy(stack, " + operand(1) + ", cursor + " +
+				std::to_string(1 + 2 * sizeof(tsIndex)) + ", size); cursor += " + std::to_string(1 + 2 * sizeof(tsIndex)) + " + size; }";
+		if (code == tsMOVE)
+			return "stack.copy(" + operand(2) + ", " + operand(1) + ", " + operand(0) + "); cursor += " +
+				std::to_string(tsInstructionSize(code, 0)) + ";";
+
+		tsOperandTypes types = tsGetOperandTypes(code);
+		auto typeName = [](tsVarType type) {
+			return std::string(type == tsVarType::tsInt ? "tsInt" : type == tsVarType::tsFloat ? "tsFloat" : "tsBool");
+		};
+		bool immediate = tsIsImmediate(code);
+		std::string a = "stack.read<" + typeName(types.a) + ">(" + operand(0) + ")";
+		std::string b;
+		if (immediate)
+			b = "bytecode.bytes.read<" + typeName(types.a) + ">(cursor + " + std::to_string(1 + sizeof(tsIndex)) + ")";
+		else if (types.b != tsVarType::tsNone)
+			b = "stack.read<" + typeName(types.b) + ">(" + operand(1) + ")";
+		std::string value;
+		switch (immediate ? tsRegisterForm(code) : code)
+		{
+			case tsItoF:       value = "(tsFloat)" + a; break;
+			case tsFtoI:       value = "(tsInt)" + a; break;
+			case tsFLIPI:
+			case tsFLIPF:      value = "-" + a; break;
+			case tsNOT:        value = "!" + a; break;
+			case tsADDI:
+			case tsADDF:       value = a + " + " + b; break;
+			case tsSUBI:
+			case tsSUBF:       value = a + " - " + b; break;
+			case tsMULI:
+			case tsMULF:       value = a + " * " + b; break;
+			case tsDIVI:
+			case tsDIVF:       value = a + " / " + b; break;
+			case tsAND:        value = a + " && " + b; break;
+			case tsOR:         value = a + " || " + b; break;
+			case tsLessI:
+			case tsLessF:      value = a + " < " + b; break;
+			case tsLessEqualI:
+			case tsLessEqualF: value = a + " <= " + b; break;
+			case tsEqualI:
+			case tsEqualF:
+			case tsEqualB:     value = a + " == " + b; break;
+			case tsItoFADDF:   value = "(tsFloat)" + a + " + " + b; break;
+			default:
+				tsMASSERT(false, std::string("No superinstruction step for ") + tsCommandName(code));
+				return "";
+		}
+		size_t r = types.b == tsVarType::tsNone && !immediate ? 1 : 2;
+		return "stack.set<" + typeName(types.r) + ">(" + operand(r) + ", " + value + "); cursor += " +
+			std::to_string(tsInstructionSize(code, 0)) + ";";
+	}
+
+	// Generate tsSuperinstructions.h for a set of sequences. The sequences become the rewrite rules
+	// tsApplySuperinstructions uses, and each gets a handler for tsExecuteByteCode that runs every command but the last
+	// in place and then goes straight to the last command's own handler, which takes care of dispatching onwards.
+	inline std::string tsGenerateSuperinstructions(const std::vector<tsSuperinstructionCandidate>& selected)
+	{
+		std::ostringstream out;
+		out << "#pragma once\n";
+		out << "// Generated by tsWriteSuperinstructions from an opcode profile, do not edit\n\n";
+
+		for (size_t s = 0; s < selected.size(); s++)
+		{
+			out << "#define tsSuperinstruction" << s << " (tsByte)(" << tsCommandCount + s << ") //";
+			for (tsByte code : selected[s].sequence)
+				out << " " << tsCommandName(code);
+			out << ", ran " << selected[s].count << " times\n";
+		}
+		out << "#define tsSUPERINSTRUCTION_COUNT " << selected.size() << "\n\n";
+
+		out << "// The commands each superinstruction runs\n";
+		out << "#define tsSUPERINSTRUCTION_SEQUENCES";
+		for (const tsSuperinstructionCandidate& c : selected)
+		{
+			out << " \\\n\t{";
+			for (tsByte code : c.sequence)
+				out << " ts" << tsCommandName(code) << ",";
+			out << " tsEND },";
+		}
+		out << "\n\n";
+
+		out << "// Appended to tsDISPATCH_LABELS by the bytecode interpreter\n";
+		out << "#define tsSUPERINSTRUCTION_LABELS";
+		for (size_t s = 0; s < selected.size(); s++)
+			out << (s % 4 == 0 ? " \\\n\t" : " ") << ", &&op_Superinstruction" << s;
+		out << "\n\n";
+
+		out << "#define tsSUPERINSTRUCTION_HANDLERS";
+		for (size_t s = 0; s < selected.size(); s++)
+		{
+			const std::vector<tsByte>& sequence = selected[s].sequence;
+			out << " \\\n\ttsCASE(Superinstruction" << s << ") \\\n\t{";
+			for (size_t c = 0; c + 1 < sequence.size(); c++)
+				out << " \\\n\t\t" << tsSuperinstructionStep(sequence[c]);
+			out << " \\\n\t\tif constexpr (counted) executed += " << sequence.size() - 1 << ";";
+			out << " \\\n\t} \\\n\t\tgoto op_" << tsCommandName(sequence.back()) << ";";
+		}
+		out << "\n";
+		return out.str();
+	}
+
+	// Pick superinstructions from a profile and write them to path, which should be src/tsSuperinstructions.h.
+	// The runtime has to be rebuilt for them to take effect.
+	inline bool tsWriteSuperinstructions(const tsOpcodeProfile& profile, size_t max, const std::string& path, std::string& error)
+	{
+		std::ofstream file(path);
+		if (!file)
+		{
+			error = "Could not open " + path;
+			return false;
+		}
+		file << tsGenerateSuperinstructions(tsSelectSuperinstructions(profile, max));
+		if (!file)
+		{
+			error = "Could not write " + path;
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,12 @@
+#pragma once
+// Generated by tsWriteSuperinstructions from an opcode profile, do not edit
+
+#define tsSUPERINSTRUCTION_COUNT 0
+
+// The commands each superinstruction runs
+#define tsSUPERINSTRUCTION_SEQUENCES
+
+// Appended to tsDISPATCH_LABELS by the bytecode interpreter
+#define tsSUPERINSTRUCTION_LABELS
+
+#define tsSUPERINSTRUCTION_HANDLERS
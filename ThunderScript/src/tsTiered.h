@@ -0,0 +1,207 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include "ThunderScript.h"
+#include "tsNative.h"
+
+namespace ts
+{
+	// When a script moves to a faster tier, it moves as soon as either its runs or its executed instructions pass the limit
+	struct tsTierThresholds
+	{
+		std::uint64_t decodedRuns = 16;
+		std::uint64_t decodedInstructions = 10000;
+		std::uint64_t nativeRuns = 10000;
+		std::uint64_t nativeInstructions = 10000000;
+		// Scripts stay on the decoded instructions if this is false
+		bool native = true;
+	};
+
+	// A native build of a script. The worker compiles its own copy of the script, so the build never touches the
+	// script in the context, which may move if other scripts are added while it runs.
+	struct tsPromotion
+	{
+		tsScript script;
+		tsIndex index = 0;
+		// entry and error are written before done is set
+		tsNativeEntry entry = nullptr;
+		std::string error;
+		std::atomic<bool> done = false;
+	};
+
+	// Owns the thread native builds run on. Builds are queued and run one at a time, the thread is joined when the
+	// promoter is destroyed after finishing the build it is working on, builds still queued are dropped.
+	class tsPromoter
+	{
+	private:
+		tsNativeCompiler& compiler;
+		std::mutex lock;
+		std::condition_variable wake;
+		std::deque<std::shared_ptr<tsPromotion>> queue;
+		bool stopping = false;
+		std::thread worker;
+
+		void run()
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (true)
+			{
+				wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+				if (stopping)
+					return;
+				std::shared_ptr<tsPromotion> promotion = queue.front();
+				queue.pop_front();
+				guard.unlock();
+				promotion->entry = compiler.compile(promotion->script, promotion->error);
+				promotion->done.store(true, std::memory_order_release);
+				guard.lock();
+			}
+		}
+
+	public:
+		tsPromoter(tsNativeCompiler& nativeCompiler = tsNativeCompiler::global()) : compiler(nativeCompiler)
+		{
+			worker = std::thread([this]() { run(); });
+		}
+		~tsPromoter()
+		{
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				stopping = true;
+			}
+			wake.notify_all();
+			worker.join();
+		}
+		tsPromoter(const tsPromoter&) = delete;
+		tsPromoter& operator=(const tsPromoter&) = delete;
+
+		// Queue a build of a copy of a script, check done on the result to see when it has finished
+		std::shared_ptr<tsPromotion> promote(const tsScript& script, tsIndex index)
+		{
+			std::shared_ptr<tsPromotion> promotion = std::make_shared<tsPromotion>();
+			promotion->script = script;
+			promotion->index = index;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				queue.push_back(promotion);
+			}
+			wake.notify_one();
+			return promotion;
+		}
+
+		// Shared by every tiered runtime. Getting the native compiler as the default argument constructs it first,
+		// so it is destroyed after the promoter has joined its thread at exit.
+		static tsPromoter& global()
+		{
+			static tsPromoter instance;
+			return instance;
+		}
+	};
+
+	// A runtime that starts cold scripts on the bytecode interpreter and promotes them as they get hot.
+	// Counters and tiers live on the script, so every tiered runtime running a script helps promote it.
+	// Native code is built on tsPromoter's thread and swapped in by the runtime that asked for it once it is ready,
+	// runs already in flight finish on the tier they started on.
+	class tsTieredRuntime : public tsRuntime
+	{
+	private:
+		tsTierThresholds thresholds;
+		// Build started by this runtime that it hasn't installed yet
+		std::shared_ptr<tsPromotion> promotion;
+
+		// Count a run on a tier that is still being profiled and promote the script if it is hot enough
+		void count(tsScript& script, tsTier tier, size_t executed)
+		{
+			std::uint64_t runs = script.runs.fetch_add(1, std::memory_order_relaxed) + 1;
+			std::uint64_t instructions = script.executedInstructions.fetch_add(executed, std::memory_order_relaxed) + executed;
+
+			if (tier == tsTier::tsBytecode)
+			{
+				if (runs >= thresholds.decodedRuns || instructions >= thresholds.decodedInstructions)
+				{
+					// The instructions were decoded when the script was loaded, so this only changes which interpreter runs
+					tsTier expected = tsTier::tsBytecode;
+					script.tier.compare_exchange_strong(expected, tsTier::tsDecoded, std::memory_order_acq_rel);
+				}
+			}
+			else if (thresholds.native && (runs >= thresholds.nativeRuns || instructions >= thresholds.nativeInstructions))
+			{
+				bool expected = false;
+				if (!promotion && script.promoting.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+					promotion = tsPromoter::global().promote(script, loadedScript);
+			}
+		}
+
+		// Switch the script to the build this runtime started if it has finished
+		void install()
+		{
+			if (!promotion || !promotion->done.load(std::memory_order_acquire))
+				return;
+			if (promotion->entry)
+				tsInstallNative(_context->scripts[promotion->index], promotion->entry);
+			else
+				tsLOG_WARNING("Could not promote script " << promotion->index << " to native code, staying in the interpreter: " << promotion->error);
+			promotion.reset();
+		}
+
+	public:
+		tsTieredRuntime(std::shared_ptr<tsContext>& context, tsTierThresholds tierThresholds = tsTierThresholds()) : tsRuntime(context), thresholds(tierThresholds)
+		{
+		}
+		// Nothing is left to install a build that is still running, so let another runtime start one.
+		// It will find the object this build leaves in the cache.
+		~tsTieredRuntime()
+		{
+			install();
+			if (promotion)
+				_context->scripts[promotion->index].promoting.store(false, std::memory_order_release);
+		}
+
+		tsTier tier() const
+		{
+			tsMASSERT(scriptLoaded, "No script loaded");
+			return _context->scripts[loadedScript].tier.load(std::memory_order_acquire);
+		}
+
+		void Run()
+		{
+			tsLOG_DEBUG("Running script: " << loadedScript);
+			Execute();
+		}
+
+		void Execute()
+		{
+			tsMASSERT(scriptLoaded, "No script loaded");
+			install();
+			// Only the interpreter can run with globals bound to host memory
+			if (bound())
+			{
+				tsRuntime::Execute();
+				return;
+			}
+			tsScript& script = _context->scripts[loadedScript];
+			tsTier tier = script.tier.load(std::memory_order_acquire);
+			switch (tier)
+			{
+				case tsTier::tsBytecode:
+					count(script, tier, tsExecuteByteCode<tsThreadedDispatch, true>(script.bytecode, instance.memory));
+					break;
+				case tsTier::tsDecoded:
+					// Stop counting once a native build has been started, whether or not it works out
+					if (script.promoting.load(std::memory_order_relaxed))
+						tsExecute(script, instance);
+					else if (script.verified)
+						count(script, tier, tsExecuteInstructions<tsThreadedDispatch, false, true>(script, instance.memory));
+					else
+						count(script, tier, tsExecuteInstructions<tsThreadedDispatch, true, true>(script, instance.memory));
+					break;
+				case tsTier::tsNative:
+					script.native.load(std::memory_order_acquire)(instance.memory.data());
+					break;
+			}
+		}
+	};
+}
@@ -0,0 +1,386 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cctype>
+#include "ThunderScript.h"
+
+namespace ts
+{
+	// How a slot of script memory is held in transpiled code
+	struct tsTranspiledSlot
+	{
+		// None if the slot is not used, or if it is used in ways that need it to stay in memory
+		tsVarType type = tsVarType::tsNone;
+		// The slot allocator shares slots between ints and floats whose values are never live at the same time. A
+		// shared slot gets an int and a float local that always hold the same bits.
+		bool shared = false;
+		bool local = false;
+		bool read = false;
+		bool written = false;
+	};
+
+	// Work out which slots can become typed locals. A slot is a local if every instruction that touches it agrees on
+	// its type or only uses it as an int and a float, every raw load or move of it is exactly that size and it does not
+	// overlap any other slot.
+	// Everything else is read and written in the instance memory.
+	inline std::vector<tsTranspiledSlot> tsTranspiledSlots(const tsScript& script)
+	{
+		std::vector<tsTranspiledSlot> slots(script.numBytes);
+		std::vector<bool> conflict(script.numBytes, false);
+		// Sizes of raw loads and moves, these have no type of their own
+		std::vector<std::vector<size_t>> rawSizes(script.numBytes);
+
+		auto use = [&](tsIndex index, tsVarType type) {
+			if (type == tsVarType::tsNone)
+				return;
+			if (slots[index].type == tsVarType::tsNone)
+				slots[index].type = type;
+			else if (slots[index].type != type)
+			{
+				// Only ints and floats have the same size
+				if (tsGetTypeSize(slots[index].type) == tsGetTypeSize(type))
+					slots[index].shared = true;
+				else
+					conflict[index] = true;
+			}
+		};
+		for (const tsGlobal& g : script.globals)
+			use(g.index, g.type);
+		for (const tsInstruction& i : script.instructions)
+		{
+			tsOperandTypes types = tsGetOperandTypes(i.code);
+			use(i.a, types.a);
+			use(i.b, types.b);
+			use(i.r, types.r);
+			if (types.a != tsVarType::tsNone)
+				slots[i.a].read = true;
+			if (types.b != tsVarType::tsNone)
+				slots[i.b].read = true;
+			if (types.r != tsVarType::tsNone)
+				slots[i.r].written = true;
+			if (i.code == tsMOVE)
+			{
+				slots[i.a].read = true;
+				rawSizes[i.a].push_back(i.b);
+				rawSizes[i.r].push_back(i.b);
+				slots[i.r].written = true;
+			}
+			else if (i.code == tsLOAD)
+			{
+				rawSizes[i.r].push_back(i.a);
+				slots[i.r].written = true;
+			}
+		}
+
+		// Which slot owns each byte, slots that share bytes have to stay in memory
+		std::vector<tsIndex> owner(script.numBytes, script.numBytes);
+		auto claim = [&](tsIndex index, size_t size) {
+			for (size_t b = index; b < index + size && b < script.numBytes; b++)
+			{
+				if (owner[b] != script.numBytes && owner[b] != index)
+				{
+					conflict[owner[b]] = true;
+					conflict[index] = true;
+				}
+				owner[b] = index;
+			}
+		};
+		for (tsIndex i = 0; i < script.numBytes; i++)
+		{
+			if (slots[i].type != tsVarType::tsNone)
+				claim(i, tsGetTypeSize(slots[i].type));
+			for (size_t size : rawSizes[i])
+			{
+				claim(i, size);
+				if (slots[i].type == tsVarType::tsNone || size != tsGetTypeSize(slots[i].type))
+					conflict[i] = true;
+			}
+		}
+		for (tsIndex i = 0; i < script.numBytes; i++)
+			slots[i].local = slots[i].type != tsVarType::tsNone && !conflict[i];
+		return slots;
+	}
+
+	inline const char* tsTranspiledType(tsVarType type)
+	{
+		switch (type)
+		{
+			case tsVarType::tsInt:
+				return "std::int32_t";
+			case tsVarType::tsFloat:
+				return "float";
+			case tsVarType::tsBool:
+				return "bool";
+			default:
+				return "void";
+		}
+	}
+
+	// Bump whenever the code tsTranspile generates changes, so objects built from older code are not reused
+	constexpr unsigned int tsTranspilerVersion = 3;
+
+	// Translate a verified script into a standalone C++ function named name, taking the base of an instance's memory.
+	// Slots become typed locals where possible and jumps become gotos, so the C++ compiler can optimize the script
+	// like any other code. The source also holds name_register(context, index) which installs the function as the
+	// native entry of that script, as long as the script still hashes the same as when it was transpiled.
+	// Define TS_AOT_NO_REGISTRATION to build the function on its own without ThunderScript.h.
+	inline bool tsTranspile(const tsScript& script, const std::string& name, std::string& source, std::string& error)
+	{
+		if (!script.verified || !script.prepared())
+		{
+			error = "Only loaded and verified scripts can be transpiled";
+			return false;
+		}
+		if (name.empty() || std::isdigit((unsigned char)name[0]) ||
+			!std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum((unsigned char)c) || c == '_'; }))
+		{
+			error = "\"" + name + "\" is not a valid C++ identifier";
+			return false;
+		}
+
+		std::vector<tsTranspiledSlot> slots = tsTranspiledSlots(script);
+		std::vector<bool> isTarget(script.instructions.size(), false);
+		for (const tsInstruction& i : script.instructions)
+			if (tsIsJump(i.code))
+				isTarget[i.imm.target] = true;
+
+		// Name of the local holding a slot as type
+		auto local = [&](tsIndex index, tsVarType type) {
+			std::string name = "s" + std::to_string(index);
+			if (slots[index].shared)
+				name += type == tsVarType::tsInt ? "i" : "f";
+			return name;
+		};
+		// Copy the bits of a shared slot's local of type to its other local, the C++ compiler drops the copy if the
+		// other local is not read before it is written again
+		auto sync = [&](tsIndex index, tsVarType type) {
+			if (!slots[index].shared)
+				return std::string();
+			tsVarType other = type == tsVarType::tsInt ? tsVarType::tsFloat : tsVarType::tsInt;
+			return " " + local(index, other) + " = tsAotCast<" + tsTranspiledType(other) + ">(" + local(index, type) + ");";
+		};
+		auto read = [&](tsIndex index, tsVarType type) {
+			if (slots[index].local)
+				return local(index, type);
+			return std::string("tsAotRead<") + tsTranspiledType(type) + ">(memory + " + std::to_string(index) + ")";
+		};
+		auto write = [&](tsIndex index, tsVarType type, const std::string& value) {
+			if (slots[index].local)
+				return local(index, type) + " = " + value + ";" + sync(index, type);
+			return std::string("tsAotWrite<") + tsTranspiledType(type) + ">(memory + " + std::to_string(index) + ", " + value + ");";
+		};
+		// A constant written out exactly, floats go through their bits so NaNs and infinities survive
+		auto literal = [](tsVarType type, const tsByte* bytes) {
+			if (type == tsVarType::tsFloat)
+			{
+				std::uint32_t bits;
+				std::memcpy(&bits, bytes, sizeof(bits));
+				std::ostringstream hex;
+				hex << "tsAotCast<float>(std::uint32_t(0x" << std::hex << bits << "u))";
+				return hex.str();
+			}
+			if (type == tsVarType::tsInt)
+			{
+				tsInt v;
+				std::memcpy(&v, bytes, sizeof(v));
+				return "std::int32_t(" + std::to_string(v) + ")";
+			}
+			return std::string(bytes[0] != tsByte(0) ? "true" : "false");
+		};
+		auto binary = [&](const tsInstruction& i, const char* op) {
+			tsOperandTypes types = tsGetOperandTypes(i.code);
+			std::string b = tsIsImmediate(i.code) ? literal(types.a, i.imm.bytes) : read(i.b, types.b);
+			return write(i.r, types.r, read(i.a, types.a) + " " + op + " " + b);
+		};
+		auto unary = [&](const tsInstruction& i, const std::string& op) {
+			tsOperandTypes types = tsGetOperandTypes(i.code);
+			return write(i.r, types.r, op + read(i.a, types.a));
+		};
+
+		std::ostringstream out;
+		out << "// Generated by the ThunderScript transpiler, do not edit\n";
+		out << "#include <cstddef>\n#include <cstdint>\n#include <cstring>\n\n";
+		out << "#ifndef TS_AOT_HELPERS\n#define TS_AOT_HELPERS\n";
+		out << "template<class T>\ninline T tsAotRead(const std::byte* p)\n{\n\tT v;\n\tstd::memcpy(&v, p, sizeof(T));\n\treturn v;\n}\n";
+		out << "template<class T>\ninline void tsAotWrite(std::byte* p, T v)\n{\n\tstd::memcpy(p, &v, sizeof(T));\n}\n";
+		out << "template<class T, class U>\ninline T tsAotCast(U v)\n{\n\tstatic_assert(sizeof(T) == sizeof(U), \"Size mismatch\");\n\tT r;\n\tstd::memcpy(&r, &v, sizeof(T));\n\treturn r;\n}\n";
+		out << "#endif\n\n";
+
+		out << "extern \"C\" void " << name << "(std::byte* memory)\n{\n";
+		// Only slots the code touches get a local, globals it never uses stay where they are
+		for (tsIndex s = 0; s < script.numBytes; s++)
+		{
+			if (!slots[s].local || (!slots[s].read && !slots[s].written))
+				continue;
+			for (tsVarType type : { tsVarType::tsInt, tsVarType::tsFloat, tsVarType::tsBool })
+				if (type == slots[s].type || (slots[s].shared && type != tsVarType::tsBool))
+					out << "\t" << tsTranspiledType(type) << " " << local(s, type) << " = tsAotRead<" << tsTranspiledType(type) << ">(memory + " << s << ");\n";
+		}
+		out << "\n";
+
+		for (size_t n = 0; n < script.instructions.size(); n++)
+		{
+			const tsInstruction& i = script.instructions[n];
+			if (isTarget[n])
+				out << "L" << n << ":\n";
+			out << "\t";
+			switch (i.code)
+			{
+				case tsEND:
+					out << "goto end;";
+					break;
+				case tsJUMP:
+					out << "goto L" << i.imm.target << ";";
+					break;
+				case tsJUMPF:
+					out << "if (!" << read(i.a, tsVarType::tsBool) << ") goto L" << i.imm.target << ";";
+					break;
+				case tsJUMPFLessI:
+				case tsJUMPFLessF:
+				case tsJUMPFLessEqualI:
+				case tsJUMPFLessEqualF:
+				case tsJUMPFEqualI:
+				case tsJUMPFEqualF:
+				{
+					tsByte comparison = tsJumpComparison(i.code);
+					const char* op = comparison == tsLessI || comparison == tsLessF ? "<" : comparison == tsEqualI || comparison == tsEqualF ? "==" : "<=";
+					tsOperandTypes types = tsGetOperandTypes(i.code);
+					out << "if (!(" << read(i.a, types.a) << " " << op << " " << read(i.b, types.b) << ")) goto L" << i.imm.target << ";";
+					break;
+				}
+				case tsLOAD:
+				{
+					if (slots[i.r].local)
+						out << write(i.r, slots[i.r].type, literal(slots[i.r].type, i.imm.bytes));
+					else
+					{
+						out << "{ const unsigned char v[] = { ";
+						for (tsIndex b = 0; b < i.a; b++)
+							out << (b ? ", " : "") << (unsigned int)i.imm.bytes[b];
+						out << " }; std::memcpy(memory + " << i.r << ", v, " << i.a << "); }";
+					}
+					break;
+				}
+				case tsMOVE:
+					if (slots[i.a].local && slots[i.r].local)
+					{
+						if (slots[i.a].type == slots[i.r].type)
+							out << write(i.r, slots[i.r].type, local(i.a, slots[i.a].type));
+						else
+							out << "std::memcpy(&" << local(i.r, slots[i.r].type) << ", &" << local(i.a, slots[i.a].type) << ", " << i.b << ");" << sync(i.r, slots[i.r].type);
+					}
+					else if (slots[i.a].local)
+						out << "std::memcpy(memory + " << i.r << ", &" << local(i.a, slots[i.a].type) << ", " << i.b << ");";
+					else if (slots[i.r].local)
+						out << "std::memcpy(&" << local(i.r, slots[i.r].type) << ", memory + " << i.a << ", " << i.b << ");" << sync(i.r, slots[i.r].type);
+					else
+						out << "std::memcpy(memory + " << i.r << ", memory + " << i.a << ", " << i.b << ");";
+					break;
+				case tsItoF:
+					out << unary(i, "(float)");
+					break;
+				case tsFtoI:
+					out << unary(i, "(std::int32_t)");
+					break;
+				case tsFLIPI:
+				case tsFLIPF:
+					out << unary(i, "-");
+					break;
+				case tsNOT:
+					out << unary(i, "!");
+					break;
+				case tsADDI:
+				case tsADDF:
+				case tsADDI_IMM:
+				case tsADDF_IMM:
+					out << binary(i, "+");
+					break;
+				case tsSUBI:
+				case tsSUBF:
+					out << binary(i, "-");
+					break;
+				case tsItoFADDF:
+					out << write(i.r, tsVarType::tsFloat, "(float)" + read(i.a, tsVarType::tsInt) + " + " + read(i.b, tsVarType::tsFloat));
+					break;
+				case tsMULI:
+				case tsMULF:
+				case tsMULI_IMM:
+				case tsMULF_IMM:
+					out << binary(i, "*");
+					break;
+				case tsDIVI:
+				case tsDIVF:
+				case tsDIVI_IMM:
+				case tsDIVF_IMM:
+					out << binary(i, "/");
+					break;
+				case tsAND:
+					out << binary(i, "&&");
+					break;
+				case tsOR:
+					out << binary(i, "||");
+					break;
+				case tsLessI:
+				case tsLessF:
+				case tsLessI_IMM:
+				case tsLessF_IMM:
+					out << binary(i, "<");
+					break;
+				case tsLessEqualI:
+				case tsLessEqualF:
+				case tsLessEqualI_IMM:
+				case tsLessEqualF_IMM:
+					out << binary(i, "<=");
+					break;
+				case tsEqualI:
+				case tsEqualF:
+				case tsEqualB:
+				case tsEqualI_IMM:
+				case tsEqualF_IMM:
+					out << binary(i, "==");
+					break;
+				default:
+					error = "Unknown byte code! " + std::to_string((unsigned int)i.code);
+					return false;
+			}
+			out << "\n";
+		}
+
+		// Locals only live for one run, anything written has to go back to the instance
+		out << "end:\n";
+		for (tsIndex s = 0; s < script.numBytes; s++)
+			if (slots[s].local && slots[s].written)
+				out << "\ttsAotWrite<" << tsTranspiledType(slots[s].type) << ">(memory + " << s << ", " << local(s, slots[s].type) << ");\n";
+		out << "\treturn;\n}\n\n";
+
+		out << "#ifndef TS_AOT_NO_REGISTRATION\n#include \"ThunderScript.h\"\n\n";
+		out << "// Run " << name << " in place of the interpreter for a script, returns false if the script has changed since it was transpiled\n";
+		out << "bool " << name << "_register(ts::tsContext& context, ts::tsIndex script)\n{\n";
+		out << "\tif (script >= context.scripts.size() || context.scripts[script].hash() != 0x" << std::hex << script.hash() << std::dec << "ull)\n";
+		out << "\t\treturn false;\n";
+		out << "\tcontext.scripts[script].native = &" << name << ";\n";
+		out << "\treturn true;\n}\n#endif\n";
+
+		source = out.str();
+		return true;
+	}
+
+	inline bool tsTranspileToFile(const tsScript& script, const std::string& name, const std::string& path, std::string& error)
+	{
+		std::string source;
+		if (!tsTranspile(script, name, source, error))
+			return false;
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			error = "Could not open " + path + " for writing";
+			return false;
+		}
+		file << source;
+		return true;
+	}
+}
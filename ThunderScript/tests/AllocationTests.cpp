@@ -0,0 +1,68 @@
+// The allocation hooks replace operator new for the whole test program, so they are defined here and nowhere else
+#define TS_ALLOCATION_HOOKS
+#include "tsTest.h"
+#include "tsAllocationGuard.h"
+#include "ThunderScript.h"
+
+namespace ts
+{
+	// while (0 < a) { a += -1; c += b; } with float a, b and c at 0, 4 and 8, bool cond at 12 and the constants 0 and -1
+	static tsScript LoopScript()
+	{
+		const tsIndex a = 0, b = 4, c = 8, cond = 12, zero = 16, minusOne = 20;
+		tsScript script;
+		script.numBytes = 24;
+		script.globals = {
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "a", a },
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "b", b },
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "c", c }
+		};
+		script.bytecode.LOAD(zero, 0.0f);
+		script.bytecode.LOAD(minusOne, -1.0f);
+		size_t loop = script.bytecode.bytes.size();
+		script.bytecode.pushCmd(tsLessF, zero, a, cond);
+		size_t exit = script.bytecode.JUMPF<tsVarType::tsBool, tsVarType::tsBool>(cond);
+		script.bytecode.pushCmd(tsADDF, a, minusOne, a);
+		script.bytecode.pushCmd(tsADDF, c, b, c);
+		script.bytecode.GOTO(loop);
+		script.bytecode.bytes.set<size_t>(exit, script.bytecode.bytes.size());
+		script.bytecode.pushCmd(tsEND);
+		return script;
+	}
+
+	tsTEST(AllocationGuardCountsEveryForm)
+	{
+		struct alignas(64) Wide { char bytes[64]; };
+		tsAllocationGuard guard("Allocating");
+		delete new int(1);
+		delete[] new int[4];
+		delete new Wide();
+		delete[] new Wide[2];
+		::operator delete(::operator new(8, std::nothrow), std::nothrow);
+		tsCHECK(guard.allocations() == 5);
+	}
+
+	// Once warmed up, reloading a script, setting its globals and running it must never touch the heap
+	tsTEST(RunDoesNotAllocate)
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		context->scripts.push_back(LoopScript());
+		tsRuntime runtime(context);
+		runtime.LoadScript(0);
+		tsGlobalHandle<tsFloat> a = runtime.ResolveGlobal<tsFloat>("a");
+		tsGlobalHandle<tsFloat> b = runtime.ResolveGlobal<tsFloat>("b");
+		tsGlobalHandle<tsFloat> c = runtime.ResolveGlobal<tsFloat>("c");
+		runtime.SetGlobal(a, 3.0f);
+		runtime.SetGlobal(b, 2.0f);
+		runtime.Run();
+
+		tsAllocationGuard guard("Reloading and running the script");
+		runtime.LoadScript(0);
+		runtime.SetGlobal(a, 4.0f);
+		runtime.SetGlobal(b, 2.0f);
+		runtime.SetGlobal(c, 0.0f);
+		runtime.Run();
+		tsCHECK(guard.check());
+		tsCHECK(runtime.GetGlobal(c) == 8.0f);
+	}
+}
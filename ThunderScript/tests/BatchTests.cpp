@@ -0,0 +1,263 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include "tsTest.h"
+#include "ThunderScript.h"
+#include "tsBatch.h"
+
+namespace ts
+{
+	// Memory of the scripts below: float a at 0, b at 4, c at 8, bool cond at 12, then the constants 0 and -1
+	static const tsIndex a = 0, b = 4, c = 8, cond = 12, zero = 16, minusOne = 20;
+
+	// Build a script by hand, the grammar can't produce jumps yet
+	static tsScript BuildScript(const std::function<void(tsBytecode&)>& body)
+	{
+		tsScript script;
+		script.numBytes = 24;
+		script.globals = {
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "a", a },
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "b", b },
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "c", c }
+		};
+		script.bytecode.LOAD(zero, 0.0f);
+		script.bytecode.LOAD(minusOne, -1.0f);
+		body(script.bytecode);
+		script.bytecode.pushCmd(tsEND);
+		std::string error;
+		tsCHECK(script.load(error));
+		return script;
+	}
+
+	static size_t CompareJump(tsBytecode& bytecode, tsByte code, tsIndex x, tsIndex y)
+	{
+		bytecode.bytes.pushBack(code);
+		bytecode.bytes.pushBack(x);
+		bytecode.bytes.pushBack(y);
+		size_t target = bytecode.bytes.size();
+		bytecode.bytes.pushBack((size_t)0);
+		return target;
+	}
+
+	// Give every lane different floats in a, b and c
+	static void SetFloatLane(tsInstance& instance, size_t l)
+	{
+		instance.memory.set<tsFloat>(a, (tsFloat)(l % 97));
+		instance.memory.set<tsFloat>(b, (tsFloat)l * 0.5f);
+		instance.memory.set<tsFloat>(c, 1.0f);
+	}
+
+	// Run a script over a batch whose lanes all take a different number of iterations and check that every lane
+	// ends up the same as running it on its own instance
+	static void CheckLanesMatchScalar(const tsScript& script, size_t lanes = 300,
+		const std::function<void(tsInstance&, size_t)>& setLane = SetFloatLane)
+	{
+		std::vector<const tsBatchKernels*> kernels = { &tsScalarKernels(), &tsGetBatchKernels() };
+		// Shared by every run, so its buffers are reused from one to the next
+		tsBatchContext context;
+		for (const tsBatchKernels* k : kernels)
+		{
+			tsBatch batch(script, lanes);
+			std::vector<tsInstance> instances(lanes, tsInstance(script));
+			for (size_t l = 0; l < lanes; l++)
+			{
+				setLane(instances[l], l);
+				batch.setLane(l, instances[l]);
+			}
+			for (tsInstance& instance : instances)
+				tsExecute(script, instance);
+			tsExecuteBatch(script, batch, context, *k);
+
+			size_t mismatched = 0;
+			tsInstance lane(script);
+			for (size_t l = 0; l < lanes; l++)
+			{
+				batch.getLane(l, lane);
+				for (const tsGlobal& g : script.globals)
+					if (g.type == tsVarType::tsInt ? lane.memory.read<tsInt>(g.index) != instances[l].memory.read<tsInt>(g.index) :
+						lane.memory.read<tsFloat>(g.index) != instances[l].memory.read<tsFloat>(g.index))
+						mismatched++;
+			}
+			if (!tsCHECK(mismatched == 0))
+				std::cout << "  " << mismatched << " globals differ with " << k->name << " kernels" << std::endl;
+		}
+	}
+
+	// while (0 < a) { a += -1; c += b; } c *= -1
+	// Lanes that leave the loop wait a short way ahead under a mask while the rest carry on
+	tsTEST(BatchMasksShortForwardJumps)
+	{
+		CheckLanesMatchScalar(BuildScript([](tsBytecode& bytecode) {
+			size_t loop = bytecode.bytes.size();
+			bytecode.pushCmd(tsLessF, zero, a, cond);
+			size_t exit = bytecode.JUMPF<tsVarType::tsBool, tsVarType::tsBool>(cond);
+			bytecode.pushCmd(tsADDF, a, minusOne, a);
+			bytecode.pushCmd(tsADDF, c, b, c);
+			bytecode.GOTO(loop);
+			bytecode.bytes.set<size_t>(exit, bytecode.bytes.size());
+			bytecode.pushCmd(tsMULF, c, minusOne, c);
+		}));
+	}
+
+	// do { a += -1; c += b; } while (a < 0 is false); c += c
+	// Every iteration the lanes that go round again jump backwards and are split off into a batch of their own
+	tsTEST(BatchSplitsBackwardJumps)
+	{
+		CheckLanesMatchScalar(BuildScript([](tsBytecode& bytecode) {
+			size_t loop = bytecode.bytes.size();
+			bytecode.pushCmd(tsADDF, a, minusOne, a);
+			bytecode.pushCmd(tsADDF, c, b, c);
+			bytecode.pushCmd(tsLessF, a, zero, cond);
+			size_t back = bytecode.JUMPF<tsVarType::tsBool, tsVarType::tsBool>(cond);
+			bytecode.bytes.set<size_t>(back, loop);
+			bytecode.pushCmd(tsADDF, c, c, c);
+		}));
+	}
+
+	// The same loop ending in a compare jump instead of a tsJUMPF
+	tsTEST(BatchSplitsBackwardCompareJumps)
+	{
+		CheckLanesMatchScalar(BuildScript([](tsBytecode& bytecode) {
+			size_t loop = bytecode.bytes.size();
+			bytecode.pushCmd(tsADDF, a, minusOne, a);
+			bytecode.pushCmd(tsADDF, c, b, c);
+			size_t back = CompareJump(bytecode, tsJUMPFLessF, a, zero);
+			bytecode.bytes.set<size_t>(back, loop);
+			bytecode.pushCmd(tsADDF, c, c, c);
+		}));
+	}
+
+	// if (a < b) { c += c, many times } else c *= -1
+	// The taken branch is too long to mask, so the lanes that skip it are split off
+	tsTEST(BatchSplitsFarForwardJumps)
+	{
+		CheckLanesMatchScalar(BuildScript([](tsBytecode& bytecode) {
+			size_t otherwise = CompareJump(bytecode, tsJUMPFLessF, a, b);
+			for (size_t i = 0; i < tsBatchMaskDistance + 8; i++)
+				bytecode.pushCmd(tsADDF, c, c, c);
+			size_t skip = bytecode.bytes.size();
+			bytecode.GOTO(0);
+			bytecode.bytes.set<size_t>(otherwise, bytecode.bytes.size());
+			bytecode.pushCmd(tsMULF, c, minusOne, c);
+			bytecode.bytes.set<size_t>(skip + 1, bytecode.bytes.size());
+		}));
+	}
+
+	// if (y == 0) r = 0; else r = x / y; with int x, y and r in place of a, b and c
+	// Lanes dividing by 0 are masked off while the others divide, the kernels must not trap on them
+	tsTEST(BatchMaskedDivideByZeroDoesNotTrap)
+	{
+		tsScript script;
+		script.numBytes = 24;
+		script.globals = {
+			{ tsVarType::tsInt, tsGlobal::GlobalType::tsRef, "x", a },
+			{ tsVarType::tsInt, tsGlobal::GlobalType::tsRef, "y", b },
+			{ tsVarType::tsInt, tsGlobal::GlobalType::tsRef, "r", c }
+		};
+		script.bytecode.LOAD(zero, (tsInt)0);
+		script.bytecode.pushCmd(tsEqualI, b, zero, cond);
+		size_t otherwise = script.bytecode.JUMPF<tsVarType::tsBool, tsVarType::tsBool>(cond);
+		script.bytecode.LOAD(c, (tsInt)0);
+		size_t skip = script.bytecode.bytes.size();
+		script.bytecode.GOTO(0);
+		script.bytecode.bytes.set<size_t>(otherwise, script.bytecode.bytes.size());
+		script.bytecode.pushCmd(tsDIVI, a, b, c);
+		script.bytecode.bytes.set<size_t>(skip + 1, script.bytecode.bytes.size());
+		script.bytecode.pushCmd(tsEND);
+		std::string error;
+		tsCHECK(script.load(error));
+
+		// Every third lane takes the y == 0 branch
+		CheckLanesMatchScalar(script, 301, [](tsInstance& instance, size_t l) {
+			instance.memory.set<tsInt>(a, (tsInt)l * 7 - 1000);
+			instance.memory.set<tsInt>(b, l % 3 == 0 ? 0 : (tsInt)(l % 11) - 12);
+			instance.memory.set<tsInt>(c, -1);
+		});
+	}
+
+	// Values every operand of a type is tried with, as their bits. Ints stay small enough that no command overflows.
+	static std::vector<std::uint32_t> KernelInputs(tsVarType type)
+	{
+		std::vector<std::uint32_t> bits;
+		if (type == tsVarType::tsInt)
+			for (tsInt v : { 0, 1, -1, 7, -13, 1000, 46340, -46341 })
+				bits.push_back((std::uint32_t)v);
+		else if (type == tsVarType::tsFloat)
+			for (tsFloat v : { 0.0f, -0.0f, 1.0f, -1.5f, 3.25f, 1e30f, -1e-30f, INFINITY, -INFINITY, NAN })
+			{
+				std::uint32_t b;
+				std::memcpy(&b, &v, sizeof(b));
+				bits.push_back(b);
+			}
+		else
+			bits = { 0, 1 };
+		return bits;
+	}
+
+	// Every SSE2 and AVX2 kernel must give the same lanes as the scalar one, on lane counts that don't fill a vector and
+	// on NaNs, signed zeros and infinities. Lanes past the count are padding the vector kernels may write but nobody reads.
+	tsTEST(VectorKernelsMatchScalar)
+	{
+	#if TS_BATCH_SIMD
+		std::vector<const tsBatchKernels*> tables = { &tsSse2Kernels() };
+		if (tsCpuSupportsAvx2())
+			tables.push_back(&tsAvx2Kernels());
+		else
+			std::cout << "  no AVX2 on this cpu, only checking SSE2" << std::endl;
+
+		// Room for the most lanes below, padded the way tsBatch pads them
+		constexpr size_t capacity = 320;
+		alignas(tsBatch::alignment) static std::uint32_t a[capacity], b[capacity], expected[capacity], result[capacity];
+		auto put = [](std::uint32_t* values, size_t l, tsVarType type, std::uint32_t bits) {
+			if (type == tsVarType::tsBool)
+				reinterpret_cast<tsByte*>(values)[l] = (tsByte)bits;
+			else
+				values[l] = bits;
+		};
+		auto same = [](const std::uint32_t* x, const std::uint32_t* y, size_t l, tsVarType type) {
+			if (type == tsVarType::tsBool)
+				return reinterpret_cast<const tsByte*>(x)[l] == reinterpret_cast<const tsByte*>(y)[l];
+			tsFloat fx, fy;
+			std::memcpy(&fx, x + l, sizeof(fx));
+			std::memcpy(&fy, y + l, sizeof(fy));
+			return x[l] == y[l] || (type == tsVarType::tsFloat && std::isnan(fx) && std::isnan(fy));
+		};
+
+		size_t mismatched = 0;
+		for (size_t c = 0; c < tsCommandCount; c++)
+		{
+			tsBatchKernel scalar = tsScalarKernels().ops[c];
+			if (!scalar)
+				continue;
+			tsOperandTypes types = tsGetOperandTypes((tsByte)c);
+			std::vector<std::uint32_t> as = KernelInputs(types.a), bs = KernelInputs(types.b);
+			// Lanes dividing by 0 are masked off, what each kernel leaves in them doesn't matter
+			if ((tsByte)c == tsDIVI)
+				bs.erase(bs.begin());
+			for (size_t lanes : { 1, 3, 17, 63, 101, 257 })
+			{
+				std::memset(a, 0, sizeof(a));
+				std::memset(b, 0, sizeof(b));
+				for (size_t l = 0; l < lanes; l++)
+				{
+					put(a, l, types.a, as[l % as.size()]);
+					put(b, l, types.b, bs[l / as.size() % bs.size()]);
+				}
+				const tsByte* pa = reinterpret_cast<const tsByte*>(a);
+				const tsByte* pb = reinterpret_cast<const tsByte*>(b);
+				scalar(pa, pb, reinterpret_cast<tsByte*>(expected), lanes);
+				for (const tsBatchKernels* table : tables)
+				{
+					std::memset(result, 0, sizeof(result));
+					table->ops[c](pa, pb, reinterpret_cast<tsByte*>(result), lanes);
+					for (size_t l = 0; l < lanes; l++)
+						if (!same(expected, result, l, types.r) && mismatched++ < 10)
+							std::cout << "  " << table->name << " " << tsCommandName((tsByte)c) << " differs in lane " << l << " of " << lanes << std::endl;
+				}
+			}
+		}
+		tsCHECK(mismatched == 0);
+	#endif
+	}
+}
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include "tsTest.h"
+#include "ThunderScript.h"
+#include "ThunderScriptCompiler.h"
+
+namespace ts
+{
+	// Compile source with the default passes and return the instructions it lowered to, without the final tsEND
+	static std::vector<tsInstruction> Compile(std::shared_ptr<tsContext>& context, std::string source)
+	{
+		tsCompiler compiler(context);
+		if (!tsCHECK(compiler.compile(source)))
+			return {};
+		std::vector<tsInstruction> code = tsDecode(context->scripts.back().bytecode);
+		if (!code.empty() && code.back().code == tsEND)
+			code.pop_back();
+		return code;
+	}
+
+	// Run the last compiled script with x set and return r
+	static tsInt Run(std::shared_ptr<tsContext>& context, tsInt x)
+	{
+		tsRuntime runtime(context);
+		runtime.LoadScript((tsIndex)context->scripts.size() - 1);
+		runtime.SetGlobal<tsInt>("x", x);
+		runtime.Run();
+		return runtime.GetGlobal<tsInt>("r");
+	}
+
+	tsTEST(LiteralAdditionFoldsToOneLoad)
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		std::vector<tsInstruction> code = Compile(context, "#ref int x\n#ref int r\nint tB = 3 + 4;\nr = tB;\n");
+		if (tsCHECK(code.size() == 1))
+		{
+			tsCHECK(code[0].code == tsLOAD);
+			tsCHECK(tsImmediate<tsInt>(code[0]) == 7);
+		}
+		tsCHECK(Run(context, 0) == 7);
+	}
+
+	tsTEST(AddingZeroIsOneMove)
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		std::vector<tsInstruction> code = Compile(context, "#ref int x\n#ref int r\nr = x + 0;\n");
+		if (tsCHECK(code.size() == 1))
+			tsCHECK(code[0].code == tsMOVE);
+		tsCHECK(Run(context, 5) == 5);
+	}
+
+	tsTEST(SubtractingFromZeroIsOneFlip)
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		std::vector<tsInstruction> code = Compile(context, "#ref int x\n#ref int r\nr = 0 - x;\n");
+		if (tsCHECK(code.size() == 1))
+			tsCHECK(code[0].code == tsFLIPI);
+		tsCHECK(Run(context, 5) == -5);
+	}
+
+	// Compile a script file with or without the IR passes and without superinstructions, so instruction counts only
+	// show what the passes did
+	static std::shared_ptr<tsContext> CompileFile(const std::string& path, bool optimize)
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		tsCompiler compiler(context);
+		compiler.optimize = optimize;
+		compiler.superinstructions = false;
+		tsCHECK(compiler.compileFile(path));
+		return context;
+	}
+
+	static size_t InstructionCount(const tsScript& script)
+	{
+		size_t count = 0;
+		for (size_t cursor = 0; cursor < script.bytecode.bytes.size(); cursor += tsInstructionSize(script.bytecode.bytes, cursor))
+			count++;
+		return count;
+	}
+
+	tsTEST(HelloWorldShrinksAndKeepsItsResult)
+	{
+		std::shared_ptr<tsContext> contexts[2] = { CompileFile("scripts/HelloWorld.thun", false), CompileFile("scripts/HelloWorld.thun", true) };
+		if (!tsCHECK(!contexts[0]->scripts.empty() && !contexts[1]->scripts.empty()))
+			return;
+		tsCHECK(InstructionCount(contexts[0]->scripts[0]) == 9);
+		tsCHECK(InstructionCount(contexts[1]->scripts[0]) == 6);
+		tsCHECK(contexts[0]->scripts[0].numBytes == 41);
+		tsCHECK(contexts[1]->scripts[0].numBytes == 29);
+		for (std::shared_ptr<tsContext>& context : contexts)
+		{
+			tsRuntime runtime(context);
+			runtime.LoadScript(0);
+			runtime.SetGlobal<tsFloat>("a", 2.0f);
+			runtime.SetGlobal<tsFloat>("b", 3.0f);
+			runtime.Run();
+			tsCHECK(runtime.GetGlobal<tsFloat>("c") == 10.0f);
+		}
+	}
+
+	tsTEST(ArithmeticShrinksAndKeepsItsResults)
+	{
+		std::shared_ptr<tsContext> contexts[2] = { CompileFile("scripts/Arithmetic.thun", false), CompileFile("scripts/Arithmetic.thun", true) };
+		if (!tsCHECK(!contexts[0]->scripts.empty() && !contexts[1]->scripts.empty()))
+			return;
+		tsCHECK(InstructionCount(contexts[0]->scripts[0]) == 47);
+		tsCHECK(InstructionCount(contexts[1]->scripts[0]) == 38);
+		tsCHECK(contexts[0]->scripts[0].numBytes == 68);
+		tsCHECK(contexts[1]->scripts[0].numBytes == 36);
+
+		// The passes only remove work, so both builds must leave every global the same
+		tsRuntime runtimes[2] = { tsRuntime(contexts[0]), tsRuntime(contexts[1]) };
+		for (tsRuntime& runtime : runtimes)
+		{
+			runtime.LoadScript(0);
+			runtime.SetGlobal<tsFloat>("a", 1.5f);
+			runtime.SetGlobal<tsFloat>("b", 2.25f);
+			runtime.SetGlobal<tsFloat>("c", -0.5f);
+			runtime.SetGlobal<tsInt>("d", 3);
+			runtime.SetGlobal<tsInt>("e", 4);
+			runtime.Run();
+		}
+		for (const char* name : { "a", "b", "c" })
+			tsCHECK(runtimes[0].GetGlobal<tsFloat>(name) == runtimes[1].GetGlobal<tsFloat>(name));
+		for (const char* name : { "d", "e" })
+			tsCHECK(runtimes[0].GetGlobal<tsInt>(name) == runtimes[1].GetGlobal<tsInt>(name));
+	}
+
+	static size_t CountCommand(const std::vector<tsInstruction>& code, tsByte command)
+	{
+		return (size_t)std::count_if(code.begin(), code.end(), [command](const tsInstruction& i) { return i.code == command; });
+	}
+
+	tsTEST(RepeatedExpressionsAreComputedOnce)
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		std::vector<tsInstruction> code = Compile(context, "#ref int x\n#ref int r\nint t = x + 1;\nint u = x + 1;\nr = t - u;\n");
+		tsCHECK(CountCommand(code, tsADDI_IMM) == 1);
+		tsCHECK(Run(context, 5) == 0);
+	}
+
+	// y may be bound to the same memory as x, so x + 1 has to be worked out again once y is written
+	tsTEST(WritingAGlobalForgetsEveryGlobal)
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		std::vector<tsInstruction> code = Compile(context, "#in int x\n#ref int y\n#ref int r\nint t = x + 1;\ny = 2;\nint u = x + 1;\nr = t - u;\n");
+		tsCHECK(CountCommand(code, tsADDI_IMM) == 2);
+
+		tsRuntime runtime(context);
+		runtime.LoadScript(0);
+		tsInt shared = 5;
+		tsCHECK(runtime.BindGlobal(runtime.ResolveGlobal<tsInt>("x"), &shared));
+		tsCHECK(runtime.BindGlobal(runtime.ResolveGlobal<tsInt>("y"), &shared));
+		runtime.Run();
+		tsCHECK(runtime.GetGlobal<tsInt>("r") == 3);
+	}
+
+	// Run the last compiled script with x and y bound to the same int, z set to 0, and return r and the shared int
+	static std::pair<tsInt, tsInt> RunAliased(std::shared_ptr<tsContext>& context, tsInt shared)
+	{
+		tsRuntime runtime(context);
+		runtime.LoadScript((tsIndex)context->scripts.size() - 1);
+		runtime.SetGlobal<tsInt>("z", 0);
+		tsCHECK(runtime.BindGlobal(runtime.ResolveGlobal<tsInt>("x"), &shared));
+		tsCHECK(runtime.BindGlobal(runtime.ResolveGlobal<tsInt>("y"), &shared));
+		runtime.Run();
+		return { runtime.GetGlobal<tsInt>("r"), shared };
+	}
+
+	// Compile source with and without the passes and check both agree when x and y share their memory
+	static void CheckAliasedGlobals(const std::string& source, tsInt r, tsInt shared)
+	{
+		for (bool optimize : { false, true })
+		{
+			std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+			tsCompiler compiler(context);
+			compiler.optimize = optimize;
+			std::string text = source;
+			if (!tsCHECK(compiler.compile(text)))
+				continue;
+			std::pair<tsInt, tsInt> result = RunAliased(context, 7);
+			tsCHECK(result.first == r);
+			tsCHECK(result.second == shared);
+		}
+	}
+
+	// Copy propagation must not read t in place of x once y, which may be x, has been written
+	tsTEST(WritingAGlobalDropsCopiesOfGlobals)
+	{
+		CheckAliasedGlobals("#ref int x\n#ref int y\n#ref int z\n#ref int r\nint t = z + 1;\nx = t;\ny = 2;\nr = x + t;\n", 3, 2);
+	}
+
+	// The write to x must stay after the write to y
+	tsTEST(MovesIntoGlobalsStayAfterOtherGlobalWrites)
+	{
+		CheckAliasedGlobals("#ref int x\n#ref int y\n#ref int z\n#ref int r\nint t = z + 1;\ny = 2;\nx = t;\nr = 0;\n", 0, 1);
+	}
+
+	// A constant stored in x is no longer known once y is written
+	tsTEST(WritingAGlobalForgetsKnownGlobals)
+	{
+		CheckAliasedGlobals("#ref int x\n#ref int y\n#ref int z\n#ref int r\nx = 5;\ny = 2;\nr = x + 0;\n", 2, 2);
+	}
+
+	// The first write to x is read through y, so it is not dead
+	tsTEST(ReadingAGlobalKeepsEveryGlobalLive)
+	{
+		CheckAliasedGlobals("#ref int x\n#ref int y\n#ref int z\n#ref int r\nx = 5;\nr = y + 0;\nx = 3;\n", 5, 3);
+	}
+
+	// Run Arithmetic on its decoded instructions or its raw bytecode and return every global
+	static std::vector<tsFloat> RunArithmetic(std::shared_ptr<tsContext>& context, tsIndex script, bool decoded)
+	{
+		tsRuntime runtime(context);
+		runtime.LoadScript(script);
+		runtime.SetGlobal<tsFloat>("a", 1.5f);
+		runtime.SetGlobal<tsFloat>("b", 2.25f);
+		runtime.SetGlobal<tsFloat>("c", -0.5f);
+		runtime.SetGlobal<tsInt>("d", 3);
+		runtime.SetGlobal<tsInt>("e", 4);
+		if (decoded)
+			runtime.Execute<tsThreadedDispatch, true>();
+		else
+			runtime.Execute<tsThreadedDispatch, false>();
+		return { runtime.GetGlobal<tsFloat>("a"), runtime.GetGlobal<tsFloat>("b"), runtime.GetGlobal<tsFloat>("c"),
+			(tsFloat)runtime.GetGlobal<tsInt>("d"), (tsFloat)runtime.GetGlobal<tsInt>("e") };
+	}
+
+	// Fused and generated superinstructions only change how a script is dispatched, never what it computes.
+	// The checked in set of generated ones is empty, a set generated in its place is run the same way.
+	// The IR passes leave nothing to fuse in Arithmetic, so they are off.
+	tsTEST(SuperinstructionsKeepResults)
+	{
+		std::shared_ptr<tsContext> plain = CompileFile("scripts/Arithmetic.thun", false);
+		if (!tsCHECK(!plain->scripts.empty()))
+			return;
+		std::vector<tsFloat> expected = RunArithmetic(plain, 0, true);
+		tsCHECK(RunArithmetic(plain, 0, false) == expected);
+
+		for (bool generated : { false, true })
+		{
+			std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+			tsCompiler compiler(context);
+			compiler.optimize = false;
+			compiler.generatedSuperinstructions = generated;
+			if (!tsCHECK(compiler.compileFile("scripts/Arithmetic.thun")))
+				continue;
+			tsCHECK(InstructionCount(context->scripts[0]) < InstructionCount(plain->scripts[0]));
+			tsCHECK(RunArithmetic(context, 0, true) == expected);
+			tsCHECK(RunArithmetic(context, 0, false) == expected);
+		}
+
+		// Applying the generated set only swaps command bytes, so the script keeps its size and still loads
+		tsScript script = plain->scripts[0];
+		size_t applied = tsApplySuperinstructions(script.bytecode);
+		tsCHECK(tsSuperinstructionCount > 0 || applied == 0);
+		tsCHECK(script.bytecode.bytes.size() == plain->scripts[0].bytecode.bytes.size());
+		std::string error;
+		if (!tsCHECK(script.load(error)))
+			return;
+		plain->scripts.push_back(script);
+		tsCHECK(RunArithmetic(plain, 1, true) == expected);
+		tsCHECK(RunArithmetic(plain, 1, false) == expected);
+	}
+}
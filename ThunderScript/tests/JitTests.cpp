@@ -0,0 +1,155 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "tsTest.h"
+#include "ThunderScript.h"
+#include "tsJit.h"
+
+namespace ts
+{
+	// Values every operand of a type is tried with, as their bits. Ints stay small enough that no command overflows.
+	static std::vector<std::uint32_t> JitInputs(tsVarType type)
+	{
+		std::vector<std::uint32_t> bits;
+		if (type == tsVarType::tsInt)
+			for (tsInt v : { 0, 1, -1, 7, -13, 1000, 46340, -46341 })
+				bits.push_back((std::uint32_t)v);
+		else if (type == tsVarType::tsFloat)
+			for (tsFloat v : { 0.0f, -0.0f, 1.0f, -1.5f, 3.25f, 1e30f, -1e-30f, INFINITY, -INFINITY, NAN })
+			{
+				std::uint32_t b;
+				std::memcpy(&b, &v, sizeof(b));
+				bits.push_back(b);
+			}
+		else if (type == tsVarType::tsBool)
+			bits = { 0, 1 };
+		else
+			bits = { 0 };
+		return bits;
+	}
+
+	static void SetBits(tsRuntime& runtime, const char* name, tsVarType type, std::uint32_t bits)
+	{
+		tsInt i = (tsInt)bits;
+		tsFloat f;
+		std::memcpy(&f, &bits, sizeof(f));
+		if (type == tsVarType::tsInt)
+			runtime.SetGlobal<tsInt>(name, i);
+		else if (type == tsVarType::tsFloat)
+			runtime.SetGlobal<tsFloat>(name, f);
+		else if (type == tsVarType::tsBool)
+			runtime.SetGlobal<tsBool>(name, bits != 0);
+	}
+
+	// Whether both runtimes left the same value in a global, any two NaNs count as the same
+	static bool SameGlobal(tsRuntime& a, tsRuntime& b, const char* name, tsVarType type)
+	{
+		if (type == tsVarType::tsInt)
+			return a.GetGlobal<tsInt>(name) == b.GetGlobal<tsInt>(name);
+		if (type == tsVarType::tsBool)
+			return a.GetGlobal<tsBool>(name) == b.GetGlobal<tsBool>(name);
+		tsFloat x = a.GetGlobal<tsFloat>(name), y = b.GetGlobal<tsFloat>(name);
+		return (std::isnan(x) && std::isnan(y)) || std::memcmp(&x, &y, sizeof(x)) == 0;
+	}
+
+	// One command reading x at 0 and y at 4 and writing r at 8. Immediate forms use constant in place of y, and
+	// jumps set the int r to 1 when they fall through.
+	static tsScript CommandScript(tsByte code, std::uint32_t constant)
+	{
+		tsOperandTypes types = tsGetOperandTypes(code);
+		tsScript script;
+		script.numBytes = 12;
+		script.globals.push_back({ types.a, tsGlobal::GlobalType::tsRef, "x", 0 });
+		if (types.b != tsVarType::tsNone)
+			script.globals.push_back({ types.b, tsGlobal::GlobalType::tsRef, "y", 4 });
+		script.globals.push_back({ tsIsJump(code) ? tsVarType::tsInt : types.r, tsGlobal::GlobalType::tsRef, "r", 8 });
+
+		tsBytecode& bytecode = script.bytecode;
+		if (tsIsJump(code))
+		{
+			bytecode.bytes.pushBack(code);
+			bytecode.bytes.pushBack((tsIndex)0);
+			if (types.b != tsVarType::tsNone)
+				bytecode.bytes.pushBack((tsIndex)4);
+			size_t target = bytecode.bytes.size();
+			bytecode.bytes.pushBack((size_t)0);
+			bytecode.LOAD(8, (tsInt)1);
+			bytecode.bytes.set<size_t>(target, bytecode.bytes.size());
+		}
+		else if (tsIsImmediate(code))
+			bytecode.pushImmediate(code, 0, constant, 8);
+		else if (types.b == tsVarType::tsNone)
+			bytecode.pushCmd(code, 0, 8);
+		else
+			bytecode.pushCmd(code, 0, 4, 8);
+		bytecode.pushCmd(tsEND);
+		std::string error;
+		tsCHECK(script.load(error));
+		return script;
+	}
+
+	// Inputs the interpreter itself has no defined result for
+	static bool Undefined(tsByte code, std::uint32_t a, std::uint32_t b)
+	{
+		if (code == tsDIVI || code == tsDIVI_IMM)
+			return b == 0;
+		if (code == tsFtoI)
+		{
+			tsFloat f;
+			std::memcpy(&f, &a, sizeof(f));
+			return !(f >= -2147483648.0f && f < 2147483648.0f);
+		}
+		return false;
+	}
+
+	// Run every command but the ones that only move data or end the script through the JIT and the interpreter on the
+	// same inputs, NaNs, signed zeros and infinities included, and check they agree
+	tsTEST(JitMatchesTheInterpreterForEveryCommand)
+	{
+	#if TS_JIT
+		size_t mismatched = 0;
+		for (size_t c = 0; c < tsCommandCount; c++)
+		{
+			tsByte code = (tsByte)c;
+			if (code == tsEND || code == tsJUMP || code == tsLOAD || code == tsMOVE)
+				continue;
+			tsOperandTypes types = tsGetOperandTypes(code);
+			tsVarType r = tsIsJump(code) ? tsVarType::tsInt : types.r;
+			bool immediate = tsIsImmediate(code);
+			// Immediate forms take their constant from the script, so they get a script for every constant
+			for (std::uint32_t constant : JitInputs(immediate ? types.a : tsVarType::tsNone))
+			{
+				std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+				context->scripts.push_back(CommandScript(code, constant));
+				tsRuntime interpreter(context);
+				tsJitRuntime jit(context);
+				interpreter.LoadScript(0);
+				jit.LoadScript(0);
+				if (!tsCHECK(jit.compiled()))
+				{
+					std::cout << "  the JIT could not compile " << tsCommandName(code) << std::endl;
+					continue;
+				}
+				for (std::uint32_t x : JitInputs(types.a))
+					for (std::uint32_t y : JitInputs(types.b))
+					{
+						if (Undefined(code, x, immediate ? constant : y))
+							continue;
+						for (tsRuntime* runtime : { &interpreter, (tsRuntime*)&jit })
+						{
+							SetBits(*runtime, "x", types.a, x);
+							SetBits(*runtime, "y", types.b, y);
+							SetBits(*runtime, "r", r, 0);
+						}
+						interpreter.Run();
+						jit.Run();
+						if (!SameGlobal(interpreter, jit, "r", r) && mismatched++ < 10)
+							std::cout << "  " << tsCommandName(code) << " differs on 0x" << std::hex << x << ", 0x" <<
+								(immediate ? constant : y) << std::dec << std::endl;
+					}
+			}
+		}
+		tsCHECK(mismatched == 0);
+	#endif
+	}
+}
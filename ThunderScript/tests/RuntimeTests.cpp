@@ -0,0 +1,172 @@
+#include <cstddef>
+#include <cstring>
+#include "tsTest.h"
+#include "ThunderScript.h"
+
+namespace ts
+{
+	// c = a + b on floats, with a, b and c at 0, 4 and 8
+	static tsScript AddScript()
+	{
+		tsScript script;
+		script.numBytes = 12;
+		script.globals = {
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "a", 0 },
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "b", 4 },
+			{ tsVarType::tsFloat, tsGlobal::GlobalType::tsRef, "c", 8 }
+		};
+		script.bytecode.pushCmd(tsADDF, 0, 4, 8);
+		script.bytecode.pushCmd(tsEND);
+		return script;
+	}
+
+	static std::shared_ptr<tsContext> AddContext()
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		context->scripts.push_back(AddScript());
+		context->scripts.push_back(AddScript());
+		return context;
+	}
+
+	tsTEST(GlobalHandlesReadAndWriteTheirGlobal)
+	{
+		std::shared_ptr<tsContext> context = AddContext();
+		tsRuntime runtime(context);
+		tsCHECK(runtime.LoadScript(0));
+		tsGlobalHandle<tsFloat> a = runtime.ResolveGlobal<tsFloat>("a");
+		tsGlobalHandle<tsFloat> b = runtime.ResolveGlobal<tsFloat>("b");
+		tsGlobalHandle<tsFloat> c = runtime.ResolveGlobal<tsFloat>("c");
+		tsCHECK(a.valid() && b.valid() && c.valid());
+		tsCHECK(runtime.SetGlobal(a, 2.0f));
+		tsCHECK(runtime.SetGlobal(b, 3.0f));
+		runtime.Run();
+		tsCHECK(runtime.GetGlobal(c) == 5.0f);
+
+		// Reloading the same script keeps its handles usable
+		tsCHECK(runtime.LoadScript(0));
+		tsCHECK(runtime.SetGlobal(a, 1.0f));
+	}
+
+	tsTEST(GlobalHandlesAreRefusedByOtherScripts)
+	{
+		std::shared_ptr<tsContext> context = AddContext();
+		tsRuntime runtime(context);
+		runtime.LoadScript(0);
+		tsGlobalHandle<tsFloat> a = runtime.ResolveGlobal<tsFloat>("a");
+		runtime.LoadScript(1);
+		runtime.SetGlobal<tsFloat>("a", 7.0f);
+		tsCHECK(!runtime.SetGlobal(a, 1.0f));
+		tsCHECK(runtime.GetGlobal(a) == 0.0f);
+		tsCHECK(runtime.GetGlobal<tsFloat>("a") == 7.0f);
+
+		tsGlobalHandle<tsFloat> unresolved;
+		tsCHECK(!unresolved.valid());
+		tsCHECK(!runtime.SetGlobal(unresolved, 1.0f));
+		tsCHECK(runtime.GetGlobal<tsFloat>("a") == 7.0f);
+	}
+
+	// A bind that fails must leave the bindings that were there before it alone
+	tsTEST(FailedBindsKeepEarlierBindings)
+	{
+		tsScript script = AddScript();
+		std::string error;
+		tsCHECK(script.load(error));
+		tsInstance instance(script);
+		instance.memory.set<tsFloat>(0, 2.0f);
+		instance.memory.set<tsFloat>(4, 3.0f);
+
+		tsBinding binding;
+		tsFloat c = 0;
+		tsCHECK(binding.bindPointer(script, 8, sizeof(tsFloat), &c, error));
+		size_t segments = binding.bases.size();
+		// Both of these only cover part of an operand
+		tsFloat other = 0;
+		tsCHECK(!binding.bindPointer(script, 2, sizeof(tsFloat), &other, error));
+		tsCHECK(!binding.bindToRecord(script, 8, 2, 0, error));
+		tsCHECK(binding.bases.size() == segments);
+
+		binding.bases[tsBinding::memorySegment] = instance.memory.data();
+		tsExecuteBound(binding.instructions.data(), binding.bases.data());
+		tsCHECK(c == 5.0f);
+		tsCHECK(other == 0.0f);
+	}
+
+	// Stands in for a header written by tsGlobalLayout::header, the hash is filled in once the script is loaded
+	struct AddRecord
+	{
+		static inline std::uint64_t tsLayoutHash = 0;
+		tsFloat a;
+		tsFloat b;
+		tsFloat c;
+	};
+
+	// A host struct keeping the globals in an order of its own with padding and other members in between
+	struct PaddedRecord
+	{
+		char tag;
+		tsFloat c;
+		double other;
+		tsFloat b;
+		bool flag;
+		tsFloat a;
+	};
+
+	tsTEST(RecordsCopyEveryGlobal)
+	{
+		std::shared_ptr<tsContext> context = AddContext();
+		tsRuntime runtime(context);
+		runtime.LoadScript(0);
+		const tsGlobalLayout& layout = context->scripts[0].layout;
+
+		std::string header = layout.header("AddRecord");
+		tsCHECK(header.find("struct AddRecord") != std::string::npos);
+		tsCHECK(header.find("float c; // #ref, slot 8") != std::string::npos);
+		tsCHECK(header.find("static_assert(sizeof(AddRecord) == 12") != std::string::npos);
+		char hash[32];
+		std::snprintf(hash, sizeof(hash), "0x%016llxull", (unsigned long long)layout.hash);
+		tsCHECK(header.find(hash) != std::string::npos);
+
+		// The globals have no gaps between them, so they are copied with a single memcpy
+		tsCopyPlan plan;
+		std::string error;
+		tsCHECK(plan.build(context->scripts[0], layout, error));
+		tsCHECK(plan.copies.size() == 1);
+
+		tsCHECK(!runtime.LayoutMatches<AddRecord>());
+		AddRecord::tsLayoutHash = layout.hash;
+		tsCHECK(runtime.LayoutMatches<AddRecord>());
+		AddRecord in = { 2.0f, 3.0f, 0.0f };
+		runtime.SetGlobals(in);
+		runtime.Run();
+		AddRecord out = {};
+		runtime.GetGlobals(out);
+		tsCHECK(out.a == 2.0f && out.b == 3.0f && out.c == 5.0f);
+
+		// A different script has a different layout
+		context->scripts[1].globals[2].identifier = "sum";
+		runtime.LoadScript(1);
+		tsCHECK(!runtime.LayoutMatches<AddRecord>());
+
+		tsGlobalLayout padded;
+		padded.add("a", tsVarType::tsFloat, offsetof(PaddedRecord, a));
+		padded.add("b", tsVarType::tsFloat, offsetof(PaddedRecord, b));
+		padded.add("sum", tsVarType::tsFloat, offsetof(PaddedRecord, c));
+		PaddedRecord host;
+		std::memset(&host, 0, sizeof(host));
+		host.a = 1.5f;
+		host.b = 4.0f;
+		tsCHECK(runtime.SetGlobals(&host, padded));
+		runtime.Run();
+		PaddedRecord result;
+		std::memset(&result, 0x5a, sizeof(result));
+		tsCHECK(runtime.GetGlobals(&result, padded));
+		tsCHECK(result.a == 1.5f && result.b == 4.0f && result.c == 5.5f);
+		// Only the globals are written, everything else in the record is left alone
+		tsCHECK(result.tag == 0x5a && reinterpret_cast<const unsigned char&>(result.flag) == 0x5a);
+
+		// A field of the wrong type is refused
+		tsGlobalLayout wrong;
+		wrong.add("a", tsVarType::tsInt, 0);
+		tsCHECK(!runtime.SetGlobals(&host, wrong));
+	}
+}
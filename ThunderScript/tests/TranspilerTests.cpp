@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+#include "tsTest.h"
+#include "ThunderScript.h"
+#include "ThunderScriptCompiler.h"
+#include "tsTranspiler.h"
+#include "tsNative.h"
+#include "tsTiered.h"
+
+namespace ts
+{
+	// Compile a script file with the default passes into a context of its own
+	static std::shared_ptr<tsContext> CompileScript(const std::string& path)
+	{
+		std::shared_ptr<tsContext> context = std::make_shared<tsContext>();
+		tsCompiler compiler(context);
+		tsCHECK(compiler.compileFile(path));
+		return context;
+	}
+
+	// The slot allocator puts an int and a float temporary of Arithmetic in the same slot, that slot must still
+	// become locals instead of being read and written in memory
+	tsTEST(TranspiledSharedSlotsStayLocal)
+	{
+		std::shared_ptr<tsContext> context = CompileScript("scripts/Arithmetic.thun");
+		if (!tsCHECK(!context->scripts.empty()))
+			return;
+		const tsScript& script = context->scripts[0];
+		std::vector<tsTranspiledSlot> slots = tsTranspiledSlots(script);
+		tsCHECK(std::any_of(slots.begin(), slots.end(), [](const tsTranspiledSlot& s) { return s.shared && s.local; }));
+
+		std::string source, error;
+		if (!tsCHECK(tsTranspile(script, "Arithmetic", source, error)))
+			return;
+		// Past the declarations of the locals only the final write back touches memory
+		size_t body = source.find("\n\n", source.find("extern \"C\""));
+		size_t end = source.find("end:\n", body);
+		tsCHECK(body != std::string::npos && end != std::string::npos);
+		tsCHECK(source.find("memory + ", body) > end);
+	}
+
+	// Give every global of an instance a value that depends on where it is
+	static void SetGlobals(const tsScript& script, tsInstance& instance)
+	{
+		for (const tsGlobal& g : script.globals)
+		{
+			if (g.type == tsVarType::tsInt)
+				instance.memory.set<tsInt>(g.index, (tsInt)g.index - 3);
+			else if (g.type == tsVarType::tsFloat)
+				instance.memory.set<tsFloat>(g.index, (tsFloat)g.index * 0.75f - 1.0f);
+			else
+				instance.memory.set<tsBool>(g.index, g.index % 2 == 0);
+		}
+	}
+
+	// Count the globals two instances of a script disagree on
+	static size_t DifferentGlobals(const tsScript& script, const tsInstance& a, const tsInstance& b)
+	{
+		size_t different = 0;
+		for (const tsGlobal& g : script.globals)
+		{
+			if (g.type == tsVarType::tsInt)
+				different += a.memory.read<tsInt>(g.index) != b.memory.read<tsInt>(g.index);
+			else if (g.type == tsVarType::tsFloat)
+				different += a.memory.read<tsFloat>(g.index) != b.memory.read<tsFloat>(g.index);
+			else
+				different += a.memory.read<tsBool>(g.index) != b.memory.read<tsBool>(g.index);
+		}
+		return different;
+	}
+
+#if TS_NATIVE
+	// Objects built by these tests go here instead of the user's cache. It is emptied the first time it is asked for,
+	// so every run of the tests really compiles its scripts.
+	static std::filesystem::path TestCacheDirectory()
+	{
+		static const std::filesystem::path directory = [] {
+			std::error_code ec;
+			std::filesystem::path path = std::filesystem::temp_directory_path(ec) / ("thunderscript-tests-" + std::to_string(geteuid()));
+			std::filesystem::remove_all(path, ec);
+			return path;
+		}();
+		return directory;
+	}
+
+	// tsNativeCompiler::global() reads TS_CACHE_DIR when it is first used, point it at the test directory before that
+	static tsNativeCompiler& TestGlobalCompiler()
+	{
+		setenv("TS_CACHE_DIR", TestCacheDirectory().c_str(), 1);
+		tsNativeCompiler& compiler = tsNativeCompiler::global();
+		tsCHECK(compiler.cacheDirectory == TestCacheDirectory());
+		return compiler;
+	}
+#endif
+
+	// Transpile the sample scripts, build them with warnings as errors and check they leave every global the way the
+	// interpreter does. Skipped when there is no C++ compiler.
+	tsTEST(TranspiledScriptsMatchTheInterpreter)
+	{
+	#if TS_NATIVE
+		tsNativeCompiler compiler;
+		compiler.cacheDirectory = TestCacheDirectory();
+		compiler.flags += " -Wall -Wextra -Werror";
+		if (!compiler.compilerAvailable())
+		{
+			std::cout << "  skipped, no C++ compiler found" << std::endl;
+			return;
+		}
+		for (const char* path : { "scripts/HelloWorld.thun", "scripts/Arithmetic.thun" })
+		{
+			std::shared_ptr<tsContext> context = CompileScript(path);
+			if (!tsCHECK(!context->scripts.empty()))
+				continue;
+			const tsScript& script = context->scripts[0];
+			std::string error;
+			tsNativeEntry entry = compiler.compile(script, error);
+			if (!tsCHECK(entry != nullptr))
+			{
+				std::cout << "  " << path << ": " << error << std::endl;
+				continue;
+			}
+			tsInstance interpreted(script), native(script);
+			SetGlobals(script, interpreted);
+			SetGlobals(script, native);
+			tsExecute(script, interpreted);
+			entry(native.memory.data());
+			tsCHECK(DifferentGlobals(script, interpreted, native) == 0);
+		}
+	#endif
+	}
+
+	// Compile HelloWorld with tsNativeRuntime and check the object lands in TS_CACHE_DIR and gives the same globals
+	// as the interpreter. Skipped when there is no C++ compiler.
+	tsTEST(NativeRuntimeMatchesTheInterpreter)
+	{
+	#if TS_NATIVE
+		if (!TestGlobalCompiler().compilerAvailable())
+		{
+			std::cout << "  skipped, no C++ compiler found" << std::endl;
+			return;
+		}
+		std::shared_ptr<tsContext> interpretedContext = CompileScript("scripts/HelloWorld.thun");
+		std::shared_ptr<tsContext> nativeContext = CompileScript("scripts/HelloWorld.thun");
+		if (!tsCHECK(!interpretedContext->scripts.empty() && !nativeContext->scripts.empty()))
+			return;
+		tsRuntime interpreted(interpretedContext);
+		tsNativeRuntime native(nativeContext);
+		interpreted.LoadScript(0);
+		native.LoadScript(0);
+		if (!tsCHECK(native.CompileNative() && native.compiled()))
+			return;
+		std::error_code ec;
+		tsCHECK(std::filesystem::exists(TestCacheDirectory() / (tsNativeCompiler::global().symbol(nativeContext->scripts[0]) + ".so"), ec));
+
+		for (tsFloat a : { 2.0f, -1.5f, 1e30f })
+		{
+			for (tsRuntime* runtime : { &interpreted, (tsRuntime*)&native })
+			{
+				runtime->SetGlobal<tsFloat>("a", a);
+				runtime->SetGlobal<tsFloat>("b", 3.0f);
+				runtime->Run();
+			}
+			tsCHECK(interpreted.GetGlobal<tsFloat>("c") == native.GetGlobal<tsFloat>("c"));
+		}
+	#endif
+	}
+
+	// Run Arithmetic on a tiered runtime with thresholds low enough that it asks for native code on its third run, and
+	// keep running it until the build is installed. Every run has to match the interpreter, whatever tier it ran on.
+	// Skipped when there is no C++ compiler.
+	tsTEST(TieredRuntimeReachesNative)
+	{
+	#if TS_NATIVE
+		if (!TestGlobalCompiler().compilerAvailable())
+		{
+			std::cout << "  skipped, no C++ compiler found" << std::endl;
+			return;
+		}
+		std::shared_ptr<tsContext> interpretedContext = CompileScript("scripts/Arithmetic.thun");
+		std::shared_ptr<tsContext> tieredContext = CompileScript("scripts/Arithmetic.thun");
+		if (!tsCHECK(!interpretedContext->scripts.empty() && !tieredContext->scripts.empty()))
+			return;
+		tsTierThresholds thresholds;
+		thresholds.decodedRuns = 1;
+		thresholds.nativeRuns = 2;
+		tsRuntime interpreted(interpretedContext);
+		tsTieredRuntime tiered(tieredContext, thresholds);
+		interpreted.LoadScript(0);
+		tiered.LoadScript(0);
+
+		size_t different = 0;
+		auto compare = [&]() {
+			for (const char* name : { "a", "b", "c" })
+				different += interpreted.GetGlobal<tsFloat>(name) != tiered.GetGlobal<tsFloat>(name);
+			for (const char* name : { "d", "e" })
+				different += interpreted.GetGlobal<tsInt>(name) != tiered.GetGlobal<tsInt>(name);
+		};
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(120);
+		for (tsInt run = 0; tiered.tier() != tsTier::tsNative && std::chrono::steady_clock::now() < deadline; run++)
+		{
+			for (tsRuntime* runtime : { &interpreted, (tsRuntime*)&tiered })
+			{
+				runtime->SetGlobal<tsFloat>("a", 1.5f);
+				runtime->SetGlobal<tsFloat>("b", 2.25f);
+				runtime->SetGlobal<tsFloat>("c", (tsFloat)run);
+				runtime->SetGlobal<tsInt>("d", run);
+				runtime->SetGlobal<tsInt>("e", 4);
+			}
+			interpreted.Run();
+			tiered.Run();
+			compare();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		if (!tsCHECK(tiered.tier() == tsTier::tsNative))
+			return;
+
+		// One more run on the native code
+		for (tsRuntime* runtime : { &interpreted, (tsRuntime*)&tiered })
+		{
+			runtime->SetGlobal<tsFloat>("c", -0.5f);
+			runtime->SetGlobal<tsInt>("d", 3);
+			runtime->Run();
+		}
+		compare();
+		tsCHECK(different == 0);
+	#endif
+	}
+}
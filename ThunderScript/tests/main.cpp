@@ -0,0 +1,19 @@
+#include <iostream>
+#include "tsTest.h"
+
+// Runs every registered test. Tests that read scripts expect to be run from the ThunderScript directory.
+int main()
+{
+	size_t failed = 0;
+	for (const ts::tsTestCase& test : ts::tsTests())
+	{
+		size_t failures = ts::tsTestFailures();
+		test.run();
+		bool passed = ts::tsTestFailures() == failures;
+		std::cout << (passed ? "[pass] " : "[FAIL] ") << test.name << std::endl;
+		if (!passed)
+			failed++;
+	}
+	std::cout << ts::tsTests().size() - failed << " of " << ts::tsTests().size() << " tests passed" << std::endl;
+	return (int)failed;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace ts
+{
+	// A minimal test harness, tests register themselves with tsTEST and main runs them all.
+	// A test fails if any tsCHECK in it does, the program returns the number of tests that failed.
+	struct tsTestCase
+	{
+		const char* name;
+		void (*run)();
+	};
+
+	inline std::vector<tsTestCase>& tsTests()
+	{
+		static std::vector<tsTestCase> tests;
+		return tests;
+	}
+
+	inline size_t& tsTestFailures()
+	{
+		static size_t failures = 0;
+		return failures;
+	}
+
+	struct tsRegisterTest
+	{
+		tsRegisterTest(const char* name, void (*run)())
+		{
+			tsTests().push_back({ name, run });
+		}
+	};
+
+	inline bool tsCheck(bool passed, const char* condition, const char* file, int line)
+	{
+		if (!passed)
+		{
+			std::cout << "  " << file << ":" << line << ": check failed: " << condition << std::endl;
+			tsTestFailures()++;
+		}
+		return passed;
+	}
+}
+
+#define tsTEST(name) \
+	static void name(); \
+	static ts::tsRegisterTest name##Registration(#name, name); \
+	static void name()
+
+#define tsCHECK(condition) ts::tsCheck((condition), #condition, __FILE__, __LINE__)
@@ -0,0 +1,48 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ThunderScript.h"
+#include "ThunderScriptCompiler.h"
+#include "tsSuperinstructionGenerator.h"
+
+// Profiles scripts on the bytecode interpreter and writes the superinstructions that would save the most dispatches
+// to src/tsSuperinstructions.h. Run it from the ThunderScript directory and rebuild everything afterwards.
+// Usage: GenerateSuperinstructions [script...], HelloWorld and Arithmetic are profiled when no scripts are given.
+int main(int argc, char** argv)
+{
+	std::vector<std::string> paths(argv + 1, argv + argc);
+	if (paths.empty())
+		paths = { "scripts/HelloWorld.thun", "scripts/Arithmetic.thun" };
+
+	std::shared_ptr<ts::tsContext> context = std::make_shared<ts::tsContext>();
+	ts::tsOpcodeProfile profile;
+	try
+	{
+		ts::tsCompiler compiler(context);
+		for (const std::string& path : paths)
+		{
+			if (!compiler.compileFile(path))
+			{
+				std::cout << "Could not read " << path << std::endl;
+				return 1;
+			}
+			ts::tsRuntime runtime(context);
+			runtime.LoadScript((ts::tsIndex)context->scripts.size() - 1);
+			runtime.Profile(profile);
+		}
+	}
+	catch (ts::tsCompileError error)
+	{
+		error.display();
+		return 1;
+	}
+
+	std::string error;
+	if (!ts::tsWriteSuperinstructions(profile, 16, "src/tsSuperinstructions.h", error))
+	{
+		std::cout << "Could not write superinstructions: " << error << std::endl;
+		return 1;
+	}
+	std::cout << "Wrote src/tsSuperinstructions.h, rebuild to use them" << std::endl;
+	return 0;
+}